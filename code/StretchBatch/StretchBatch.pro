@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# 批量拉伸命令行程序(不依赖Qt)
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = StretchBatch
+TEMPLATE = app
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+
+SOURCES += \
+        main.cpp
+
+include(../StretchEngine/stretchengine.pri)
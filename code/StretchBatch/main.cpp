@@ -0,0 +1,437 @@
+﻿// 批量拉伸命令行程序
+// 将多景影像拉伸后输出为8位RGB(A) GeoTIFF或COG，用于批量生成快视图
+// 多景影像同时处理，每景影像内部再分块并行，总线程数不超过 -threads 指定的数目
+// 镶嵌模式(-mosaic)先统计所有影像并合并统计信息，所有影像按同一组统计信息拉伸，镶嵌后没有接缝
+
+#include <gdal.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stretchengine.hpp"
+#include "mosaic.hpp"
+#include "rasterstream.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+namespace
+{
+
+// 目录中按扩展名识别的影像文件
+const char* const IMAGE_EXTENSIONS[] = {"tif", "tiff", "img", "jpg", "jpeg"};
+
+struct BatchOptions
+{
+    int  iBands[3] = {0, 0, 0};     // 为0时按波段数取1,2,3
+    rsisa::StretchAlgorithm eAlg = rsisa::SA_Linear;
+    rsisa::StreamOptions stream;
+    rsisa::OutputOptions output;
+    rsisa::ClaheOptions clahe;
+    std::string osSuffix;
+    bool bOverwrite = false;
+    bool bMosaic = false;
+    std::string osMosaicStats;      // 保存合并统计信息的文件，为空时不保存
+    int  nThreads = 0;
+    int  nJobs = 0;
+};
+
+void Usage(const char* pszError = nullptr)
+{
+    printf("Usage: StretchBatch [-b <r> <g> <b>] [-alg none|linear|clip|equalize|gauss|clahe]\n"
+           "                    [-clahe_tile <pixels>] [-clahe_clip <factor>]\n"
+           "                    [-nodata <value>|none] [-bandnodata] [-of GTiff|COG] [-noalpha]\n"
+           "                    [-co <NAME>=<VALUE>]... [-suffix <text>] [-overwrite]\n"
+           "                    [-threads <n>|ALL_CPUS] [-jobs <n>] [-nocache]\n"
+           "                    [-mosaic] [-mosaic_stats <file>]\n"
+           "                    [-input_file_list <file>] <input file|directory>... <output directory>\n"
+           "\n"
+           "  -alg         clip: 2%% linear stretch, equalize: histogram equalization,\n"
+           "               gauss: histogram specification (normal distribution),\n"
+           "               clahe: contrast limited adaptive histogram equalization\n"
+           "  -clahe_tile  CLAHE tile size in pixels (default 512)\n"
+           "  -clahe_clip  CLAHE clip limit, multiple of the mean count of used bins (default 3)\n"
+           "  -nodata      pixel value excluded from statistics (default 0, none: no nodata)\n"
+           "  -bandnodata  use the nodata value of each band when it is set\n"
+           "  -threads     total thread budget (default: RSISA_NUM_THREADS or CPU count)\n"
+           "  -jobs        number of scenes processed concurrently (default: min(scenes, threads))\n"
+           "  -mosaic      stretch all scenes with statistics merged over all of them (VRT inputs\n"
+           "               contribute their source files)\n"
+           "  -mosaic_stats  merged statistics file (implies -mosaic): scenes already merged in it are\n"
+           "               not read again, new scenes are merged and the file is updated\n");
+    if(pszError != nullptr){
+        fprintf(stderr, "\nFAILURE: %s\n", pszError);
+    }
+    exit(1);
+}
+
+bool ParseAlgorithm(const char* pszName, rsisa::StretchAlgorithm& eAlg)
+{
+    if(EQUAL(pszName, "none")){ eAlg = rsisa::SA_None; }
+    else if(EQUAL(pszName, "linear")){ eAlg = rsisa::SA_Linear; }
+    else if(EQUAL(pszName, "clip")){ eAlg = rsisa::SA_PercentClip; }
+    else if(EQUAL(pszName, "equalize")){ eAlg = rsisa::SA_Equalize; }
+    else if(EQUAL(pszName, "gauss")){ eAlg = rsisa::SA_GaussSpec; }
+    else if(EQUAL(pszName, "clahe")){ eAlg = rsisa::SA_Clahe; }
+    else { return false; }
+    return true;
+}
+
+bool IsImageFile(const char* pszFilename)
+{
+    const char* pszExt = CPLGetExtension(pszFilename);
+    for(size_t i=0;i<sizeof(IMAGE_EXTENSIONS)/sizeof(IMAGE_EXTENSIONS[0]);++i){
+        if(EQUAL(pszExt, IMAGE_EXTENSIONS[i])){ return true; }
+    }
+    return false;
+}
+
+// 添加输入：目录中的影像文件按文件名排序加入，其它直接加入
+void AddInput(const std::string& osInput, std::vector<std::string>& inputs)
+{
+    VSIStatBufL sStat;
+    if(VSIStatL(osInput.c_str(), &sStat) == 0 && VSI_ISDIR(sStat.st_mode)){
+        char** papszFiles = VSIReadDir(osInput.c_str());
+        std::vector<std::string> files;
+        for(int i=0;papszFiles != nullptr && papszFiles[i] != nullptr;++i){
+            if(IsImageFile(papszFiles[i])){
+                files.push_back(CPLFormFilename(osInput.c_str(), papszFiles[i], nullptr));
+            }
+        }
+        CSLDestroy(papszFiles);
+        std::sort(files.begin(), files.end());
+        inputs.insert(inputs.end(), files.begin(), files.end());
+        return;
+    }
+    inputs.push_back(osInput);
+}
+
+// 读取文件列表，每行一个文件或目录，忽略空行和#开头的行
+bool AddInputList(const char* pszListFile, std::vector<std::string>& inputs)
+{
+    VSILFILE* fp = VSIFOpenL(pszListFile, "r");
+    if(fp == nullptr){
+        return false;
+    }
+    const char* pszLine = nullptr;
+    while((pszLine = CPLReadLineL(fp)) != nullptr){
+        std::string osLine(pszLine);
+        const size_t nBegin = osLine.find_first_not_of(" \t");
+        if(nBegin == std::string::npos || osLine[nBegin] == '#'){
+            continue;
+        }
+        osLine = osLine.substr(nBegin, osLine.find_last_not_of(" \t") - nBegin + 1);
+        AddInput(osLine, inputs);
+    }
+    VSIFCloseL(fp);
+    return true;
+}
+
+// 使用的波段：没有指定时按波段数取1,2,3
+void ResolveBands(const BatchOptions& opts, int nBands, int iBands[3])
+{
+    for(int c=0;c<3;++c){
+        iBands[c] = (opts.iBands[c] > 0)? opts.iBands[c] : std::min(c + 1, nBands);
+    }
+}
+
+// 镶嵌模式：统计所有影像并与已保存的统计信息合并，确定所有影像使用的波段
+bool ComputeMosaic(const std::vector<std::string>& inputs, BatchOptions& opts, int nThreads,
+                   rsisa::MosaicStats& mosaic)
+{
+    if(!opts.osMosaicStats.empty() && rsisa::LoadMosaicStats(opts.osMosaicStats.c_str(), mosaic)){
+        printf("%d scene(s) already merged in %s\n", static_cast<int>(mosaic.scenes.size()),
+               opts.osMosaicStats.c_str());
+    }
+    std::vector<std::string> scenes;
+    for(size_t i=0;i<inputs.size();++i){
+        std::vector<std::string> files;
+        if(rsisa::MosaicSceneFiles(inputs[i].c_str(), files) != CE_None){
+            fprintf(stderr, "%s\n", CPLGetLastErrorMsg());
+            return false;
+        }
+        scenes.insert(scenes.end(), files.begin(), files.end());
+    }
+
+    // 波段：指定的波段，其次为已保存的统计信息的波段，否则按第一景影像的波段数确定
+    int iBands[3];
+    if(opts.iBands[0] == 0 && mosaic.bands.size() == 3){
+        std::copy(mosaic.bands.begin(), mosaic.bands.end(), iBands);
+    }
+    else {
+        GDALDatasetH hDset = GDALOpen(scenes.empty()? inputs[0].c_str() : scenes[0].c_str(), GA_ReadOnly);
+        if(hDset == nullptr){
+            fprintf(stderr, "%s\n", CPLGetLastErrorMsg());
+            return false;
+        }
+        ResolveBands(opts, GDALGetRasterCount(hDset), iBands);
+        GDALClose(hDset);
+    }
+
+    rsisa::ThreadPool pool(nThreads);
+    rsisa::StreamOptions stream = opts.stream;
+    stream.pPool = &pool;
+    stream.pfnProgress = GDALTermProgress;
+    printf("Computing mosaic statistics of %d scene(s)\n", static_cast<int>(scenes.size()));
+    if(rsisa::AddMosaicScenes(mosaic, scenes, iBands, 3, stream) != CE_None){
+        fprintf(stderr, "Mosaic statistics failed: %s\n", CPLGetLastErrorMsg());
+        return false;
+    }
+    if(!opts.osMosaicStats.empty() && !rsisa::SaveMosaicStats(opts.osMosaicStats.c_str(), mosaic)){
+        fprintf(stderr, "%s\n", CPLGetLastErrorMsg());
+        return false;
+    }
+    std::copy(iBands, iBands + 3, opts.iBands);
+    return true;
+}
+
+// 各输入影像的输出文件：输出目录下与输入同名、加上后缀的.tif文件
+// 不同目录中的同名影像(或重复给出的同一影像)会输出到同一文件，逐个报告后返回false
+// 按不区分大小写比较，Windows上只有大小写不同的文件名也是同一文件
+bool MakeOutputFiles(const std::vector<std::string>& inputs, const std::string& osOutDir,
+                     const std::string& osSuffix, std::vector<std::string>& outputs)
+{
+    std::map<std::string, size_t> owners;
+    bool bOk = true;
+    outputs.clear();
+    for(size_t i=0;i<inputs.size();++i){
+        outputs.push_back(CPLFormFilename(osOutDir.c_str(),
+                                          (CPLGetBasename(inputs[i].c_str()) + osSuffix).c_str(), "tif"));
+        std::string osKey = outputs.back();
+        std::transform(osKey.begin(), osKey.end(), osKey.begin(),
+                       [](char ch){ return static_cast<char>(toupper(static_cast<unsigned char>(ch))); });
+        const auto res = owners.insert(std::make_pair(osKey, i));
+        if(!res.second){
+            fprintf(stderr, "%s and %s would both be written to %s\n",
+                    inputs[res.first->second].c_str(), inputs[i].c_str(), outputs.back().c_str());
+            bOk = false;
+        }
+    }
+    return bOk;
+}
+
+// 处理一景影像，失败时返回false并在osError中给出原因
+// pStats不为空时为镶嵌统计信息，不再统计影像本身
+bool RunJob(const std::string& osInput, const std::string& osOutput, const BatchOptions& opts,
+            const rsisa::BandStats* pStats, rsisa::ThreadPool& pool, std::string& osError)
+{
+    GDALDatasetH hDset = GDALOpen(osInput.c_str(), GA_ReadOnly);
+    if(hDset == nullptr){
+        osError = CPLGetLastErrorMsg();
+        return false;
+    }
+    const int nBands = GDALGetRasterCount(hDset);
+    int iBands[3];
+    ResolveBands(opts, nBands, iBands);
+    if(nBands == 0 || *std::max_element(iBands, iBands + 3) > nBands){
+        GDALClose(hDset);
+        osError = CPLSPrintf("Band index out of range (%d bands)", nBands);
+        return false;
+    }
+
+    rsisa::StreamOptions stream = opts.stream;
+    stream.pPool = &pool;
+    CPLErr err = rsisa::StretchToGeoTIFF(hDset, osOutput.c_str(), iBands, opts.eAlg, stream, opts.output,
+                                         opts.clahe, pStats);
+    GDALClose(hDset);
+    if(err != CE_None){
+        osError = CPLGetLastErrorMsg();
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    GDALAllRegister();
+    argc = GDALGeneralCmdLineProcessor(argc, &argv, 0);
+    if(argc < 1){
+        exit(-argc);
+    }
+
+    BatchOptions opts;
+    std::vector<std::string> inputs;
+    std::vector<std::string> args;
+    for(int i=1;i<argc;++i){
+        const char* pszArg = argv[i];
+        const bool bHasValue = i + 1 < argc;
+        if(EQUAL(pszArg, "-b") && i + 3 < argc){
+            for(int c=0;c<3;++c){
+                opts.iBands[c] = atoi(argv[++i]);
+                if(opts.iBands[c] <= 0){ Usage("Band index must be positive"); }
+            }
+        }
+        else if(EQUAL(pszArg, "-alg") && bHasValue){
+            if(!ParseAlgorithm(argv[++i], opts.eAlg)){ Usage("Unknown algorithm"); }
+        }
+        else if(EQUAL(pszArg, "-clahe_tile") && bHasValue){
+            opts.clahe.nTileSize = atoi(argv[++i]);
+            if(opts.clahe.nTileSize < 16){ Usage("CLAHE tile size must be at least 16"); }
+        }
+        else if(EQUAL(pszArg, "-clahe_clip") && bHasValue){
+            opts.clahe.dfClipLimit = CPLAtof(argv[++i]);
+        }
+        else if(EQUAL(pszArg, "-nodata") && bHasValue){
+            const char* pszValue = argv[++i];
+            opts.stream.dfNoData = EQUAL(pszValue, "none")? std::numeric_limits<double>::quiet_NaN()
+                                                          : CPLAtof(pszValue);
+        }
+        else if(EQUAL(pszArg, "-bandnodata")){
+            opts.stream.bUseBandNoData = true;
+        }
+        else if(EQUAL(pszArg, "-of") && bHasValue){
+            const char* pszFormat = argv[++i];
+            if(EQUAL(pszFormat, "GTiff")){ opts.output.eFormat = rsisa::OF_GTiff; }
+            else if(EQUAL(pszFormat, "COG")){ opts.output.eFormat = rsisa::OF_COG; }
+            else { Usage("Output format must be GTiff or COG"); }
+        }
+        else if(EQUAL(pszArg, "-noalpha")){
+            opts.output.bAlpha = false;
+        }
+        else if(EQUAL(pszArg, "-co") && bHasValue){
+            opts.output.creationOptions.push_back(argv[++i]);
+        }
+        else if(EQUAL(pszArg, "-suffix") && bHasValue){
+            opts.osSuffix = argv[++i];
+        }
+        else if(EQUAL(pszArg, "-overwrite")){
+            opts.bOverwrite = true;
+        }
+        else if(EQUAL(pszArg, "-threads") && bHasValue){
+            const char* pszValue = argv[++i];
+            opts.nThreads = EQUAL(pszValue, "ALL_CPUS")? CPLGetNumCPUs() : atoi(pszValue);
+            if(opts.nThreads <= 0){ Usage("Thread count must be positive"); }
+        }
+        else if(EQUAL(pszArg, "-jobs") && bHasValue){
+            opts.nJobs = atoi(argv[++i]);
+            if(opts.nJobs <= 0){ Usage("Job count must be positive"); }
+        }
+        else if(EQUAL(pszArg, "-nocache")){
+            opts.stream.bUseStatsCache = false;
+        }
+        else if(EQUAL(pszArg, "-mosaic")){
+            opts.bMosaic = true;
+        }
+        else if(EQUAL(pszArg, "-mosaic_stats") && bHasValue){
+            opts.bMosaic = true;
+            opts.osMosaicStats = argv[++i];
+        }
+        else if(EQUAL(pszArg, "-input_file_list") && bHasValue){
+            if(!AddInputList(argv[++i], inputs)){ Usage("Cannot read input file list"); }
+        }
+        else if(pszArg[0] == '-' && pszArg[1] != '\0'){
+            Usage(CPLSPrintf("Unknown option or missing value: %s", pszArg));
+        }
+        else {
+            args.push_back(pszArg);
+        }
+    }
+    if(args.empty() || (args.size() == 1 && inputs.empty())){
+        Usage("No input or output given");
+    }
+    const std::string osOutDir = args.back();
+    args.pop_back();
+    for(size_t i=0;i<args.size();++i){
+        AddInput(args[i], inputs);
+    }
+    if(inputs.empty()){
+        Usage("No input image found");
+    }
+    std::vector<std::string> outputs;
+    if(!MakeOutputFiles(inputs, osOutDir, opts.osSuffix, outputs)){
+        fprintf(stderr, "Output file names conflict, rename the inputs or process them separately\n");
+        exit(1);
+    }
+    VSIStatBufL sStat;
+    if(VSIStatL(osOutDir.c_str(), &sStat) != 0 && VSIMkdirRecursive(osOutDir.c_str(), 0755) != 0){
+        Usage("Cannot create output directory");
+    }
+
+    // 线程分配：同时处理nJobs景影像，每景影像分块并行使用nThreads/nJobs个线程
+    const int nThreads = (opts.nThreads > 0)? opts.nThreads : rsisa::ThreadPool::DefaultThreadCount();
+    rsisa::MosaicStats mosaic;
+    if(opts.bMosaic && !ComputeMosaic(inputs, opts, nThreads, mosaic)){
+        exit(1);
+    }
+    const rsisa::BandStats* pMosaicStats = opts.bMosaic? mosaic.stats.data() : nullptr;
+
+    const int nJobs = std::max(1, std::min(static_cast<int>(inputs.size()),
+                                           (opts.nJobs > 0)? opts.nJobs : nThreads));
+    const int nTileThreads = std::max(1, nThreads / nJobs);
+    printf("%d scene(s), %d concurrent job(s) x %d thread(s)\n",
+           static_cast<int>(inputs.size()), nJobs, nTileThreads);
+
+    std::atomic<size_t> nNext(0);
+    std::atomic<int> nFailed(0);
+    std::mutex logMutex;
+    const auto worker = [&](){
+        rsisa::ThreadPool pool(nTileThreads);
+        for(;;){
+            const size_t i = nNext.fetch_add(1);
+            if(i >= inputs.size()){ break; }
+            const std::string& osInput = inputs[i];
+            const std::string& osOutput = outputs[i];
+            VSIStatBufL sOutStat;
+            if(!opts.bOverwrite && VSIStatL(osOutput.c_str(), &sOutStat) == 0){
+                std::lock_guard<std::mutex> lock(logMutex);
+                printf("[%d/%d] %s: skipped, output exists\n", static_cast<int>(i + 1),
+                       static_cast<int>(inputs.size()), osInput.c_str());
+                continue;
+            }
+
+            const auto tStart = std::chrono::steady_clock::now();
+            std::string osError;
+            const bool bOk = RunJob(osInput, osOutput, opts, pMosaicStats, pool, osError);
+            const double dfSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+            std::lock_guard<std::mutex> lock(logMutex);
+            if(bOk){
+                printf("[%d/%d] %s -> %s (%.2f s)\n", static_cast<int>(i + 1), static_cast<int>(inputs.size()),
+                       osInput.c_str(), osOutput.c_str(), dfSeconds);
+            }
+            else {
+                nFailed += 1;
+                fprintf(stderr, "[%d/%d] %s: %s\n", static_cast<int>(i + 1), static_cast<int>(inputs.size()),
+                        osInput.c_str(), osError.c_str());
+            }
+            fflush(stdout);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int j=1;j<nJobs;++j){
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for(size_t j=0;j<threads.size();++j){
+        threads[j].join();
+    }
+
+    if(nFailed > 0){
+        fprintf(stderr, "%d of %d scene(s) failed\n", nFailed.load(), static_cast<int>(inputs.size()));
+    }
+    // 配置项RSISA_TRACE开启时输出各阶段的耗时和计数
+    if(rsisa::IsTraceEnabled()){
+        printf("\n%s", rsisa::TraceSummary().c_str());
+        const std::string osTrace = rsisa::TraceOutputFile();
+        if(!osTrace.empty() && rsisa::WriteTraceJson(osTrace.c_str())){
+            printf("Trace written to %s\n", osTrace.c_str());
+        }
+    }
+    CSLDestroy(argv);
+    GDALDestroyDriverManager();
+    return nFailed > 0? 1 : 0;
+}
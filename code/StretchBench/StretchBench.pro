@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# 拉伸引擎性能测试(不依赖Qt)
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = StretchBench
+TEMPLATE = app
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+
+SOURCES += \
+        main.cpp
+
+include(../StretchEngine/stretchengine.pri)
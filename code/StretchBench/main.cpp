@@ -0,0 +1,664 @@
+﻿// 拉伸引擎性能测试
+// 在内存中生成模拟影像(可选写出为GeoTIFF)，分别测量统计、生成拉伸变换、拉伸输出和读写的速度，
+// 以及从1个线程到N个线程的加速情况，不需要外部数据
+// 结果可以输出为CSV或JSON，便于长期跟踪
+// -check 检查各指令集的拉伸内核与标量实现的结果是否逐字节相同
+
+#include <gdal.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "stretchengine.hpp"
+#include "rasterstream.hpp"
+#include "stretchkernel.hpp"
+#include "stretchsimd.hpp"
+#include "threadpool.hpp"
+
+namespace
+{
+
+const rsisa::StretchAlgorithm ALGORITHMS[] = {
+    rsisa::SA_Linear, rsisa::SA_PercentClip, rsisa::SA_Equalize, rsisa::SA_GaussSpec
+};
+
+const char* AlgorithmName(rsisa::StretchAlgorithm eAlg)
+{
+    switch(eAlg){
+    case rsisa::SA_Linear:      return "linear";
+    case rsisa::SA_PercentClip: return "clip";
+    case rsisa::SA_Equalize:    return "equalize";
+    case rsisa::SA_GaussSpec:   return "gauss";
+    default:                    return "none";
+    }
+}
+
+enum OutputFormat
+{
+    OF_Text = 0,
+    OF_CSV,
+    OF_JSON
+};
+
+struct BenchOptions
+{
+    std::vector<GDALDataType> types;
+    std::vector<int> sizes;
+    std::vector<double> nodataDensities;
+    std::vector<int> threads;
+    int nRepeat = 3;
+    bool bIO = false;
+    bool bCheck = false;
+    std::string osTmpDir;
+    OutputFormat eFormat = OF_Text;
+};
+
+// 一项测量结果
+struct Record
+{
+    std::string osStage;        // stats/lut/apply/write/stream_stats/stream_stretch
+    GDALDataType eType;
+    int nSize;                  // 影像宽高(正方形)
+    double dfNoDataDensity;
+    std::string osAlgorithm;
+    int nThreads;
+    double dfSeconds;           // 多次重复中最快的一次
+    double dfMPixPerSec;
+    double dfMBPerSec;          // 按输入数据字节数计算
+};
+
+// 模拟影像：平滑的渐变加噪声，按比例随机设置为无效值0
+// 有效像素的值不为0，与无效值区分
+std::vector<uint8_t> MakeRaster(GDALDataType eType, int nSize, double dfNoDataDensity)
+{
+    const size_t nCount = static_cast<size_t>(nSize) * nSize;
+    const int nTypeBytes = GDALGetDataTypeSizeBytes(eType);
+    std::vector<uint8_t> data(nCount * nTypeBytes);
+    std::mt19937 rng(12345);
+    std::normal_distribution<double> noise(0.0, 0.05);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for(int y=0;y<nSize;++y){
+        for(int x=0;x<nSize;++x){
+            const size_t i = static_cast<size_t>(y) * nSize + x;
+            // [0,1]之间的值
+            double v = 0.5 + 0.35 * std::sin(x * 0.01) * std::cos(y * 0.013) + noise(rng);
+            v = std::min(std::max(v, 0.0), 1.0);
+            const bool bNoData = uniform(rng) < dfNoDataDensity;
+            switch(eType){
+            case GDT_Byte:
+                data[i] = bNoData? 0 : static_cast<uint8_t>(1 + v * 254);
+                break;
+            case GDT_UInt16: {
+                uint16_t u = bNoData? 0 : static_cast<uint16_t>(1 + v * 4094);
+                memcpy(&data[i * 2], &u, sizeof(u));
+                break;
+            }
+            default: {
+                float f = bNoData? 0.0f : static_cast<float>(0.001 + v);
+                memcpy(&data[i * 4], &f, sizeof(f));
+                break;
+            }
+            }
+        }
+    }
+    return data;
+}
+
+// 多次运行fn，返回最快一次的秒数
+template<typename Fn>
+double BestOf(int nRepeat, Fn fn)
+{
+    double dfBest = 1e300;
+    for(int r=0;r<nRepeat;++r){
+        const auto tStart = std::chrono::steady_clock::now();
+        fn();
+        const double dfSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+        dfBest = std::min(dfBest, dfSeconds);
+    }
+    return std::max(dfBest, 1e-9);
+}
+
+Record MakeRecord(const char* pszStage, GDALDataType eType, int nSize, double dfNoDataDensity,
+                  const char* pszAlgorithm, int nThreads, double dfSeconds)
+{
+    const double dfPixels = static_cast<double>(nSize) * nSize;
+    Record rec;
+    rec.osStage = pszStage;
+    rec.eType = eType;
+    rec.nSize = nSize;
+    rec.dfNoDataDensity = dfNoDataDensity;
+    rec.osAlgorithm = pszAlgorithm;
+    rec.nThreads = nThreads;
+    rec.dfSeconds = dfSeconds;
+    rec.dfMPixPerSec = dfPixels / dfSeconds * 1e-6;
+    rec.dfMBPerSec = dfPixels * GDALGetDataTypeSizeBytes(eType) / dfSeconds / (1024.0 * 1024.0);
+    return rec;
+}
+
+// 内存中的统计、生成拉伸变换和拉伸输出
+void BenchMemory(const BenchOptions& opts, GDALDataType eType, int nSize, double dfNoDataDensity,
+                 std::vector<Record>& records)
+{
+    const std::vector<uint8_t> data = MakeRaster(eType, nSize, dfNoDataDensity);
+    rsisa::BandView band;
+    band.pData = data.data();
+    band.eType = eType;
+    band.nCount = static_cast<size_t>(nSize) * nSize;
+    band.dfNoData = 0.0;
+    const rsisa::BandView bands[3] = {band, band, band};
+    std::vector<uint8_t> rgba(band.nCount * 4);
+
+    for(size_t t=0;t<opts.threads.size();++t){
+        rsisa::ThreadPool pool(opts.threads[t]);
+        rsisa::BandStats stats;
+        double dfSeconds = BestOf(opts.nRepeat, [&](){ stats = rsisa::ComputeBandStats(band, &pool); });
+        records.push_back(MakeRecord("stats", eType, nSize, dfNoDataDensity, "", opts.threads[t], dfSeconds));
+
+        for(size_t a=0;a<sizeof(ALGORITHMS)/sizeof(ALGORITHMS[0]);++a){
+            const rsisa::StretchAlgorithm eAlg = ALGORITHMS[a];
+            rsisa::StretchTransform tr;
+            // 生成拉伸变换是单线程的，只在第一个线程数下测量
+            dfSeconds = BestOf(opts.nRepeat, [&](){ tr = rsisa::BuildTransform(eAlg, stats); });
+            if(t == 0){
+                // 耗时只与直方图大小有关，不计算吞吐量
+                Record rec = MakeRecord("lut", eType, nSize, dfNoDataDensity, AlgorithmName(eAlg), 1, dfSeconds);
+                rec.dfMPixPerSec = 0.0;
+                rec.dfMBPerSec = 0.0;
+                records.push_back(rec);
+            }
+            const rsisa::StretchTransform* transforms[3] = {&tr, &tr, &tr};
+            dfSeconds = BestOf(opts.nRepeat, [&](){ rsisa::ApplyStretchRGBA(bands, transforms, rgba.data(), &pool); });
+            records.push_back(MakeRecord("apply", eType, nSize, dfNoDataDensity, AlgorithmName(eAlg),
+                                         opts.threads[t], dfSeconds));
+        }
+    }
+}
+
+// 写出GeoTIFF，分块统计和分块拉伸输出
+void BenchIO(const BenchOptions& opts, GDALDataType eType, int nSize, double dfNoDataDensity,
+             std::vector<Record>& records)
+{
+    GDALDriverH hDriver = GDALGetDriverByName("GTiff");
+    if(hDriver == nullptr){
+        return;
+    }
+    const std::vector<uint8_t> data = MakeRaster(eType, nSize, dfNoDataDensity);
+    const std::string osSrc = CPLFormFilename(opts.osTmpDir.c_str(),
+                                              CPLSPrintf("rsisa_bench_%d_%d.tif", static_cast<int>(eType), nSize),
+                                              nullptr);
+    const std::string osDst = CPLFormFilename(opts.osTmpDir.c_str(), "rsisa_bench_out.tif", nullptr);
+
+    char** papszOptions = CSLSetNameValue(nullptr, "TILED", "YES");
+    const double dfWrite = BestOf(opts.nRepeat, [&](){
+        GDALDatasetH hDset = GDALCreate(hDriver, osSrc.c_str(), nSize, nSize, 1, eType, papszOptions);
+        if(hDset == nullptr){ return; }
+        if(GDALRasterIO(GDALGetRasterBand(hDset, 1), GF_Write, 0, 0, nSize, nSize,
+                        const_cast<uint8_t*>(data.data()), nSize, nSize, eType, 0, 0) != CE_None){
+            fprintf(stderr, "%s\n", CPLGetLastErrorMsg());
+        }
+        GDALClose(hDset);
+    });
+    CSLDestroy(papszOptions);
+    records.push_back(MakeRecord("write", eType, nSize, dfNoDataDensity, "", 1, dfWrite));
+
+    GDALDatasetH hSrc = GDALOpen(osSrc.c_str(), GA_ReadOnly);
+    if(hSrc == nullptr){
+        fprintf(stderr, "%s\n", CPLGetLastErrorMsg());
+        return;
+    }
+    const int iBands[3] = {1, 1, 1};
+    for(size_t t=0;t<opts.threads.size();++t){
+        rsisa::ThreadPool pool(opts.threads[t]);
+        rsisa::StreamOptions stream;
+        stream.dfNoData = 0.0;
+        stream.bUseStatsCache = false;
+        stream.pPool = &pool;
+        rsisa::BandStats stats;
+        double dfSeconds = BestOf(opts.nRepeat, [&](){ rsisa::ComputeStreamStats(hSrc, iBands, 1, stream, &stats); });
+        records.push_back(MakeRecord("stream_stats", eType, nSize, dfNoDataDensity, "", opts.threads[t], dfSeconds));
+
+        dfSeconds = BestOf(opts.nRepeat, [&](){
+            if(rsisa::StretchToGeoTIFF(hSrc, osDst.c_str(), iBands, rsisa::SA_Linear, stream) != CE_None){
+                fprintf(stderr, "%s\n", CPLGetLastErrorMsg());
+            }
+        });
+        records.push_back(MakeRecord("stream_stretch", eType, nSize, dfNoDataDensity,
+                                     AlgorithmName(rsisa::SA_Linear), opts.threads[t], dfSeconds));
+    }
+    GDALClose(hSrc);
+    GDALDeleteDataset(hDriver, osSrc.c_str());
+    GDALDeleteDataset(hDriver, osDst.c_str());
+}
+
+// 检查内核使用的数据类型和长度
+// 长度包括不是向量宽度整数倍的情况，覆盖不足8个像素的尾部处理
+const GDALDataType CHECK_TYPES[] = {GDT_Byte, GDT_UInt16, GDT_Int16, GDT_UInt32, GDT_Float32, GDT_Float64};
+const size_t CHECK_LENGTHS[] = {1, 3, 7, 8, 9, 15, 16, 17, 31, 33, 63, 64, 65, 1000, 4099};
+
+// 随机数据：值的范围超出拉伸范围，包含无效值，浮点数还包含NaN和正负无穷大
+template<typename T>
+void FillCheckData(std::mt19937& rng, double dfNoData, T* pData, size_t nCount)
+{
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const bool bFloat = !std::numeric_limits<T>::is_integer;
+    const double dfLow = bFloat? -1000.0 : static_cast<double>(std::numeric_limits<T>::min());
+    const double dfHigh = bFloat? 70000.0 : static_cast<double>(std::numeric_limits<T>::max());
+    for(size_t i=0;i<nCount;++i){
+        const double r = uniform(rng);
+        if(r < 0.1 && !std::isnan(dfNoData)){
+            pData[i] = static_cast<T>(dfNoData);
+        }
+        else if(bFloat && r < 0.15){
+            pData[i] = std::numeric_limits<T>::quiet_NaN();
+        }
+        else if(bFloat && r < 0.2){
+            pData[i] = (r < 0.175)? std::numeric_limits<T>::infinity() : -std::numeric_limits<T>::infinity();
+        }
+        else {
+            pData[i] = static_cast<T>(dfLow + uniform(rng) * (dfHigh - dfLow));
+        }
+    }
+}
+
+template<typename T>
+void MakeCheckDataT(std::mt19937& rng, double dfNoData, std::vector<uint8_t>& data, size_t nCount)
+{
+    data.assign(nCount * sizeof(T), 0);
+    FillCheckData(rng, dfNoData, reinterpret_cast<T*>(data.data()), nCount);
+}
+
+void MakeCheckData(GDALDataType eType, std::mt19937& rng, double dfNoData, std::vector<uint8_t>& data, size_t nCount)
+{
+    switch(eType){
+    case GDT_Byte:    MakeCheckDataT<uint8_t>(rng, dfNoData, data, nCount); break;
+    case GDT_UInt16:  MakeCheckDataT<uint16_t>(rng, dfNoData, data, nCount); break;
+    case GDT_Int16:   MakeCheckDataT<int16_t>(rng, dfNoData, data, nCount); break;
+    case GDT_UInt32:  MakeCheckDataT<uint32_t>(rng, dfNoData, data, nCount); break;
+    case GDT_Float32: MakeCheckDataT<float>(rng, dfNoData, data, nCount); break;
+    default:          MakeCheckDataT<double>(rng, dfNoData, data, nCount); break;
+    }
+}
+
+// 标量参考实现
+void MapBandReference(GDALDataType eType, const void* pData, size_t nCount, const rsisa::simd::MapParams& params,
+                      uint8_t* pOut, uint8_t* pValid)
+{
+    using rsisa::kernel::MapBandT;
+    switch(eType){
+    case GDT_Byte:    MapBandT(static_cast<const uint8_t*>(pData), nCount, params, pOut, pValid); break;
+    case GDT_UInt16:  MapBandT(static_cast<const uint16_t*>(pData), nCount, params, pOut, pValid); break;
+    case GDT_Int16:   MapBandT(static_cast<const int16_t*>(pData), nCount, params, pOut, pValid); break;
+    case GDT_UInt32:  MapBandT(static_cast<const uint32_t*>(pData), nCount, params, pOut, pValid); break;
+    case GDT_Float32: MapBandT(static_cast<const float*>(pData), nCount, params, pOut, pValid); break;
+    default:          MapBandT(static_cast<const double*>(pData), nCount, params, pOut, pValid); break;
+    }
+}
+
+// 8位和16位整数的直接映射表参考实现，其它类型返回false
+bool GatherBandReference(GDALDataType eType, const void* pData, size_t nCount, const rsisa::StretchTransform& tr,
+                         int32_t nNoData, uint8_t* pOut, uint8_t* pValid)
+{
+    using rsisa::kernel::GatherBandT;
+    switch(eType){
+    case GDT_Byte:
+        GatherBandT(static_cast<const uint8_t*>(pData), nCount, tr.valueLut.data(), tr.nValueOrigin, nNoData, pOut, pValid);
+        return true;
+    case GDT_UInt16:
+        GatherBandT(static_cast<const uint16_t*>(pData), nCount, tr.valueLut.data(), tr.nValueOrigin, nNoData, pOut, pValid);
+        return true;
+    case GDT_Int16:
+        GatherBandT(static_cast<const int16_t*>(pData), nCount, tr.valueLut.data(), tr.nValueOrigin, nNoData, pOut, pValid);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 检查CLAHE插值内核：随机的三列网格颜色表、灰度级、有效标记和权重(包括0和满权重)，返回不一致的个数
+int CheckInterpolate(std::mt19937& rng, const char* pszLevel)
+{
+    const rsisa::simd::KernelTable& kernels = rsisa::simd::ActiveKernels();
+    const int nOne = 1 << rsisa::simd::INTERP_WEIGHT_BITS;
+    const int nTiles = 3;
+    // 两行网格的颜色表，末尾的3字节填充与ClaheGrid相同
+    std::vector<uint8_t> luts(2 * nTiles * rsisa::HIST_BINS + 3);
+    for(size_t i=0;i<luts.size();++i){
+        luts[i] = static_cast<uint8_t>(rng() & 0xFF);
+    }
+    const uint8_t* pLuts0 = luts.data();
+    const uint8_t* pLuts1 = luts.data() + nTiles * rsisa::HIST_BINS;
+    const int WEIGHTS_Y[] = {0, 1, 97, nOne - 1, nOne};
+    int nFailed = 0;
+    for(size_t l=0;l<sizeof(CHECK_LENGTHS)/sizeof(CHECK_LENGTHS[0]);++l){
+        const size_t nCount = CHECK_LENGTHS[l];
+        std::vector<uint16_t> idx(nCount);
+        std::vector<uint8_t> valid(nCount), out(nCount), ref(nCount);
+        std::vector<int32_t> off0(nCount), off1(nCount), wx(nCount);
+        for(size_t i=0;i<nCount;++i){
+            // 包括最后一个网格的最后一级，检查gather不越界
+            idx[i] = (i % 5 == 0)? rsisa::HIST_BINS - 1 : static_cast<uint16_t>(rng() % rsisa::HIST_BINS);
+            valid[i] = (rng() % 8 == 0)? 0 : 0xFF;
+            const int32_t nTile = static_cast<int32_t>(rng() % nTiles);
+            off0[i] = nTile * rsisa::HIST_BINS;
+            off1[i] = std::min(nTile + 1, nTiles - 1) * rsisa::HIST_BINS;
+            wx[i] = (i % 7 == 0)? nOne : static_cast<int32_t>(rng() % nOne);
+        }
+        for(size_t w=0;w<sizeof(WEIGHTS_Y)/sizeof(WEIGHTS_Y[0]);++w){
+            rsisa::kernel::InterpolateRow(idx.data(), valid.data(), nCount, pLuts0, pLuts1, WEIGHTS_Y[w],
+                                          off0.data(), off1.data(), wx.data(), ref.data());
+            kernels.interpolate(idx.data(), valid.data(), nCount, pLuts0, pLuts1, WEIGHTS_Y[w],
+                                off0.data(), off1.data(), wx.data(), out.data());
+            if(memcmp(out.data(), ref.data(), nCount) != 0){
+                fprintf(stderr, "%s: interpolate length %d weight %d differs from scalar\n", pszLevel,
+                        static_cast<int>(nCount), WEIGHTS_Y[w]);
+                nFailed += 1;
+            }
+        }
+    }
+    return nFailed;
+}
+
+// 检查当前指令集的内核，返回不一致的个数
+int CheckKernels(std::mt19937& rng)
+{
+    const rsisa::simd::KernelTable& kernels = rsisa::simd::ActiveKernels();
+    const char* pszLevel = rsisa::SimdLevelName(rsisa::GetSimdLevel());
+    std::vector<int32_t> lut(rsisa::HIST_BINS);
+    for(size_t i=0;i<lut.size();++i){
+        lut[i] = static_cast<int32_t>(rng() & 0xFF);
+    }
+    int nFailed = 0;
+    std::vector<uint8_t> data;
+    for(size_t t=0;t<sizeof(CHECK_TYPES)/sizeof(CHECK_TYPES[0]);++t){
+        const GDALDataType eType = CHECK_TYPES[t];
+        for(size_t l=0;l<sizeof(CHECK_LENGTHS)/sizeof(CHECK_LENGTHS[0]);++l){
+            const size_t nCount = CHECK_LENGTHS[l];
+            for(int nCase=0;nCase<4;++nCase){
+                // 有或没有无效值、有或没有颜色表
+                const double dfNoData = (nCase & 1)? std::numeric_limits<double>::quiet_NaN() : 7.0;
+                MakeCheckData(eType, rng, dfNoData, data, nCount);
+                rsisa::simd::MapParams params;
+                params.dfMin = (eType == GDT_Int16)? -20000.0 : 100.0;
+                params.dfScale = (nCase & 2)? (rsisa::HIST_BINS - 1) / 50000.0 : 255.0 / 50000.0;
+                params.dfUpper = (nCase & 2)? rsisa::HIST_BINS - 1 : 255.0;
+                params.pLut = (nCase & 2)? lut.data() : nullptr;
+                params.dfNoData = dfNoData;
+
+                std::vector<uint8_t> out(nCount), valid(nCount), refOut(nCount), refValid(nCount);
+                MapBandReference(eType, data.data(), nCount, params, refOut.data(), refValid.data());
+                if(kernels.mapBand[eType] != nullptr){
+                    kernels.mapBand[eType](data.data(), nCount, params, out.data(), valid.data());
+                }
+                else {
+                    MapBandReference(eType, data.data(), nCount, params, out.data(), valid.data());
+                }
+                if(memcmp(out.data(), refOut.data(), nCount) != 0 || memcmp(valid.data(), refValid.data(), nCount) != 0){
+                    fprintf(stderr, "%s: mapBand %s length %d case %d differs from scalar\n", pszLevel,
+                            GDALGetDataTypeName(eType), static_cast<int>(nCount), nCase);
+                    nFailed += 1;
+                }
+
+                // 完整的RGBA输出与标量参考实现逐字节比较，整数类型经过直接映射表
+                rsisa::BandView band;
+                band.pData = data.data();
+                band.eType = eType;
+                band.nCount = nCount;
+                band.dfNoData = dfNoData;
+                rsisa::BandStats stats = rsisa::ComputeBandStats(band);
+                const rsisa::StretchTransform tr = rsisa::BuildTransform((nCase & 2)? rsisa::SA_Equalize : rsisa::SA_Linear, stats);
+                const rsisa::BandView bands[3] = {band, band, band};
+                const rsisa::StretchTransform* transforms[3] = {&tr, &tr, &tr};
+                std::vector<uint8_t> rgba(nCount * 4);
+                rsisa::ApplyStretchRGBA(bands, transforms, rgba.data());
+
+                std::vector<uint8_t> ref(nCount * 4);
+                const int32_t nNoData = std::isnan(dfNoData)? INT32_MIN : static_cast<int32_t>(dfNoData);
+                if(tr.valueLut.empty() || !GatherBandReference(eType, data.data(), nCount, tr, nNoData,
+                                                               refOut.data(), refValid.data())){
+                    std::vector<int32_t> trLut(tr.lut.begin(), tr.lut.end());
+                    params.dfMin = tr.dfMin;
+                    params.dfScale = tr.dfScale;
+                    params.dfUpper = tr.lut.empty()? 255.0 : static_cast<double>(tr.lut.size() - 1);
+                    params.pLut = tr.lut.empty()? nullptr : trLut.data();
+                    MapBandReference(eType, data.data(), nCount, params, refOut.data(), refValid.data());
+                }
+                for(size_t i=0;i<nCount;++i){
+                    ref[i*4+0] = ref[i*4+1] = ref[i*4+2] = refOut[i];
+                    ref[i*4+3] = refValid[i];
+                }
+                if(memcmp(rgba.data(), ref.data(), ref.size()) != 0){
+                    fprintf(stderr, "%s: ApplyStretchRGBA %s length %d case %d differs from scalar\n", pszLevel,
+                            GDALGetDataTypeName(eType), static_cast<int>(nCount), nCase);
+                    nFailed += 1;
+                }
+            }
+        }
+    }
+    nFailed += CheckInterpolate(rng, pszLevel);
+    return nFailed;
+}
+
+// 在CPU支持的每一级指令集上检查内核，返回不一致的个数
+int CheckSimd()
+{
+    const rsisa::SimdLevel eSaved = rsisa::GetSimdLevel();
+    const rsisa::SimdLevel eDetected = rsisa::DetectSimdLevel();
+    int nFailed = 0;
+    for(int i=rsisa::SIMD_Scalar;i<=eDetected;++i){
+        rsisa::SetSimdLevel(static_cast<rsisa::SimdLevel>(i));
+        std::mt19937 rng(12345);
+        const int nLevelFailed = CheckKernels(rng);
+        printf("%-8s %s\n", rsisa::SimdLevelName(static_cast<rsisa::SimdLevel>(i)),
+               nLevelFailed == 0? "OK" : CPLSPrintf("%d mismatch(es)", nLevelFailed));
+        nFailed += nLevelFailed;
+    }
+    rsisa::SetSimdLevel(eSaved);
+    return nFailed;
+}
+
+void PrintRecords(const BenchOptions& opts, const std::vector<Record>& records)
+{
+    const char* pszSimd = rsisa::SimdLevelName(rsisa::GetSimdLevel());
+    if(opts.eFormat == OF_JSON){
+        printf("{\n  \"cpus\": %d,\n  \"simd\": \"%s\",\n  \"repeat\": %d,\n  \"results\": [\n",
+               CPLGetNumCPUs(), pszSimd, opts.nRepeat);
+        for(size_t i=0;i<records.size();++i){
+            const Record& r = records[i];
+            printf("    {\"stage\": \"%s\", \"type\": \"%s\", \"width\": %d, \"height\": %d, "
+                   "\"nodata_density\": %g, \"algorithm\": \"%s\", \"threads\": %d, "
+                   "\"seconds\": %.6g, \"mpix_per_s\": %.4g, \"mb_per_s\": %.4g}%s\n",
+                   r.osStage.c_str(), GDALGetDataTypeName(r.eType), r.nSize, r.nSize,
+                   r.dfNoDataDensity, r.osAlgorithm.c_str(), r.nThreads,
+                   r.dfSeconds, r.dfMPixPerSec, r.dfMBPerSec, (i + 1 < records.size())? "," : "");
+        }
+        printf("  ]\n}\n");
+        return;
+    }
+    if(opts.eFormat == OF_CSV){
+        printf("stage,type,width,height,nodata_density,algorithm,threads,simd,seconds,mpix_per_s,mb_per_s\n");
+        for(size_t i=0;i<records.size();++i){
+            const Record& r = records[i];
+            printf("%s,%s,%d,%d,%g,%s,%d,%s,%.6g,%.4g,%.4g\n",
+                   r.osStage.c_str(), GDALGetDataTypeName(r.eType), r.nSize, r.nSize,
+                   r.dfNoDataDensity, r.osAlgorithm.c_str(), r.nThreads, pszSimd,
+                   r.dfSeconds, r.dfMPixPerSec, r.dfMBPerSec);
+        }
+        return;
+    }
+    printf("CPUs: %d  SIMD: %s  repeat: %d (best time)\n\n", CPLGetNumCPUs(), pszSimd, opts.nRepeat);
+    printf("%-15s %-8s %11s %7s %-9s %7s %11s %10s %10s\n",
+           "stage", "type", "size", "nodata", "algorithm", "threads", "ms", "Mpix/s", "MB/s");
+    for(size_t i=0;i<records.size();++i){
+        const Record& r = records[i];
+        printf("%-15s %-8s %5dx%-5d %6.0f%% %-9s %7d %11.3f %10.1f %10.1f\n",
+               r.osStage.c_str(), GDALGetDataTypeName(r.eType), r.nSize, r.nSize,
+               r.dfNoDataDensity * 100, r.osAlgorithm.c_str(), r.nThreads,
+               r.dfSeconds * 1000, r.dfMPixPerSec, r.dfMBPerSec);
+    }
+}
+
+void Usage(const char* pszError = nullptr)
+{
+    printf("Usage: StretchBench [-types Byte,UInt16,Float32] [-sizes 1024,4096] [-nodata 0,0.25]\n"
+           "                    [-threads 1,2,4,...|max] [-repeat n] [-io] [-tmpdir dir]\n"
+           "                    [-simd scalar|sse42|avx2|avx512] [-of text|csv|json]\n"
+           "       StretchBench -check\n"
+           "\n"
+           "  -nodata   fractions of pixels set to nodata\n"
+           "  -threads  thread counts to measure (default: powers of two up to the CPU count)\n"
+           "  -io       also measure GeoTIFF write, streamed statistics and streamed stretch\n"
+           "  -check    check that the kernels of every SIMD level supported by this CPU give\n"
+           "            byte-identical results to the scalar implementation (NaN, infinity,\n"
+           "            nodata and lengths that are not a multiple of the vector width)\n");
+    if(pszError != nullptr){
+        fprintf(stderr, "\nFAILURE: %s\n", pszError);
+    }
+    exit(1);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    GDALAllRegister();
+    argc = GDALGeneralCmdLineProcessor(argc, &argv, 0);
+    if(argc < 1){
+        exit(-argc);
+    }
+
+    BenchOptions opts;
+    for(int i=1;i<argc;++i){
+        const char* pszArg = argv[i];
+        const bool bHasValue = i + 1 < argc;
+        if(EQUAL(pszArg, "-types") && bHasValue){
+            char** papszTypes = CSLTokenizeString2(argv[++i], ",", 0);
+            for(int k=0;papszTypes != nullptr && papszTypes[k] != nullptr;++k){
+                const GDALDataType eType = GDALGetDataTypeByName(papszTypes[k]);
+                if(eType != GDT_Byte && eType != GDT_UInt16 && eType != GDT_Float32){
+                    Usage("Supported types are Byte, UInt16 and Float32");
+                }
+                opts.types.push_back(eType);
+            }
+            CSLDestroy(papszTypes);
+        }
+        else if(EQUAL(pszArg, "-sizes") && bHasValue){
+            char** papszSizes = CSLTokenizeString2(argv[++i], ",", 0);
+            for(int k=0;papszSizes != nullptr && papszSizes[k] != nullptr;++k){
+                opts.sizes.push_back(std::max(1, atoi(papszSizes[k])));
+            }
+            CSLDestroy(papszSizes);
+        }
+        else if(EQUAL(pszArg, "-nodata") && bHasValue){
+            char** papszValues = CSLTokenizeString2(argv[++i], ",", 0);
+            for(int k=0;papszValues != nullptr && papszValues[k] != nullptr;++k){
+                opts.nodataDensities.push_back(std::min(std::max(CPLAtof(papszValues[k]), 0.0), 1.0));
+            }
+            CSLDestroy(papszValues);
+        }
+        else if(EQUAL(pszArg, "-threads") && bHasValue){
+            const char* pszValue = argv[++i];
+            if(EQUAL(pszValue, "max")){
+                opts.threads.push_back(rsisa::ThreadPool::DefaultThreadCount());
+                continue;
+            }
+            char** papszValues = CSLTokenizeString2(pszValue, ",", 0);
+            for(int k=0;papszValues != nullptr && papszValues[k] != nullptr;++k){
+                opts.threads.push_back(std::max(1, atoi(papszValues[k])));
+            }
+            CSLDestroy(papszValues);
+        }
+        else if(EQUAL(pszArg, "-repeat") && bHasValue){
+            opts.nRepeat = std::max(1, atoi(argv[++i]));
+        }
+        else if(EQUAL(pszArg, "-check")){
+            opts.bCheck = true;
+        }
+        else if(EQUAL(pszArg, "-io")){
+            opts.bIO = true;
+        }
+        else if(EQUAL(pszArg, "-tmpdir") && bHasValue){
+            opts.osTmpDir = argv[++i];
+        }
+        else if(EQUAL(pszArg, "-simd") && bHasValue){
+            const char* pszValue = argv[++i];
+            rsisa::SimdLevel eLevel = rsisa::SIMD_Scalar;
+            if(EQUAL(pszValue, "sse42")){ eLevel = rsisa::SIMD_SSE42; }
+            else if(EQUAL(pszValue, "avx2")){ eLevel = rsisa::SIMD_AVX2; }
+            else if(EQUAL(pszValue, "avx512")){ eLevel = rsisa::SIMD_AVX512; }
+            else if(!EQUAL(pszValue, "scalar")){ Usage("Unknown SIMD level"); }
+            rsisa::SetSimdLevel(eLevel);
+        }
+        else if(EQUAL(pszArg, "-of") && bHasValue){
+            const char* pszValue = argv[++i];
+            if(EQUAL(pszValue, "text")){ opts.eFormat = OF_Text; }
+            else if(EQUAL(pszValue, "csv")){ opts.eFormat = OF_CSV; }
+            else if(EQUAL(pszValue, "json")){ opts.eFormat = OF_JSON; }
+            else { Usage("Output format must be text, csv or json"); }
+        }
+        else {
+            Usage(CPLSPrintf("Unknown option or missing value: %s", pszArg));
+        }
+    }
+
+    if(opts.bCheck){
+        const int nFailed = CheckSimd();
+        CSLDestroy(argv);
+        GDALDestroyDriverManager();
+        return nFailed > 0? 1 : 0;
+    }
+
+    if(opts.types.empty()){
+        opts.types.push_back(GDT_Byte);
+        opts.types.push_back(GDT_UInt16);
+        opts.types.push_back(GDT_Float32);
+    }
+    if(opts.sizes.empty()){
+        opts.sizes.push_back(1024);
+        opts.sizes.push_back(4096);
+    }
+    if(opts.nodataDensities.empty()){
+        opts.nodataDensities.push_back(0.0);
+        opts.nodataDensities.push_back(0.25);
+    }
+    if(opts.threads.empty()){
+        const int nMax = rsisa::ThreadPool::DefaultThreadCount();
+        for(int n=1;n<nMax;n*=2){
+            opts.threads.push_back(n);
+        }
+        opts.threads.push_back(nMax);
+    }
+    if(opts.osTmpDir.empty()){
+        opts.osTmpDir = CPLGetPath(CPLGenerateTempFilename(nullptr));
+    }
+
+    std::vector<Record> records;
+    for(size_t t=0;t<opts.types.size();++t){
+        for(size_t s=0;s<opts.sizes.size();++s){
+            for(size_t d=0;d<opts.nodataDensities.size();++d){
+                if(opts.eFormat == OF_Text){
+                    fprintf(stderr, "%s %dx%d nodata %g...\n", GDALGetDataTypeName(opts.types[t]),
+                            opts.sizes[s], opts.sizes[s], opts.nodataDensities[d]);
+                }
+                BenchMemory(opts, opts.types[t], opts.sizes[s], opts.nodataDensities[d], records);
+                if(opts.bIO){
+                    BenchIO(opts, opts.types[t], opts.sizes[s], opts.nodataDensities[d], records);
+                }
+            }
+        }
+    }
+    PrintRecords(opts, records);
+
+    CSLDestroy(argv);
+    GDALDestroyDriverManager();
+    return 0;
+}
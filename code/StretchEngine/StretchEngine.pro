@@ -0,0 +1,43 @@
+#-------------------------------------------------
+#
+# 影像拉伸引擎(静态库，不依赖Qt)
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = StretchEngine
+TEMPLATE = lib
+CONFIG += staticlib c++11 thread
+
+SOURCES += \
+        bandstats.cpp \
+        clahe.cpp \
+        mosaic.cpp \
+        preview.cpp \
+        rasterstream.cpp \
+        statscache.cpp \
+        stretchengine.cpp \
+        stretchsimd.cpp \
+        stretchsimd_avx2.cpp \
+        stretchsimd_avx512.cpp \
+        stretchsimd_sse42.cpp \
+        streamhistogram.cpp \
+        threadpool.cpp \
+        trace.cpp
+
+HEADERS += \
+        bandstats.hpp \
+        clahe.hpp \
+        mosaic.hpp \
+        preview.hpp \
+        rasterstream.hpp \
+        statscache.hpp \
+        stretchengine.hpp \
+        stretchkernel.hpp \
+        stretchsimd.hpp \
+        streamhistogram.hpp \
+        threadpool.hpp \
+        trace.hpp
+
+include(../gdal.pri)
@@ -0,0 +1,160 @@
+﻿#include "bandstats.hpp"
+#include "stretchkernel.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <utility>
+
+namespace rsisa
+{
+
+namespace
+{
+
+// 8位和16位整数使用覆盖整个取值范围的精确直方图(8位为256个桶，16位为65536个桶)
+// 其它整数从宽度为1的桶开始，浮点数从很小的宽度开始，随数据范围自动加宽
+StreamHistogram HistogramFor(GDALDataType eType)
+{
+    int32_t nMinValue = 0, nValueCount = 0;
+    if(IntegerValueRange(eType, nMinValue, nValueCount)){
+        return StreamHistogram::ForIntegerRange(nMinValue, nMinValue + nValueCount - 1);
+    }
+    const bool bInteger = GDALDataTypeIsInteger(eType) != 0;
+    return StreamHistogram(4096, bInteger? 0 : -40, bInteger);
+}
+
+}
+
+BandAccumulator::BandAccumulator(GDALDataType eType)
+    : dfMin(DBL_MAX), dfMax(-DBL_MAX), dfMean(0.0), dfM2(0.0), nValidCount(0),
+      eType(eType), histogram(HistogramFor(eType))
+{
+}
+
+BandAccumulator::BandAccumulator(GDALDataType eType, const StreamHistogram& hist)
+    : dfMin(DBL_MAX), dfMax(-DBL_MAX), dfMean(0.0), dfM2(0.0), nValidCount(0),
+      eType(eType), histogram(hist)
+{
+}
+
+BandAccumulator::BandAccumulator(const BandStats& stats)
+    : BandAccumulator(stats.eType)
+{
+    if(stats.nValidCount == 0){
+        return;
+    }
+    dfMin = stats.dfMin;
+    dfMax = stats.dfMax;
+    dfMean = stats.dfMean;
+    dfM2 = stats.dfStddev * stats.dfStddev * static_cast<double>(stats.nValidCount);
+    nValidCount = stats.nValidCount;
+    histogram = stats.distribution;
+}
+
+BandAccumulator BandAccumulator::WithoutHistogram(GDALDataType eType)
+{
+    return BandAccumulator(eType, StreamHistogram(2, 0, false));
+}
+
+void BandAccumulator::Add(const BandView& block)
+{
+    Add(block, histogram);
+}
+
+void BandAccumulator::Add(const BandView& block, StreamHistogram& hist)
+{
+    switch(block.eType){
+    case GDT_Byte:
+        kernel::AccumulateT(static_cast<const uint8_t*>(block.pData), block.nCount, block.dfNoData, *this, hist); break;
+    case GDT_UInt16:
+        kernel::AccumulateT(static_cast<const uint16_t*>(block.pData), block.nCount, block.dfNoData, *this, hist); break;
+    case GDT_Int16:
+        kernel::AccumulateT(static_cast<const int16_t*>(block.pData), block.nCount, block.dfNoData, *this, hist); break;
+    case GDT_UInt32:
+        kernel::AccumulateT(static_cast<const uint32_t*>(block.pData), block.nCount, block.dfNoData, *this, hist); break;
+    case GDT_Float32:
+        kernel::AccumulateT(static_cast<const float*>(block.pData), block.nCount, block.dfNoData, *this, hist); break;
+    case GDT_Float64:
+        kernel::AccumulateT(static_cast<const double*>(block.pData), block.nCount, block.dfNoData, *this, hist); break;
+    default:
+        break;
+    }
+}
+
+void BandAccumulator::Merge(const BandAccumulator& other)
+{
+    dfMin = std::min(dfMin, other.dfMin);
+    dfMax = std::max(dfMax, other.dfMax);
+    kernel::MergeMoments(nValidCount, dfMean, dfM2, other.nValidCount, other.dfMean, other.dfM2);
+    histogram.Merge(other.histogram);
+}
+
+void BandAccumulator::Merge(const BandStats& stats)
+{
+    if(stats.eType != GDT_Unknown && stats.eType != eType){
+        const GDALDataType eUnion = (eType == GDT_Unknown)? stats.eType : GDALDataTypeUnion(eType, stats.eType);
+        if(eUnion != eType){
+            BandAccumulator widened(eUnion);
+            widened.Merge(*this);
+            *this = std::move(widened);
+        }
+    }
+    if(stats.nValidCount == 0){
+        return;
+    }
+    dfMin = std::min(dfMin, stats.dfMin);
+    dfMax = std::max(dfMax, stats.dfMax);
+    kernel::MergeMoments(nValidCount, dfMean, dfM2, stats.nValidCount, stats.dfMean,
+                         stats.dfStddev * stats.dfStddev * static_cast<double>(stats.nValidCount));
+    histogram.Merge(stats.distribution);
+}
+
+BandStats BandAccumulator::Finalize() const
+{
+    BandStats stats;
+    stats.eType = eType;
+    stats.histogram.assign(HIST_BINS, 0.0);
+    if(nValidCount == 0){
+        return stats;
+    }
+    stats.dfMin = dfMin;
+    stats.dfMax = dfMax;
+    stats.nValidCount = nValidCount;
+    stats.dfMean = dfMean;
+    stats.dfStddev = std::sqrt(dfM2 / nValidCount);
+    stats.histogram = histogram.Resample(dfMin, dfMax, HIST_BINS);
+    stats.distribution = histogram;
+    return stats;
+}
+
+HistogramPool::HistogramPool(GDALDataType eType)
+    : m_eType(eType)
+{
+}
+
+StreamHistogram* HistogramPool::Acquire()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(!m_free.empty()){
+        StreamHistogram* pHist = m_free.back();
+        m_free.pop_back();
+        return pHist;
+    }
+    m_all.push_back(std::unique_ptr<StreamHistogram>(new StreamHistogram(HistogramFor(m_eType))));
+    return m_all.back().get();
+}
+
+void HistogramPool::Release(StreamHistogram* pHist)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free.push_back(pHist);
+}
+
+void HistogramPool::MergeInto(StreamHistogram& hist) const
+{
+    for(size_t i=0;i<m_all.size();++i){
+        hist.Merge(*m_all[i]);
+    }
+}
+
+}
@@ -0,0 +1,75 @@
+﻿#ifndef BANDSTATS_HPP
+#define BANDSTATS_HPP
+
+#include "stretchengine.hpp"
+#include "streamhistogram.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace rsisa
+{
+
+// 波段统计信息的累加器，可以分块累加，也可以合并多个累加器的结果
+struct BandAccumulator
+{
+    explicit BandAccumulator(GDALDataType eType = GDT_Float64);
+    // 使用给定的(空)直方图累加像素值分布
+    BandAccumulator(GDALDataType eType, const StreamHistogram& hist);
+    // 从已有的统计信息恢复累加器(Finalize的逆过程)，用于合并多组统计信息
+    explicit BandAccumulator(const BandStats& stats);
+
+    // 不带像素值分布的累加器，只累加最大最小值和矩，并行统计时与HistogramPool配合使用
+    static BandAccumulator WithoutHistogram(GDALDataType eType);
+
+    // 累加一块数据
+    void Add(const BandView& block);
+    // 累加一块数据，像素值分布累加到hist中
+    void Add(const BandView& block, StreamHistogram& hist);
+    // 合并另一个累加器
+    void Merge(const BandAccumulator& other);
+    // 合并一组统计信息，不复制其像素值分布；数据类型不同时换为能容纳两者的类型(GDALDataTypeUnion)
+    void Merge(const BandStats& stats);
+    // 计算最终的统计信息
+    BandStats Finalize() const;
+
+    double   dfMin;
+    double   dfMax;
+    double   dfMean;        // 均值和离差平方和(Welford算法)
+    double   dfM2;
+    uint64_t nValidCount;
+    GDALDataType eType;
+    StreamHistogram histogram;
+};
+
+// 并行统计时各线程重复使用的像素值分布
+// 8位和16位整数的精确直方图较大(16位为512KB)，每个任务一个时分配和合并的开销会超过统计本身
+// 直方图的合并结果与顺序无关，因此可以每个线程一个、跨任务累加，最后再合并，结果与按任务合并相同
+class HistogramPool
+{
+public:
+    explicit HistogramPool(GDALDataType eType);
+
+    // 取出一个直方图，没有空闲的时新建一个；用完后用Release放回
+    StreamHistogram* Acquire();
+    void Release(StreamHistogram* pHist);
+
+    // 将所有直方图合并到hist中
+    void MergeInto(StreamHistogram& hist) const;
+
+private:
+    HistogramPool(const HistogramPool&);
+    HistogramPool& operator=(const HistogramPool&);
+
+    GDALDataType m_eType;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<StreamHistogram> > m_all;
+    std::vector<StreamHistogram*> m_free;
+};
+
+}
+
+#endif // BANDSTATS_HPP
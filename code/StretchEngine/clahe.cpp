@@ -0,0 +1,239 @@
+﻿#include "clahe.hpp"
+#include "stretchkernel.hpp"
+#include "stretchsimd.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace rsisa
+{
+
+namespace
+{
+
+// 插值权重的定点精度，与插值内核相同
+const int WEIGHT_BITS = simd::INTERP_WEIGHT_BITS;
+const int WEIGHT_ONE = 1 << WEIGHT_BITS;
+
+// 计算一段像素的灰度级，与直方图均衡化拉伸时的下标计算相同
+// pIdx为灰度级，pValid为有效标记(有效0xFF，无效0)，无效像素的灰度级为0
+template<typename T>
+void BinIndexT(const T* pData, size_t nCount, double dfNoData, double dfMin, double dfScale,
+               uint16_t* pIdx, uint8_t* pValid)
+{
+    const double dfUpper = HIST_BINS - 1;
+    for(size_t i=0;i<nCount;++i){
+        if(!kernel::IsValid(pData[i], dfNoData)){
+            pIdx[i] = 0; pValid[i] = 0; continue;
+        }
+        pIdx[i] = static_cast<uint16_t>(kernel::ClampIndex((static_cast<double>(pData[i]) - dfMin) * dfScale, dfUpper));
+        pValid[i] = 0xFF;
+    }
+}
+
+// 按数据类型计算band中从第nOff个像素开始的nCount个像素的灰度级
+void BinIndex(const BandView& band, size_t nOff, size_t nCount, double dfMin, double dfScale,
+              uint16_t* pIdx, uint8_t* pValid)
+{
+    const uint8_t* pData = static_cast<const uint8_t*>(band.pData)
+            + nOff * GDALGetDataTypeSizeBytes(band.eType);
+    switch(band.eType){
+    case GDT_Byte:
+        BinIndexT(reinterpret_cast<const uint8_t*>(pData), nCount, band.dfNoData, dfMin, dfScale, pIdx, pValid); break;
+    case GDT_UInt16:
+        BinIndexT(reinterpret_cast<const uint16_t*>(pData), nCount, band.dfNoData, dfMin, dfScale, pIdx, pValid); break;
+    case GDT_Int16:
+        BinIndexT(reinterpret_cast<const int16_t*>(pData), nCount, band.dfNoData, dfMin, dfScale, pIdx, pValid); break;
+    case GDT_UInt32:
+        BinIndexT(reinterpret_cast<const uint32_t*>(pData), nCount, band.dfNoData, dfMin, dfScale, pIdx, pValid); break;
+    case GDT_Float32:
+        BinIndexT(reinterpret_cast<const float*>(pData), nCount, band.dfNoData, dfMin, dfScale, pIdx, pValid); break;
+    case GDT_Float64:
+        BinIndexT(reinterpret_cast<const double*>(pData), nCount, band.dfNoData, dfMin, dfScale, pIdx, pValid); break;
+    default:
+        memset(pIdx, 0, nCount * sizeof(uint16_t)); memset(pValid, 0, nCount); break;
+    }
+}
+
+// 统计一个网格的直方图并生成颜色表
+// band中第nFirst个像素为网格左上角，每行nXSize个像素，行与行相隔nRowStride个像素
+void BuildTileLut(const BandView& band, size_t nFirst, size_t nRowStride, int nXSize, int nYSize,
+                  int nTileX, int nTileY, ClaheGrid& grid)
+{
+    std::vector<double> histogram(HIST_BINS, 0.0);
+    std::vector<uint16_t> idx(static_cast<size_t>(nXSize));
+    std::vector<uint8_t> valid(static_cast<size_t>(nXSize));
+    double dfValid = 0.0;
+    for(int y=0;y<nYSize;++y){
+        BinIndex(band, nFirst + y * nRowStride, static_cast<size_t>(nXSize), grid.dfMin, grid.dfScale,
+                 idx.data(), valid.data());
+        for(int x=0;x<nXSize;++x){
+            if(valid[x] != 0){
+                histogram[idx[x]] += 1.0;
+                dfValid += 1.0;
+            }
+        }
+    }
+    // 没有有效像素时保留线性拉伸的颜色表
+    if(dfValid == 0.0){
+        return;
+    }
+
+    // 截断超过上限的部分，均匀分配到所有灰度级(只分配一次，分配后可能略超过上限)
+    // 上限按非空灰度级的平均像素个数计算，与数据类型和取值范围无关
+    if(grid.dfClipLimit > 1.0){
+        const double dfUsed = static_cast<double>(HIST_BINS - std::count(histogram.begin(), histogram.end(), 0.0));
+        const double dfLimit = grid.dfClipLimit * dfValid / dfUsed;
+        double dfExcess = 0.0;
+        for(int i=0;i<HIST_BINS;++i){
+            if(histogram[i] > dfLimit){
+                dfExcess += histogram[i] - dfLimit;
+                histogram[i] = dfLimit;
+            }
+        }
+        const double dfAdd = dfExcess / HIST_BINS;
+        for(int i=0;i<HIST_BINS;++i){
+            histogram[i] += dfAdd;
+        }
+    }
+    uint8_t* pLut = &grid.luts[(static_cast<size_t>(nTileY) * grid.nTilesX + nTileX) * HIST_BINS];
+    kernel::EqualizeLut(histogram.data(), dfValid, pLut);
+}
+
+// 第nPos个像素在网格中心之间的插值位置：前后两个网格和后一个网格的定点权重
+void InterpAxis(int nPos, int nTileSize, int nTiles, int& n0, int& n1, int& nWeight)
+{
+    const double f = (nPos + 0.5) / nTileSize - 0.5;
+    const int t = static_cast<int>(std::floor(f));
+    if(t < 0){
+        n0 = n1 = 0; nWeight = 0;
+    }
+    else if(t >= nTiles - 1){
+        n0 = n1 = nTiles - 1; nWeight = 0;
+    }
+    else {
+        n0 = t; n1 = t + 1;
+        nWeight = static_cast<int>((f - t) * WEIGHT_ONE + 0.5);
+    }
+}
+
+}
+
+ClaheGrid InitClaheGrid(int nXSize, int nYSize, const BandStats& stats, const ClaheOptions& opts)
+{
+    ClaheGrid grid;
+    grid.nXSize = nXSize;
+    grid.nYSize = nYSize;
+    grid.nTileSize = std::max(16, opts.nTileSize);
+    grid.nTilesX = std::max(1, (nXSize + grid.nTileSize - 1) / grid.nTileSize);
+    grid.nTilesY = std::max(1, (nYSize + grid.nTileSize - 1) / grid.nTileSize);
+    grid.dfMin = stats.dfMin;
+    grid.dfScale = (stats.dfMax > stats.dfMin)? HIST_BINS / (stats.dfMax - stats.dfMin) : 0.0;
+    grid.dfClipLimit = opts.dfClipLimit;
+    // 末尾多留3字节，插值内核按32位gather读取颜色表
+    grid.luts.resize(static_cast<size_t>(grid.nTilesX) * grid.nTilesY * HIST_BINS + 3);
+    for(int i=0;i<HIST_BINS;++i){
+        grid.luts[i] = static_cast<uint8_t>(i * 256 / HIST_BINS);
+    }
+    for(size_t t=1;t<static_cast<size_t>(grid.nTilesX) * grid.nTilesY;++t){
+        memcpy(&grid.luts[t * HIST_BINS], &grid.luts[0], HIST_BINS);
+    }
+    return grid;
+}
+
+void ClaheTileWindow(const ClaheGrid& grid, int nTileX, int nTileY,
+                     int& nXOff, int& nYOff, int& nXSize, int& nYSize)
+{
+    nXOff = nTileX * grid.nTileSize;
+    nYOff = nTileY * grid.nTileSize;
+    nXSize = std::min(grid.nTileSize, grid.nXSize - nXOff);
+    nYSize = std::min(grid.nTileSize, grid.nYSize - nYOff);
+}
+
+void BuildClaheRowLuts(const BandView& row, int nTileY, ClaheGrid& grid, ThreadPool* pPool)
+{
+    TraceScope scope("clahe_row");
+    ThreadPool& pool = pPool? *pPool : ThreadPool::Global();
+    pool.ParallelFor(static_cast<size_t>(grid.nTilesX), [&](size_t t){
+        const int nTileX = static_cast<int>(t);
+        int nXOff = 0, nYOff = 0, nWinXSize = 0, nWinYSize = 0;
+        ClaheTileWindow(grid, nTileX, nTileY, nXOff, nYOff, nWinXSize, nWinYSize);
+        BuildTileLut(row, static_cast<size_t>(nXOff), static_cast<size_t>(grid.nXSize),
+                     nWinXSize, nWinYSize, nTileX, nTileY, grid);
+    });
+}
+
+ClaheGrid BuildClaheGrid(const BandView& band, int nXSize, int nYSize, const BandStats& stats,
+                         const ClaheOptions& opts, ThreadPool* pPool)
+{
+    TraceScope scope("clahe_grid");
+    ClaheGrid grid = InitClaheGrid(nXSize, nYSize, stats, opts);
+    // 各网格并行统计，每个网格只写自己的颜色表
+    ThreadPool& pool = pPool? *pPool : ThreadPool::Global();
+    pool.ParallelFor(static_cast<size_t>(grid.nTilesX) * grid.nTilesY, [&](size_t t){
+        const int nTileX = static_cast<int>(t % grid.nTilesX);
+        const int nTileY = static_cast<int>(t / grid.nTilesX);
+        int nXOff = 0, nYOff = 0, nWinXSize = 0, nWinYSize = 0;
+        ClaheTileWindow(grid, nTileX, nTileY, nXOff, nYOff, nWinXSize, nWinYSize);
+        BuildTileLut(band, static_cast<size_t>(nYOff) * nXSize + nXOff, static_cast<size_t>(nXSize),
+                     nWinXSize, nWinYSize, nTileX, nTileY, grid);
+    });
+    return grid;
+}
+
+void ApplyClaheRGBA(const BandView bands[3], const ClaheGrid* grids[3],
+                    int nXOff, int nYOff, int nXSize, uint8_t* pRGBA, ThreadPool* pPool)
+{
+    TraceScope scope("clahe_apply");
+    TraceCount("apply_pixels", static_cast<int64_t>(bands[0].nCount));
+    const simd::KernelTable& kernels = simd::ActiveKernels();
+    const int nYSize = (nXSize > 0)? static_cast<int>(bands[0].nCount / nXSize) : 0;
+
+    // 每列左右网格颜色表的偏移和权重，整个窗口共用
+    std::vector<int32_t> offsets[3][2];
+    std::vector<int32_t> weights[3];
+    for(int c=0;c<3;++c){
+        const ClaheGrid& grid = *grids[c];
+        offsets[c][0].resize(static_cast<size_t>(nXSize));
+        offsets[c][1].resize(static_cast<size_t>(nXSize));
+        weights[c].resize(static_cast<size_t>(nXSize));
+        for(int x=0;x<nXSize;++x){
+            int n0 = 0, n1 = 0, nWeight = 0;
+            InterpAxis(nXOff + x, grid.nTileSize, grid.nTilesX, n0, n1, nWeight);
+            offsets[c][0][x] = n0 * HIST_BINS;
+            offsets[c][1][x] = n1 * HIST_BINS;
+            weights[c][x] = nWeight;
+        }
+    }
+
+    // 按行并行，每行依次计算灰度级、插值和交错输出
+    const int TASK_ROWS = 16;
+    ThreadPool& pool = pPool? *pPool : ThreadPool::Global();
+    pool.ParallelFor(static_cast<size_t>((nYSize + TASK_ROWS - 1) / TASK_ROWS), [&](size_t iTask){
+        const size_t n = static_cast<size_t>(nXSize);
+        std::vector<uint16_t> idx(n);
+        std::vector<uint8_t> work(n * 6);
+        uint8_t* pValues[3] = {&work[0], &work[n], &work[n*2]};
+        uint8_t* pValids[3] = {&work[n*3], &work[n*4], &work[n*5]};
+        const int nEnd = std::min(nYSize, static_cast<int>(iTask + 1) * TASK_ROWS);
+        for(int y=static_cast<int>(iTask)*TASK_ROWS;y<nEnd;++y){
+            const size_t nOff = static_cast<size_t>(y) * n;
+            for(int c=0;c<3;++c){
+                const ClaheGrid& grid = *grids[c];
+                int n0 = 0, n1 = 0, nWy = 0;
+                InterpAxis(nYOff + y, grid.nTileSize, grid.nTilesY, n0, n1, nWy);
+                const size_t nRowLuts = static_cast<size_t>(grid.nTilesX) * HIST_BINS;
+                BinIndex(bands[c], nOff, n, grid.dfMin, grid.dfScale, idx.data(), pValids[c]);
+                kernels.interpolate(idx.data(), pValids[c], n, &grid.luts[n0 * nRowLuts], &grid.luts[n1 * nRowLuts], nWy,
+                                    offsets[c][0].data(), offsets[c][1].data(), weights[c].data(), pValues[c]);
+            }
+            kernels.interleave(pValues[0], pValues[1], pValues[2],
+                               pValids[0], pValids[1], pValids[2], n, pRGBA + nOff*4);
+        }
+    });
+}
+
+}
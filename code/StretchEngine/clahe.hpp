@@ -0,0 +1,62 @@
+﻿#ifndef CLAHE_HPP
+#define CLAHE_HPP
+
+#include "stretchengine.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// 限制对比度的局部自适应直方图均衡化(CLAHE)
+// 影像划分为网格，每个网格单独统计直方图，截断超过限制的部分并均匀分配到各灰度级后生成均衡化颜色表
+// 拉伸时每个像素在周围四个网格的颜色表之间双线性插值，网格之间没有接缝
+// 灰度级划分与全局直方图均衡化相同：整幅影像的[dfMin,dfMax]分为HIST_BINS级
+// 每个像素的输出只依赖像素值、位置和颜色表，可以按任意分块拉伸
+namespace rsisa
+{
+
+class ThreadPool;
+
+// CLAHE参数
+struct ClaheOptions
+{
+    int    nTileSize = 512;     // 网格大小(像素)
+    double dfClipLimit = 3.0;   // 每个灰度级的像素个数上限，为网格平均每级像素个数的倍数，不大于1时不截断
+};
+
+// 一个波段的颜色表网格
+struct ClaheGrid
+{
+    int    nXSize = 0;          // 影像大小
+    int    nYSize = 0;
+    int    nTileSize = 0;
+    int    nTilesX = 0;         // 网格列数和行数
+    int    nTilesY = 0;
+    double dfMin = 0.0;         // 灰度级 idx = clamp((value - dfMin) * dfScale, 0, HIST_BINS-1)
+    double dfScale = 0.0;
+    double dfClipLimit = 0.0;
+    std::vector<uint8_t> luts;  // 按行优先顺序，每个网格HIST_BINS项，末尾另有3字节填充
+};
+
+// 按影像大小和整幅影像的统计信息初始化网格，颜色表初始化为线性拉伸
+ClaheGrid InitClaheGrid(int nXSize, int nYSize, const BandStats& stats, const ClaheOptions& opts);
+
+// 第nTileY行第nTileX列网格的范围
+void ClaheTileWindow(const ClaheGrid& grid, int nTileX, int nTileY,
+                     int& nXOff, int& nYOff, int& nXSize, int& nYSize);
+
+// 用第nTileY行网格的数据并行生成该行所有网格的颜色表
+// row为影像第nTileY行网格覆盖的所有像素行(宽为影像宽度，高为ClaheTileWindow的nYSize)
+void BuildClaheRowLuts(const BandView& row, int nTileY, ClaheGrid& grid, ThreadPool* pPool = nullptr);
+
+// 整幅影像在内存中时并行生成所有网格的颜色表，band为nXSize*nYSize的数据
+ClaheGrid BuildClaheGrid(const BandView& band, int nXSize, int nYSize, const BandStats& stats,
+                         const ClaheOptions& opts, ThreadPool* pPool = nullptr);
+
+// 将影像上左上角为(nXOff,nYOff)、宽为nXSize的窗口内的三个波段按CLAHE拉伸后输出为RGBA8888
+// 窗口的行数为 bands[0].nCount / nXSize，pRGBA需要有 bands[0].nCount*4 字节
+void ApplyClaheRGBA(const BandView bands[3], const ClaheGrid* grids[3],
+                    int nXOff, int nYOff, int nXSize, uint8_t* pRGBA, ThreadPool* pPool = nullptr);
+
+}
+
+#endif // CLAHE_HPP
@@ -0,0 +1,448 @@
+﻿#include "mosaic.hpp"
+#include "bandstats.hpp"
+#include "statscache.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+#include <cpl_minixml.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+namespace rsisa
+{
+
+namespace
+{
+
+const char MOSAIC_MAGIC[8] = {'R','S','I','S','A','M','O','S'};
+const uint32_t MOSAIC_VERSION = 2;
+
+// 镶嵌统计文件头，之后依次为:
+// nBandCount个int32_t的波段序号、nSceneCount个影像(uint32_t长度和路径、uint64_t大小、int64_t修改时间)、每个波段一个MosaicBand
+struct MosaicHeader
+{
+    char     szMagic[8];
+    uint32_t nVersion;
+    int32_t  nBandCount;
+    uint32_t nSceneCount;
+    uint32_t nReserved;
+};
+
+// 一个波段的统计信息，之后为nUsedCount个uint64_t的像素值分布桶计数
+// 灰度级直方图不保存，读取时由像素值分布重新生成
+struct MosaicBand
+{
+    double   dfMin;
+    double   dfMax;
+    double   dfMean;
+    double   dfStddev;
+    uint64_t nValidCount;
+    int64_t  nDistOrigin;
+    int32_t  eType;
+    int32_t  nDistExp;
+    int32_t  nDistBins;
+    uint32_t bDistInteger;
+    int32_t  nUsedOffset;       // 有计数的桶在窗口中的起始位置和个数
+    int32_t  nUsedCount;
+};
+
+static_assert(sizeof(MosaicHeader) == 24, "MosaicHeader must not contain padding");
+static_assert(sizeof(MosaicBand) == 72, "MosaicBand must not contain padding");
+
+// 统计一景影像，失败时返回false并在osError中给出原因
+bool ComputeSceneStats(const std::string& osFile, const int* iBands, int nBandCount,
+                       const StreamOptions& opts, BandStats* pStats, std::string& osError)
+{
+    GDALDatasetH hDset = GDALOpen(osFile.c_str(), GA_ReadOnly);
+    if(hDset == nullptr){
+        osError = CPLSPrintf("Cannot open %s", osFile.c_str());
+        return false;
+    }
+    const int nBands = GDALGetRasterCount(hDset);
+    for(int c=0;c<nBandCount;++c){
+        if(iBands[c] < 1 || iBands[c] > nBands){
+            GDALClose(hDset);
+            osError = CPLSPrintf("%s: band %d out of range (%d bands)", osFile.c_str(), iBands[c], nBands);
+            return false;
+        }
+    }
+    const CPLErr err = ComputeStreamStats(hDset, iBands, nBandCount, opts, pStats);
+    GDALClose(hDset);
+    if(err != CE_None){
+        osError = CPLSPrintf("%s: %s", osFile.c_str(), CPLGetLastErrorMsg());
+        return false;
+    }
+    return true;
+}
+
+// 一景影像的统计信息合并到merged中，直接累加，不复制已合并的结果
+void MergeScene(std::vector<BandAccumulator>& merged, const std::vector<BandStats>& scene)
+{
+    for(size_t c=0;c<merged.size();++c){
+        merged[c].Merge(scene[c]);
+    }
+}
+
+// 影像的规范化路径、大小和修改时间，用于识别已合并的影像
+// 不是本地文件(如/vsi虚拟文件)时使用原路径和VSIStatL的结果(修改时间精确到秒)
+MosaicScene SceneOf(const std::string& osFile)
+{
+    MosaicScene scene;
+    if(StatLocalFile(osFile.c_str(), scene.osPath, scene.nFileSize, scene.nMTime)){
+        return scene;
+    }
+    scene.osPath = osFile;
+    VSIStatBufL sStat;
+    if(VSIStatL(osFile.c_str(), &sStat) == 0){
+        scene.nFileSize = static_cast<uint64_t>(sStat.st_size);
+        scene.nMTime = static_cast<int64_t>(sStat.st_mtime) * 1000000000;
+    }
+    return scene;
+}
+
+// 检查VRT各波段引用的源波段：第i个波段只能引用源文件的第i个波段
+bool CheckVrtSourceBands(GDALDatasetH hDset, const char* pszFile)
+{
+    char** papszXml = GDALGetMetadata(hDset, "xml:VRT");
+    CPLXMLNode* psRoot = (papszXml != nullptr && papszXml[0] != nullptr)? CPLParseXMLString(papszXml[0]) : nullptr;
+    const CPLXMLNode* psVrt = (psRoot != nullptr)? CPLGetXMLNode(psRoot, "=VRTDataset") : nullptr;
+    if(psVrt == nullptr){
+        CPLError(CE_Failure, CPLE_AppDefined, "%s: cannot read the VRT definition", pszFile);
+        if(psRoot != nullptr){ CPLDestroyXMLNode(psRoot); }
+        return false;
+    }
+    bool bOk = true;
+    for(const CPLXMLNode* psBand = psVrt->psChild;psBand != nullptr && bOk;psBand = psBand->psNext){
+        if(psBand->eType != CXT_Element || !EQUAL(psBand->pszValue, "VRTRasterBand")){
+            continue;
+        }
+        const int iBand = atoi(CPLGetXMLValue(psBand, "band", "0"));
+        for(const CPLXMLNode* psSource = psBand->psChild;psSource != nullptr && bOk;psSource = psSource->psNext){
+            // 有SourceBand的子元素是源(SimpleSource、ComplexSource等)
+            const char* pszSourceBand = (psSource->eType == CXT_Element)?
+                        CPLGetXMLValue(psSource, "SourceBand", nullptr) : nullptr;
+            if(pszSourceBand != nullptr && atoi(pszSourceBand) != iBand){
+                CPLError(CE_Failure, CPLE_AppDefined,
+                         "%s: band %d reads band %s of %s; mosaic sources must have the same bands "
+                         "in the same order as the VRT", pszFile, iBand, pszSourceBand,
+                         CPLGetXMLValue(psSource, "SourceFilename", "?"));
+                bOk = false;
+            }
+        }
+    }
+    CPLDestroyXMLNode(psRoot);
+    return bOk;
+}
+
+bool ReadString(VSILFILE* fp, std::string& osText)
+{
+    uint32_t nLength = 0;
+    if(VSIFReadL(&nLength, sizeof(nLength), 1, fp) != 1 || nLength > 65536){
+        return false;
+    }
+    osText.assign(nLength, '\0');
+    return nLength == 0 || VSIFReadL(&osText[0], 1, nLength, fp) == nLength;
+}
+
+bool WriteString(VSILFILE* fp, const std::string& osText)
+{
+    const uint32_t nLength = static_cast<uint32_t>(osText.size());
+    return VSIFWriteL(&nLength, sizeof(nLength), 1, fp) == 1
+            && (nLength == 0 || VSIFWriteL(osText.data(), 1, nLength, fp) == nLength);
+}
+
+}
+
+CPLErr MosaicSceneFiles(const char* pszFile, std::vector<std::string>& files)
+{
+    files.clear();
+    GDALDatasetH hDset = GDALOpen(pszFile, GA_ReadOnly);
+    GDALDriverH hDriver = (hDset != nullptr)? GDALGetDatasetDriver(hDset) : nullptr;
+    if(hDriver == nullptr || !EQUAL(GDALGetDriverShortName(hDriver), "VRT")){
+        if(hDset != nullptr){ GDALClose(hDset); }
+        files.push_back(pszFile);
+        return CE_None;
+    }
+    const int nBands = GDALGetRasterCount(hDset);
+    bool bOk = CheckVrtSourceBands(hDset, pszFile);
+    // 文件列表的第一项是VRT文件本身
+    char** papszFiles = GDALGetFileList(hDset);
+    for(int i=1;papszFiles != nullptr && papszFiles[i] != nullptr;++i){
+        files.push_back(papszFiles[i]);
+    }
+    CSLDestroy(papszFiles);
+    GDALClose(hDset);
+
+    // 各源文件的波段数与VRT相同，源文件按VRT的波段序号统计
+    for(size_t i=0;i<files.size() && bOk;++i){
+        GDALDatasetH hSource = GDALOpen(files[i].c_str(), GA_ReadOnly);
+        if(hSource == nullptr){
+            CPLError(CE_Failure, CPLE_OpenFailed, "%s: cannot open source %s", pszFile, files[i].c_str());
+            bOk = false;
+            break;
+        }
+        const int nSourceBands = GDALGetRasterCount(hSource);
+        GDALClose(hSource);
+        if(nSourceBands != nBands){
+            CPLError(CE_Failure, CPLE_AppDefined,
+                     "%s: source %s has %d band(s) but the VRT has %d; mosaic sources must have the same bands "
+                     "in the same order as the VRT", pszFile, files[i].c_str(), nSourceBands, nBands);
+            bOk = false;
+        }
+    }
+    if(!bOk){
+        files.clear();
+        return CE_Failure;
+    }
+    return CE_None;
+}
+
+CPLErr AddMosaicScenes(MosaicStats& mosaic, const std::vector<std::string>& files,
+                       const int* iBands, int nBandCount, const StreamOptions& opts)
+{
+    TraceScope scope("mosaic_stats");
+    const std::vector<int> bands(iBands, iBands + nBandCount);
+    if(!mosaic.scenes.empty() && mosaic.bands != bands){
+        CPLError(CE_Failure, CPLE_AppDefined, "Bands differ from those of the mosaic statistics");
+        return CE_Failure;
+    }
+
+    // 按规范化路径跳过已经合并的和重复的影像
+    // 已合并的影像被修改时不能只替换它的统计信息(合并结果中减不掉旧的部分)，报错要求重新统计
+    std::map<std::string, MosaicScene> known;
+    for(size_t i=0;i<mosaic.scenes.size();++i){
+        known[mosaic.scenes[i].osPath] = mosaic.scenes[i];
+    }
+    std::vector<MosaicScene> pending;
+    for(size_t i=0;i<files.size();++i){
+        const MosaicScene scene = SceneOf(files[i]);
+        const auto res = known.insert(std::make_pair(scene.osPath, scene));
+        if(res.second){
+            pending.push_back(scene);
+        }
+        else if(res.first->second.nFileSize != scene.nFileSize || res.first->second.nMTime != scene.nMTime){
+            CPLError(CE_Failure, CPLE_AppDefined,
+                     "%s has changed since it was merged into the mosaic statistics; "
+                     "recompute the statistics of all scenes", files[i].c_str());
+            return CE_Failure;
+        }
+    }
+    if(pending.empty()){
+        mosaic.bands = bands;
+        return CE_None;
+    }
+    // 在累加器中合并，最后生成一次统计信息
+    std::vector<BandAccumulator> merged;
+    for(int c=0;c<nBandCount;++c){
+        merged.push_back(static_cast<size_t>(c) < mosaic.stats.size()? BandAccumulator(mosaic.stats[c])
+                                                                      : BandAccumulator(GDT_Unknown));
+    }
+    TraceCount("mosaic_scenes", static_cast<int64_t>(pending.size()));
+
+    ThreadPool& pool = opts.pPool? *opts.pPool : ThreadPool::Global();
+    std::string osError;
+    CPLErrorNum nErrorNo = CPLE_AppDefined;
+    if(pending.size() >= static_cast<size_t>(pool.ThreadCount())){
+        // 各景并行统计，每景内部串行；进度按完成的景数报告
+        // ParallelReduce最多领先未合并的影像2倍线程数，等待合并的各景统计信息有上限
+        StreamOptions sceneOpts = opts;
+        sceneOpts.pfnProgress = nullptr;
+        sceneOpts.pProgressData = nullptr;
+        std::mutex mutex;
+        std::atomic<bool> bStop(false);
+        size_t nDone = 0;
+        ParallelReduce(pool, pending.size(), std::vector<BandStats>(nBandCount),
+            [&](size_t i, std::vector<BandStats>& scene){
+                if(bStop){ return; }
+                std::string osSceneError;
+                const bool bOk = ComputeSceneStats(pending[i].osPath, iBands, nBandCount, sceneOpts,
+                                                   scene.data(), osSceneError);
+                std::lock_guard<std::mutex> lock(mutex);
+                if(bStop){ return; }
+                if(!bOk){
+                    osError = osSceneError;
+                    bStop = true;
+                    return;
+                }
+                nDone += 1;
+                if(opts.pfnProgress != nullptr
+                        && !opts.pfnProgress(static_cast<double>(nDone) / pending.size(), "", opts.pProgressData)){
+                    osError = "User terminated";
+                    nErrorNo = CPLE_UserInterrupt;
+                    bStop = true;
+                }
+            },
+            [&](const std::vector<BandStats>& scene){
+                if(!bStop){ MergeScene(merged, scene); }
+            });
+        if(bStop){
+            CPLError(CE_Failure, nErrorNo, "%s", osError.c_str());
+            return CE_Failure;
+        }
+    }
+    else {
+        // 影像较少时逐景统计，每景内部分块并行
+        for(size_t i=0;i<pending.size();++i){
+            StreamOptions sceneOpts = opts;
+            if(opts.pfnProgress != nullptr){
+                sceneOpts.pProgressData = GDALCreateScaledProgress(static_cast<double>(i) / pending.size(),
+                                                                   static_cast<double>(i + 1) / pending.size(),
+                                                                   opts.pfnProgress, opts.pProgressData);
+                sceneOpts.pfnProgress = GDALScaledProgress;
+            }
+            std::vector<BandStats> scene(nBandCount);
+            const bool bOk = ComputeSceneStats(pending[i].osPath, iBands, nBandCount, sceneOpts, scene.data(), osError);
+            if(opts.pfnProgress != nullptr){
+                GDALDestroyScaledProgress(sceneOpts.pProgressData);
+            }
+            if(!bOk){
+                CPLError(CE_Failure, CPLE_AppDefined, "%s", osError.c_str());
+                return CE_Failure;
+            }
+            MergeScene(merged, scene);
+        }
+    }
+
+    mosaic.bands = bands;
+    mosaic.scenes.insert(mosaic.scenes.end(), pending.begin(), pending.end());
+    mosaic.stats.clear();
+    for(int c=0;c<nBandCount;++c){
+        mosaic.stats.push_back(merged[c].Finalize());
+    }
+    return CE_None;
+}
+
+bool LoadMosaicStats(const char* pszFile, MosaicStats& mosaic)
+{
+    VSILFILE* fp = VSIFOpenL(pszFile, "rb");
+    if(fp == nullptr){
+        return false;
+    }
+    MosaicStats result;
+    MosaicHeader header;
+    bool bOk = VSIFReadL(&header, sizeof(header), 1, fp) == 1
+            && memcmp(header.szMagic, MOSAIC_MAGIC, sizeof(MOSAIC_MAGIC)) == 0
+            && header.nVersion == MOSAIC_VERSION
+            && header.nBandCount > 0 && header.nBandCount <= 65536;
+    if(bOk){
+        result.bands.resize(header.nBandCount);
+        bOk = VSIFReadL(result.bands.data(), sizeof(int32_t), header.nBandCount, fp)
+                == static_cast<size_t>(header.nBandCount);
+    }
+    for(uint32_t i=0;i<header.nSceneCount && bOk;++i){
+        MosaicScene scene;
+        bOk = ReadString(fp, scene.osPath)
+                && VSIFReadL(&scene.nFileSize, sizeof(scene.nFileSize), 1, fp) == 1
+                && VSIFReadL(&scene.nMTime, sizeof(scene.nMTime), 1, fp) == 1;
+        result.scenes.push_back(scene);
+    }
+    for(int c=0;c<header.nBandCount && bOk;++c){
+        MosaicBand band;
+        bOk = VSIFReadL(&band, sizeof(band), 1, fp) == 1
+                && band.nDistBins >= 2 && band.nDistBins % 2 == 0
+                && band.nUsedOffset >= 0 && band.nUsedCount >= 0
+                && band.nUsedCount <= band.nDistBins - band.nUsedOffset;
+        std::vector<uint64_t> counts(bOk? band.nUsedCount : 0);
+        bOk = bOk && (counts.empty() || VSIFReadL(counts.data(), sizeof(uint64_t), counts.size(), fp) == counts.size());
+        if(!bOk){ break; }
+
+        BandStats stats;
+        stats.dfMin = band.dfMin;
+        stats.dfMax = band.dfMax;
+        stats.dfMean = band.dfMean;
+        stats.dfStddev = band.dfStddev;
+        stats.nValidCount = band.nValidCount;
+        stats.eType = static_cast<GDALDataType>(band.eType);
+        stats.distribution = StreamHistogram::FromCounts(band.nDistBins, band.nDistExp, band.nDistOrigin,
+                                                         band.bDistInteger != 0, band.nUsedOffset,
+                                                         counts.data(), band.nUsedCount);
+        stats.histogram = (stats.nValidCount > 0)? stats.distribution.Resample(stats.dfMin, stats.dfMax, HIST_BINS)
+                                                 : std::vector<double>(HIST_BINS, 0.0);
+        result.stats.push_back(stats);
+    }
+    VSIFCloseL(fp);
+    if(!bOk){
+        CPLDebug("RSISA", "Invalid mosaic statistics file %s", pszFile);
+        return false;
+    }
+    mosaic = result;
+    return true;
+}
+
+bool SaveMosaicStats(const char* pszFile, const MosaicStats& mosaic)
+{
+    if(mosaic.bands.empty() || mosaic.stats.size() != mosaic.bands.size()){
+        CPLError(CE_Failure, CPLE_AppDefined, "Empty mosaic statistics");
+        return false;
+    }
+    // 先写入临时文件再改名，写出失败时不破坏已有的文件
+    const std::string osTemp = std::string(pszFile) + ".tmp";
+    VSILFILE* fp = VSIFOpenL(osTemp.c_str(), "wb");
+    if(fp == nullptr){
+        CPLError(CE_Failure, CPLE_OpenFailed, "Cannot create %s", osTemp.c_str());
+        return false;
+    }
+    MosaicHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.szMagic, MOSAIC_MAGIC, sizeof(MOSAIC_MAGIC));
+    header.nVersion = MOSAIC_VERSION;
+    header.nBandCount = static_cast<int32_t>(mosaic.bands.size());
+    header.nSceneCount = static_cast<uint32_t>(mosaic.scenes.size());
+    bool bOk = VSIFWriteL(&header, sizeof(header), 1, fp) == 1;
+    for(size_t c=0;c<mosaic.bands.size() && bOk;++c){
+        const int32_t iBand = mosaic.bands[c];
+        bOk = VSIFWriteL(&iBand, sizeof(iBand), 1, fp) == 1;
+    }
+    for(size_t i=0;i<mosaic.scenes.size() && bOk;++i){
+        const MosaicScene& scene = mosaic.scenes[i];
+        bOk = WriteString(fp, scene.osPath)
+                && VSIFWriteL(&scene.nFileSize, sizeof(scene.nFileSize), 1, fp) == 1
+                && VSIFWriteL(&scene.nMTime, sizeof(scene.nMTime), 1, fp) == 1;
+    }
+    for(size_t c=0;c<mosaic.stats.size() && bOk;++c){
+        const BandStats& stats = mosaic.stats[c];
+        const StreamHistogram& dist = stats.distribution;
+        int nFirst = 0, nLast = -1;
+        dist.UsedBins(nFirst, nLast);
+
+        MosaicBand band;
+        memset(&band, 0, sizeof(band));
+        band.dfMin = stats.dfMin;
+        band.dfMax = stats.dfMax;
+        band.dfMean = stats.dfMean;
+        band.dfStddev = stats.dfStddev;
+        band.nValidCount = stats.nValidCount;
+        band.nDistOrigin = dist.Origin();
+        band.eType = static_cast<int32_t>(stats.eType);
+        band.nDistExp = dist.Exp();
+        band.nDistBins = dist.Bins();
+        band.bDistInteger = dist.IsInteger()? 1 : 0;
+        band.nUsedOffset = (nLast >= nFirst)? nFirst : 0;
+        band.nUsedCount = nLast - nFirst + 1;
+        bOk = VSIFWriteL(&band, sizeof(band), 1, fp) == 1;
+        if(bOk && band.nUsedCount > 0){
+            bOk = VSIFWriteL(dist.Counts().data() + band.nUsedOffset, sizeof(uint64_t), band.nUsedCount, fp)
+                    == static_cast<size_t>(band.nUsedCount);
+        }
+    }
+    bOk = (VSIFCloseL(fp) == 0) && bOk;
+    if(bOk && VSIRename(osTemp.c_str(), pszFile) != 0){
+        // Windows上目标文件已存在时不能改名，删除旧文件后重试
+        VSIUnlink(pszFile);
+        bOk = VSIRename(osTemp.c_str(), pszFile) == 0;
+    }
+    if(!bOk){
+        VSIUnlink(osTemp.c_str());
+        CPLError(CE_Failure, CPLE_FileIO, "Failed to write %s", pszFile);
+        return false;
+    }
+    return true;
+}
+
+}
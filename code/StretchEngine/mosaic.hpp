@@ -0,0 +1,53 @@
+﻿#ifndef MOSAIC_HPP
+#define MOSAIC_HPP
+
+#include "rasterstream.hpp"
+
+#include <string>
+#include <vector>
+
+// 镶嵌统计：多景影像(或VRT引用的各景影像)同一波段合并后的统计信息
+// 各景分别统计(使用统计缓存)，再用MergeBandStats合并为一组统计信息，所有影像用同一组统计信息生成拉伸变换
+// 相邻影像的拉伸结果一致，镶嵌后没有接缝
+// 合并结果可以保存到文件，有新的影像时只统计新影像并合并进去，不需要重新读取已合并的影像
+namespace rsisa
+{
+
+// 已合并的一景影像
+struct MosaicScene
+{
+    std::string osPath;         // 本地文件为规范化的绝对路径，其它为原路径
+    uint64_t nFileSize = 0;     // 合并时的文件大小和修改时间(纳秒)，无法获取时为0
+    int64_t  nMTime = 0;
+};
+
+// 合并后的统计信息
+struct MosaicStats
+{
+    std::vector<int> bands;             // 各景影像参与统计的波段序号
+    std::vector<MosaicScene> scenes;    // 已合并的影像，按合并的顺序排列
+    std::vector<BandStats> stats;       // 与bands一一对应
+};
+
+// 影像文件对应的各景影像：VRT返回其引用的源文件，其它返回文件本身
+// VRT的第i个波段只能引用各源文件的第i个波段，且各源文件的波段数与VRT相同
+// 不满足时返回CE_Failure并报告不符的源文件，files为空
+CPLErr MosaicSceneFiles(const char* pszFile, std::vector<std::string>& files);
+
+// 统计各景影像的指定波段并合并到mosaic中，已经在mosaic.scenes中的影像(按规范化路径比较)跳过
+// 已合并的影像的大小或修改时间改变时返回CE_Failure：合并结果中不能减去旧的统计信息，需要重新统计所有影像
+// mosaic为空时设置参与统计的波段，否则iBands必须与mosaic.bands相同
+// 影像数不少于线程数时各景并行统计，否则逐景统计、每景内部分块并行；都按文件顺序合并
+// 每完成一景报告一次进度，有影像无法打开、波段不存在或被进度回调中止时返回CE_Failure，mosaic保持不变
+CPLErr AddMosaicScenes(MosaicStats& mosaic, const std::vector<std::string>& files,
+                       const int* iBands, int nBandCount, const StreamOptions& opts);
+
+// 读取保存的镶嵌统计，文件不存在或格式不对时返回false
+bool LoadMosaicStats(const char* pszFile, MosaicStats& mosaic);
+
+// 保存镶嵌统计，失败时返回false
+bool SaveMosaicStats(const char* pszFile, const MosaicStats& mosaic);
+
+}
+
+#endif // MOSAIC_HPP
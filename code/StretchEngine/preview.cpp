@@ -0,0 +1,157 @@
+﻿#include "preview.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rsisa
+{
+
+namespace
+{
+
+// 预览的[nBufYOff,nBufYOff+nBufRows)行在源数据上对应的窗口
+// 源窗口不是整行时由浮点窗口保证抽样位置与整幅读取一致
+void PreviewRowWindow(int nSrcXSize, int nSrcYSize, int nBufYSize, int nBufYOff, int nBufRows,
+                      int& nYOff, int& nYSize, GDALRasterIOExtraArg& sExtraArg)
+{
+    const double dfRowHeight = static_cast<double>(nSrcYSize) / nBufYSize;
+    const double dfYOff = nBufYOff * dfRowHeight;
+    const double dfYSize = std::min(nBufRows * dfRowHeight, nSrcYSize - dfYOff);
+    nYOff = static_cast<int>(dfYOff);
+    nYSize = std::max(1, std::min(nSrcYSize, static_cast<int>(std::ceil(dfYOff + dfYSize))) - nYOff);
+    if(nBufYOff != 0 || nBufRows != nBufYSize){
+        sExtraArg.bFloatingPointWindowValidity = TRUE;
+        sExtraArg.dfXOff = 0.0;
+        sExtraArg.dfYOff = dfYOff;
+        sExtraArg.dfXSize = nSrcXSize;
+        sExtraArg.dfYSize = dfYSize;
+    }
+}
+
+}
+
+void PreviewSize(int nXSize, int nYSize, int nMaxSize, int& nBufXSize, int& nBufYSize)
+{
+    // 窄长条带影像(如推扫式影像)按高度缩小
+    const double dfScale = std::min(1.0, static_cast<double>(nMaxSize) / std::max(nXSize, nYSize));
+    nBufXSize = std::max(1, static_cast<int>(nXSize * dfScale + 0.5));
+    nBufYSize = std::max(1, static_cast<int>(nYSize * dfScale + 0.5));
+}
+
+GDALRasterBandH SelectOverview(GDALRasterBandH hBand, int nBufXSize, int nBufYSize)
+{
+    GDALRasterBandH hBest = hBand;
+    int nBestXSize = GDALGetRasterBandXSize(hBand);
+    const int nOverviews = GDALGetOverviewCount(hBand);
+    for(int i=0;i<nOverviews;++i){
+        GDALRasterBandH hOvr = GDALGetOverview(hBand, i);
+        if(hOvr == nullptr){ continue; }
+        const int nOvrXSize = GDALGetRasterBandXSize(hOvr);
+        const int nOvrYSize = GDALGetRasterBandYSize(hOvr);
+        // 概览分辨率不能低于预览，否则需要放大
+        if(nOvrXSize >= nBufXSize && nOvrYSize >= nBufYSize && nOvrXSize < nBestXSize){
+            hBest = hOvr;
+            nBestXSize = nOvrXSize;
+        }
+    }
+    return hBest;
+}
+
+CPLErr ReadPreviewBand(GDALRasterBandH hBand, int nBufXSize, int nBufYSize, double dfNoData,
+                       std::vector<uint8_t>& data, BandView& view,
+                       GDALProgressFunc pfnProgress, void* pProgressData)
+{
+    const GDALDataType eType = BufferTypeFor(GDALGetRasterDataType(hBand));
+    const size_t nCount = static_cast<size_t>(nBufXSize) * nBufYSize;
+    data.resize(nCount * GDALGetDataTypeSizeBytes(eType));
+    CPLErr err = ReadPreviewRows(hBand, nBufXSize, nBufYSize, 0, nBufYSize, data.data(),
+                                 pfnProgress, pProgressData);
+    view.pData = data.data();
+    view.eType = eType;
+    view.nCount = nCount;
+    view.dfNoData = dfNoData;
+    return err;
+}
+
+CPLErr ReadPreviewRows(GDALRasterBandH hBand, int nBufXSize, int nBufYSize, int nBufYOff, int nBufRows,
+                       void* pData, GDALProgressFunc pfnProgress, void* pProgressData)
+{
+    TraceScope scope("read_preview");
+    const GDALDataType eType = BufferTypeFor(GDALGetRasterDataType(hBand));
+    TraceCount("bytes_read", static_cast<int64_t>(nBufXSize) * nBufRows * GDALGetDataTypeSizeBytes(eType));
+    GDALRasterBandH hSrc = SelectOverview(hBand, nBufXSize, nBufYSize);
+    const int nSrcXSize = GDALGetRasterBandXSize(hSrc);
+    const int nSrcYSize = GDALGetRasterBandYSize(hSrc);
+
+    GDALRasterIOExtraArg sExtraArg;
+    INIT_RASTERIO_EXTRA_ARG(sExtraArg);
+    sExtraArg.pfnProgress = pfnProgress;
+    sExtraArg.pProgressData = pProgressData;
+    int nYOff = 0, nYSize = 0;
+    PreviewRowWindow(nSrcXSize, nSrcYSize, nBufYSize, nBufYOff, nBufRows, nYOff, nYSize, sExtraArg);
+    return GDALRasterIOEx(hSrc, GF_Read, 0, nYOff, nSrcXSize, nYSize,
+                          pData, nBufXSize, nBufRows, eType, 0, 0, &sExtraArg);
+}
+
+CPLErr ReadPreviewRows(GDALDatasetH hDset, int nBandCount, const int* iBands, GDALDataType eBufType,
+                       int nBufXSize, int nBufYSize, int nBufYOff, int nBufRows, void* pData,
+                       GDALProgressFunc pfnProgress, void* pProgressData)
+{
+    TraceScope scope("read_preview");
+    TraceCount("bytes_read", static_cast<int64_t>(nBufXSize) * nBufRows * nBandCount * GDALGetDataTypeSizeBytes(eBufType));
+    // 数据集级读取由GDAL选择合适的概览
+    const int nSrcXSize = GDALGetRasterXSize(hDset);
+    const int nSrcYSize = GDALGetRasterYSize(hDset);
+    GDALRasterIOExtraArg sExtraArg;
+    INIT_RASTERIO_EXTRA_ARG(sExtraArg);
+    sExtraArg.pfnProgress = pfnProgress;
+    sExtraArg.pProgressData = pProgressData;
+    int nYOff = 0, nYSize = 0;
+    PreviewRowWindow(nSrcXSize, nSrcYSize, nBufYSize, nBufYOff, nBufRows, nYOff, nYSize, sExtraArg);
+    return GDALDatasetRasterIOEx(hDset, GF_Read, 0, nYOff, nSrcXSize, nYSize,
+                                 pData, nBufXSize, nBufRows, eBufType,
+                                 nBandCount, const_cast<int*>(iBands), 0, 0, 0, &sExtraArg);
+}
+
+bool IsPixelInterleaved(GDALDatasetH hDset)
+{
+    const char* pszInterleave = GDALGetMetadataItem(hDset, "INTERLEAVE", "IMAGE_STRUCTURE");
+    return pszInterleave != nullptr && EQUAL(pszInterleave, "PIXEL");
+}
+
+CPLErr ReadPreview(GDALDatasetH hDset, const int iBands[3], int nMaxSize, double dfNoData,
+                   PreviewBuffer& preview)
+{
+    const int nXSize = GDALGetRasterXSize(hDset);
+    const int nYSize = GDALGetRasterYSize(hDset);
+    if(nXSize <= 0 || nYSize <= 0){
+        return CE_Failure;
+    }
+    PreviewSize(nXSize, nYSize, nMaxSize, preview.nXSize, preview.nYSize);
+
+    for(int c=0;c<3;++c){
+        GDALRasterBandH hBand = GDALGetRasterBand(hDset, iBands[c]);
+        if(hBand == nullptr){
+            return CE_Failure;
+        }
+        // 相同波段只读取一次
+        int iSame = -1;
+        for(int p=0;p<c;++p){
+            if(iBands[p] == iBands[c]){ iSame = p; break; }
+        }
+        if(iSame >= 0){
+            preview.views[c] = preview.views[iSame];
+            continue;
+        }
+
+        CPLErr err = ReadPreviewBand(hBand, preview.nXSize, preview.nYSize, dfNoData,
+                                     preview.data[c], preview.views[c]);
+        if(err != CE_None){
+            return err;
+        }
+    }
+    return CE_None;
+}
+
+}
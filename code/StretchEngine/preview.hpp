@@ -0,0 +1,54 @@
+﻿#ifndef PREVIEW_HPP
+#define PREVIEW_HPP
+
+#include "stretchengine.hpp"
+
+#include <vector>
+
+// 快速预览：只读取显示所需分辨率的数据
+// 优先使用影像的概览(金字塔)，没有合适的概览时由RasterIO按缩小后的缓冲区抽样读取
+namespace rsisa
+{
+
+// 按预览大小读取的三个波段数据
+struct PreviewBuffer
+{
+    int nXSize = 0;                 // 预览宽度
+    int nYSize = 0;                 // 预览高度
+    std::vector<uint8_t> data[3];
+    BandView views[3];
+};
+
+// 计算宽和高都不超过nMaxSize、保持宽高比的预览大小(按较长的一边缩小)
+void PreviewSize(int nXSize, int nYSize, int nMaxSize, int& nBufXSize, int& nBufYSize);
+
+// 选择不小于预览大小的最小一级概览，没有时返回原波段
+GDALRasterBandH SelectOverview(GDALRasterBandH hBand, int nBufXSize, int nBufYSize);
+
+// 读取一个波段nBufXSize*nBufYSize大小的预览数据，按 BufferTypeFor 选定的类型存放到data中
+// pfnProgress为GDAL进度回调，返回FALSE时中止读取
+CPLErr ReadPreviewBand(GDALRasterBandH hBand, int nBufXSize, int nBufYSize, double dfNoData,
+                       std::vector<uint8_t>& data, BandView& view,
+                       GDALProgressFunc pfnProgress = nullptr, void* pProgressData = nullptr);
+
+// 只读取预览数据中从第nBufYOff行开始的nBufRows行，存放到pData(按 BufferTypeFor 选定的类型)
+// 按浮点窗口抽样，分多次读取的结果与 ReadPreviewBand 一次读取的结果相同，用于逐条显示
+CPLErr ReadPreviewRows(GDALRasterBandH hBand, int nBufXSize, int nBufYSize, int nBufYOff, int nBufRows,
+                       void* pData, GDALProgressFunc pfnProgress = nullptr, void* pProgressData = nullptr);
+
+// 按波段映射一次读取nBandCount个波段预览数据的同一段行，各波段依次存放在pData中(类型为eBufType)
+// 像素交叉存储的影像逐波段读取时每个波段都要读取全部数据，按波段映射读取只需一遍(见 IsPixelInterleaved)
+CPLErr ReadPreviewRows(GDALDatasetH hDset, int nBandCount, const int* iBands, GDALDataType eBufType,
+                       int nBufXSize, int nBufYSize, int nBufYOff, int nBufRows, void* pData,
+                       GDALProgressFunc pfnProgress = nullptr, void* pProgressData = nullptr);
+
+// 影像是否按像素交叉存储(BIP)
+bool IsPixelInterleaved(GDALDatasetH hDset);
+
+// 读取三个波段的预览数据，各波段按 BufferTypeFor 选定的类型存放
+CPLErr ReadPreview(GDALDatasetH hDset, const int iBands[3], int nMaxSize, double dfNoData,
+                   PreviewBuffer& preview);
+
+}
+
+#endif // PREVIEW_HPP
@@ -0,0 +1,505 @@
+﻿#include "rasterstream.hpp"
+#include "bandstats.hpp"
+#include "statscache.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace rsisa
+{
+
+namespace
+{
+
+// 单行条带合并后每块的目标像素个数
+const int STRIP_WINDOW_PIXELS = 1 << 20;
+
+ThreadPool& PoolFor(const StreamOptions& opts)
+{
+    return opts.pPool? *opts.pPool : ThreadPool::Global();
+}
+
+// 报告进度，回调返回FALSE时设置中止错误并返回false
+bool ReportProgress(const StreamOptions& opts, double dfComplete)
+{
+    if(opts.pfnProgress == nullptr || opts.pfnProgress(dfComplete, "", opts.pProgressData)){
+        return true;
+    }
+    CPLError(CE_Failure, CPLE_UserInterrupt, "User terminated");
+    return false;
+}
+
+// 并行任务中第一个失败的错误
+// CPL的错误状态属于各线程，工作线程上的错误要在调用线程重新报告，调用者才能用CPLGetLastErrorMsg取得
+struct TaskError
+{
+    CPLErr eErr;
+    CPLErrorNum nErrorNo;
+    std::string osMsg;
+
+    TaskError() : eErr(CE_None), nErrorNo(CPLE_None) {}
+
+    // 在出错的线程上记录错误号和错误信息，调用者持有锁
+    void Capture(CPLErr err)
+    {
+        eErr = err;
+        nErrorNo = CPLGetLastErrorNo();
+        osMsg = CPLGetLastErrorMsg();
+    }
+
+    // 在调用线程上重新报告并返回错误，错误发生在调用线程上时不重复报告
+    CPLErr Raise() const
+    {
+        if(eErr != CE_None && (CPLGetLastErrorNo() != nErrorNo || osMsg != CPLGetLastErrorMsg())){
+            CPLError(eErr, nErrorNo, "%s", osMsg.c_str());
+        }
+        return eErr;
+    }
+};
+
+// 分段报告进度：将opts的进度回调映射到[dfMin,dfMax]区间
+class ProgressStage
+{
+public:
+    ProgressStage(const StreamOptions& opts, double dfMin, double dfMax)
+        : m_opts(opts), m_bScaled(opts.pfnProgress != nullptr)
+    {
+        if(m_bScaled){
+            m_opts.pProgressData = GDALCreateScaledProgress(dfMin, dfMax, opts.pfnProgress, opts.pProgressData);
+            m_opts.pfnProgress = GDALScaledProgress;
+        }
+    }
+    ~ProgressStage()
+    {
+        if(m_bScaled){
+            GDALDestroyScaledProgress(m_opts.pProgressData);
+        }
+    }
+    const StreamOptions& Options() const { return m_opts; }
+
+private:
+    ProgressStage(const ProgressStage&);
+    ProgressStage& operator=(const ProgressStage&);
+
+    StreamOptions m_opts;
+    bool m_bScaled;
+};
+
+// 在默认创建选项上覆盖用户指定的NAME=VALUE选项
+char** MergeCreationOptions(char** papszOptions, const std::vector<std::string>& options)
+{
+    for(size_t i=0;i<options.size();++i){
+        char* pszKey = nullptr;
+        const char* pszValue = CPLParseNameValue(options[i].c_str(), &pszKey);
+        if(pszKey != nullptr && pszValue != nullptr){
+            papszOptions = CSLSetNameValue(papszOptions, pszKey, pszValue);
+        }
+        CPLFree(pszKey);
+    }
+    return papszOptions;
+}
+
+// 创建分块存储的RGB(A) GeoTIFF，复制hSrc的地理参考
+GDALDatasetH CreateRGBGeoTIFF(GDALDatasetH hSrc, const char* pszDstFile, bool bAlpha,
+                              const std::vector<std::string>& options)
+{
+    GDALDriverH hDriver = GDALGetDriverByName("GTiff");
+    if(hDriver == nullptr){
+        CPLError(CE_Failure, CPLE_AppDefined, "GTiff driver not available");
+        return nullptr;
+    }
+    char** papszOptions = nullptr;
+    papszOptions = CSLSetNameValue(papszOptions, "TILED", "YES");
+    papszOptions = CSLSetNameValue(papszOptions, "PHOTOMETRIC", "RGB");
+    if(bAlpha){
+        papszOptions = CSLSetNameValue(papszOptions, "ALPHA", "YES");
+    }
+    papszOptions = CSLSetNameValue(papszOptions, "BIGTIFF", "IF_SAFER");
+    papszOptions = MergeCreationOptions(papszOptions, options);
+    GDALDatasetH hDst = GDALCreate(hDriver, pszDstFile,
+                                   GDALGetRasterXSize(hSrc), GDALGetRasterYSize(hSrc),
+                                   bAlpha? 4 : 3, GDT_Byte, papszOptions);
+    CSLDestroy(papszOptions);
+    if(hDst == nullptr){
+        return nullptr;
+    }
+    double adfGeoTransform[6];
+    if(GDALGetGeoTransform(hSrc, adfGeoTransform) == CE_None){
+        GDALSetGeoTransform(hDst, adfGeoTransform);
+    }
+    const char* pszWkt = GDALGetProjectionRef(hSrc);
+    if(pszWkt != nullptr && pszWkt[0] != '\0'){
+        GDALSetProjection(hDst, pszWkt);
+    }
+    return hDst;
+}
+
+}
+
+std::vector<RasterWindow> ComputeWindows(GDALDatasetH hDset, int iBand, const StreamOptions& opts)
+{
+    std::vector<RasterWindow> windows;
+    const int nXSize = GDALGetRasterXSize(hDset);
+    const int nYSize = GDALGetRasterYSize(hDset);
+    if(nXSize <= 0 || nYSize <= 0){
+        return windows;
+    }
+
+    int nWinX = opts.nWindowXSize, nWinY = opts.nWindowYSize;
+    if(nWinX <= 0 || nWinY <= 0){
+        int nBlockX = 0, nBlockY = 0;
+        GDALGetBlockSize(GDALGetRasterBand(hDset, iBand), &nBlockX, &nBlockY);
+        nWinX = std::max(1, nBlockX);
+        nWinY = std::max(1, nBlockY);
+        // 条带存储时合并多行，减少RasterIO调用次数
+        if(nWinX >= nXSize && static_cast<int64_t>(nXSize) * nWinY < STRIP_WINDOW_PIXELS){
+            nWinY *= std::max(1, STRIP_WINDOW_PIXELS / (nXSize * nWinY));
+        }
+    }
+    nWinX = std::min(nWinX, nXSize);
+    nWinY = std::min(nWinY, nYSize);
+
+    for(int y=0;y<nYSize;y+=nWinY){
+        for(int x=0;x<nXSize;x+=nWinX){
+            RasterWindow win = {x, y, std::min(nWinX, nXSize - x), std::min(nWinY, nYSize - y)};
+            windows.push_back(win);
+        }
+    }
+    return windows;
+}
+
+double BandNoData(GDALRasterBandH hBand, const StreamOptions& opts)
+{
+    if(opts.bUseBandNoData){
+        int bHasNoData = FALSE;
+        double dfNoData = GDALGetRasterNoDataValue(hBand, &bHasNoData);
+        if(bHasNoData){
+            return dfNoData;
+        }
+    }
+    return opts.dfNoData;
+}
+
+CPLErr ReadWindow(GDALRasterBandH hBand, const RasterWindow& win, double dfNoData,
+                  std::vector<uint8_t>& buffer, BandView& view)
+{
+    TraceScope scope("read");
+    const GDALDataType eType = BufferTypeFor(GDALGetRasterDataType(hBand));
+    const size_t nCount = static_cast<size_t>(win.nXSize) * win.nYSize;
+    buffer.resize(nCount * GDALGetDataTypeSizeBytes(eType));
+    TraceCount("bytes_read", static_cast<int64_t>(buffer.size()));
+    CPLErr err = GDALRasterIO(hBand, GF_Read,
+                              win.nXOff, win.nYOff, win.nXSize, win.nYSize,
+                              buffer.data(), win.nXSize, win.nYSize, eType, 0, 0);
+    view.pData = buffer.data();
+    view.eType = eType;
+    view.nCount = nCount;
+    view.dfNoData = dfNoData;
+    return err;
+}
+
+CPLErr ComputeStreamStats(GDALDatasetH hDset, const int* iBands, int nBandCount,
+                          const StreamOptions& opts, BandStats* pStats)
+{
+    TraceScope scope("stream_stats");
+    // 先读取缓存的统计信息，只统计没有缓存的波段
+    std::vector<int> missing;
+    std::vector<BandAccumulator> init;
+    std::vector<BandAccumulator> total;
+    std::vector<std::unique_ptr<HistogramPool> > hists;
+    std::vector<double> noData;
+    for(int b=0;b<nBandCount;++b){
+        GDALRasterBandH hBand = GDALGetRasterBand(hDset, iBands[b]);
+        const double dfNoData = BandNoData(hBand, opts);
+        if(opts.bUseStatsCache && LoadCachedStats(hDset, iBands[b], dfNoData, pStats[b])){
+            continue;
+        }
+        missing.push_back(b);
+        const GDALDataType eType = GDALGetRasterDataType(hBand);
+        init.push_back(BandAccumulator::WithoutHistogram(eType));
+        total.push_back(BandAccumulator(eType));
+        hists.push_back(std::unique_ptr<HistogramPool>(new HistogramPool(eType)));
+        noData.push_back(dfNoData);
+    }
+    if(missing.empty()){
+        return ReportProgress(opts, 1.0)? CE_None : CE_Failure;
+    }
+    if(!ReportProgress(opts, 0.0)){
+        return CE_Failure;
+    }
+    const size_t nMissing = missing.size();
+
+    // 各分块并行统计，GDAL数据集不能同时被多个线程读取，读取时加锁
+    // 最大最小值和矩按分块顺序合并，像素值分布每个线程一个(见HistogramPool)
+    std::mutex ioMutex;
+    TaskError error;
+    size_t nDone = 0;
+    const std::vector<RasterWindow> windows = ComputeWindows(hDset, iBands[0], opts);
+    ParallelReduce(PoolFor(opts), windows.size(), init,
+        [&](size_t w, std::vector<BandAccumulator>& accs){
+            std::vector<uint8_t> buffer;
+            BandView view;
+            for(size_t b=0;b<nMissing;++b){
+                {
+                    std::lock_guard<std::mutex> lock(ioMutex);
+                    if(error.eErr != CE_None){ return; }
+                    CPLErr err = ReadWindow(GDALGetRasterBand(hDset, iBands[missing[b]]), windows[w],
+                                            noData[b], buffer, view);
+                    if(err != CE_None){ error.Capture(err); return; }
+                }
+                StreamHistogram* pHist = hists[b]->Acquire();
+                accs[b].Add(view, *pHist);
+                hists[b]->Release(pHist);
+            }
+            std::lock_guard<std::mutex> lock(ioMutex);
+            if(error.eErr == CE_None && !ReportProgress(opts, static_cast<double>(++nDone) / windows.size())){
+                error.Capture(CE_Failure);
+            }
+        },
+        [&](const std::vector<BandAccumulator>& accs){
+            for(size_t b=0;b<nMissing;++b){
+                total[b].Merge(accs[b]);
+            }
+        });
+    if(error.eErr != CE_None){
+        return error.Raise();
+    }
+
+    for(size_t b=0;b<nMissing;++b){
+        hists[b]->MergeInto(total[b].histogram);
+        pStats[missing[b]] = total[b].Finalize();
+        if(opts.bUseStatsCache){
+            SaveCachedStats(hDset, iBands[missing[b]], noData[b], pStats[missing[b]]);
+        }
+    }
+    return CE_None;
+}
+
+namespace
+{
+
+// 拉伸一个分块的三个波段，输出RGBA8888
+typedef std::function<void(const RasterWindow& win, const BandView views[3], uint8_t* pRGBA)> WindowStretchFn;
+
+// 逐块读取三个波段，用stretch拉伸后写出到hDst
+CPLErr StreamWindowsRGBA(GDALDatasetH hSrc, const int iBands[3], const WindowStretchFn& stretch,
+                         GDALDatasetH hDst, const StreamOptions& opts)
+{
+    if(GDALGetRasterXSize(hDst) != GDALGetRasterXSize(hSrc)
+            || GDALGetRasterYSize(hDst) != GDALGetRasterYSize(hSrc)
+            || GDALGetRasterCount(hDst) < 3){
+        CPLError(CE_Failure, CPLE_AppDefined, "Output dataset does not match the source");
+        return CE_Failure;
+    }
+
+    double noData[3];
+    for(int c=0;c<3;++c){
+        noData[c] = BandNoData(GDALGetRasterBand(hSrc, iBands[c]), opts);
+    }
+    // 输出只有三个波段时不写透明通道
+    const int nDstBands = std::min(4, GDALGetRasterCount(hDst));
+
+    if(!ReportProgress(opts, 0.0)){
+        return CE_Failure;
+    }
+
+    // 各分块并行拉伸，读写时加锁
+    std::mutex ioMutex;
+    TaskError error;
+    size_t nDone = 0;
+    const std::vector<RasterWindow> windows = ComputeWindows(hSrc, iBands[0], opts);
+    PoolFor(opts).ParallelFor(windows.size(), [&](size_t w){
+        const RasterWindow& win = windows[w];
+        std::vector<uint8_t> buffers[3];
+        BandView views[3];
+        {
+            std::lock_guard<std::mutex> lock(ioMutex);
+            if(error.eErr != CE_None){ return; }
+            for(int c=0;c<3;++c){
+                CPLErr err = ReadWindow(GDALGetRasterBand(hSrc, iBands[c]), win,
+                                        noData[c], buffers[c], views[c]);
+                if(err != CE_None){ error.Capture(err); return; }
+            }
+        }
+        std::vector<uint8_t> rgba(views[0].nCount * 4);
+        stretch(win, views, rgba.data());
+        std::lock_guard<std::mutex> lock(ioMutex);
+        if(error.eErr != CE_None){ return; }
+        TraceScope writeScope("write");
+        TraceCount("bytes_written", static_cast<int64_t>(views[0].nCount) * nDstBands);
+        CPLErr err = GDALDatasetRasterIO(hDst, GF_Write,
+                                         win.nXOff, win.nYOff, win.nXSize, win.nYSize,
+                                         rgba.data(), win.nXSize, win.nYSize, GDT_Byte,
+                                         nDstBands, nullptr, 4, 4 * win.nXSize, 1);
+        if(err != CE_None){ error.Capture(err); return; }
+        if(!ReportProgress(opts, static_cast<double>(++nDone) / windows.size())){
+            error.Capture(CE_Failure);
+        }
+    });
+    return error.Raise();
+}
+
+}
+
+CPLErr StreamStretchRGBA(GDALDatasetH hSrc, const int iBands[3],
+                         const StretchTransform* transforms[3],
+                         GDALDatasetH hDst, const StreamOptions& opts)
+{
+    TraceScope scope("stream_stretch");
+    return StreamWindowsRGBA(hSrc, iBands, [&](const RasterWindow&, const BandView views[3], uint8_t* pRGBA){
+        ApplyStretchRGBA(views, transforms, pRGBA);
+    }, hDst, opts);
+}
+
+CPLErr ComputeStreamClahe(GDALDatasetH hDset, const int* iBands, int nBandCount, const BandStats* pStats,
+                          const ClaheOptions& clahe, const StreamOptions& opts, ClaheGrid* pGrids)
+{
+    TraceScope scope("stream_clahe");
+    const int nXSize = GDALGetRasterXSize(hDset);
+    const int nYSize = GDALGetRasterYSize(hDset);
+    std::vector<double> noData(static_cast<size_t>(nBandCount));
+    for(int b=0;b<nBandCount;++b){
+        pGrids[b] = InitClaheGrid(nXSize, nYSize, pStats[b], clahe);
+        noData[b] = BandNoData(GDALGetRasterBand(hDset, iBands[b]), opts);
+    }
+    if(!ReportProgress(opts, 0.0)){
+        return CE_Failure;
+    }
+
+    // 逐行网格、逐波段读取整行网格的数据，该行各网格并行统计，每个网格只写自己的颜色表
+    // 一次读取完整的分块行，不再由各网格分别加锁读取同一分块
+    const ClaheGrid& grid = pGrids[0];
+    const size_t nSteps = static_cast<size_t>(grid.nTilesY) * nBandCount;
+    std::vector<uint8_t> buffer;
+    BandView view;
+    for(int nTileY=0;nTileY<grid.nTilesY;++nTileY){
+        RasterWindow win;
+        ClaheTileWindow(grid, 0, nTileY, win.nXOff, win.nYOff, win.nXSize, win.nYSize);
+        win.nXSize = nXSize;
+        for(int b=0;b<nBandCount;++b){
+            CPLErr err = ReadWindow(GDALGetRasterBand(hDset, iBands[b]), win, noData[b], buffer, view);
+            if(err != CE_None){
+                return err;
+            }
+            BuildClaheRowLuts(view, nTileY, pGrids[b], &PoolFor(opts));
+            const size_t nDone = static_cast<size_t>(nTileY) * nBandCount + b + 1;
+            if(!ReportProgress(opts, static_cast<double>(nDone) / nSteps)){
+                return CE_Failure;
+            }
+        }
+    }
+    return CE_None;
+}
+
+CPLErr StreamClaheRGBA(GDALDatasetH hSrc, const int iBands[3], const ClaheGrid* grids[3],
+                       GDALDatasetH hDst, const StreamOptions& opts)
+{
+    TraceScope scope("stream_stretch");
+    return StreamWindowsRGBA(hSrc, iBands, [&](const RasterWindow& win, const BandView views[3], uint8_t* pRGBA){
+        ApplyClaheRGBA(views, grids, win.nXOff, win.nYOff, win.nXSize, pRGBA);
+    }, hDst, opts);
+}
+
+CPLErr StretchToGeoTIFF(GDALDatasetH hSrc, const char* pszDstFile, const int iBands[3],
+                        StretchAlgorithm eAlg, const StreamOptions& opts,
+                        const OutputOptions& output, const ClaheOptions& clahe,
+                        const BandStats* pStats)
+{
+    if(output.eFormat == OF_COG && GDALGetDriverByName("COG") == nullptr){
+        CPLError(CE_Failure, CPLE_AppDefined, "COG driver not available (requires GDAL 3.1)");
+        return CE_Failure;
+    }
+
+    // 进度：统计(、CLAHE网格)和拉伸写出平分，输出COG时转换占最后的20%
+    // 给定统计信息时没有统计这一段
+    const double dfStretchEnd = (output.eFormat == OF_COG)? 0.8 : 1.0;
+    const bool bClahe = (eAlg == SA_Clahe);
+    const int nStages = (pStats? 1 : 2) + (bClahe? 1 : 0);
+    const double dfStatsEnd = pStats? 0.0 : dfStretchEnd / nStages;
+    const double dfGridEnd = bClahe? dfStatsEnd + dfStretchEnd / nStages : dfStatsEnd;
+
+    // 第一遍：统计
+    BandStats stats[3];
+    CPLErr err = CE_None;
+    if(pStats != nullptr){
+        std::copy(pStats, pStats + 3, stats);
+    }
+    else {
+        ProgressStage stage(opts, 0.0, dfStatsEnd);
+        err = ComputeStreamStats(hSrc, iBands, 3, stage.Options(), stats);
+    }
+    if(err != CE_None){ return err; }
+    StretchTransform trs[3];
+    for(int c=0;c<3;++c){
+        trs[c] = BuildTransform(eAlg, stats[c]);
+    }
+    const StretchTransform* transforms[3] = {&trs[0], &trs[1], &trs[2]};
+
+    // CLAHE：按网格生成颜色表
+    ClaheGrid grids[3];
+    const ClaheGrid* pGrids[3] = {&grids[0], &grids[1], &grids[2]};
+    if(bClahe){
+        ProgressStage stage(opts, dfStatsEnd, dfGridEnd);
+        err = ComputeStreamClahe(hSrc, iBands, 3, stats, clahe, stage.Options(), grids);
+        if(err != CE_None){ return err; }
+    }
+
+    // 创建输出影像，COG先写出到临时文件
+    std::string osDst = pszDstFile;
+    if(output.eFormat == OF_COG){
+        osDst += ".tmp.tif";
+    }
+    GDALDatasetH hDst = CreateRGBGeoTIFF(hSrc, osDst.c_str(), output.bAlpha,
+                                         output.eFormat == OF_GTiff? output.creationOptions
+                                                                   : std::vector<std::string>());
+    if(hDst == nullptr){
+        return CE_Failure;
+    }
+
+    // 第二遍：拉伸并写出
+    {
+        ProgressStage stage(opts, dfGridEnd, dfStretchEnd);
+        err = bClahe? StreamClaheRGBA(hSrc, iBands, pGrids, hDst, stage.Options())
+                    : StreamStretchRGBA(hSrc, iBands, transforms, hDst, stage.Options());
+    }
+    if(output.eFormat == OF_GTiff){
+        GDALClose(hDst);
+        // 不保留未完成的输出文件
+        if(err != CE_None){
+            GDALDeleteDataset(GDALGetDriverByName("GTiff"), pszDstFile);
+        }
+        return err;
+    }
+
+    // 转换为COG，COG驱动会生成概览
+    if(err == CE_None){
+        char** papszOptions = CSLSetNameValue(nullptr, "BIGTIFF", "IF_SAFER");
+        papszOptions = MergeCreationOptions(papszOptions, output.creationOptions);
+        ProgressStage stage(opts, dfStretchEnd, 1.0);
+        TraceScope scope("cog_copy");
+        GDALDatasetH hCog = GDALCreateCopy(GDALGetDriverByName("COG"), pszDstFile, hDst, FALSE, papszOptions,
+                                           stage.Options().pfnProgress, stage.Options().pProgressData);
+        CSLDestroy(papszOptions);
+        if(hCog == nullptr){
+            // 失败或被中止时COG驱动可能已经写出了部分文件，不保留
+            VSIUnlink(pszDstFile);
+            err = CE_Failure;
+        }
+        else {
+            GDALClose(hCog);
+        }
+    }
+    GDALClose(hDst);
+    GDALDeleteDataset(GDALGetDriverByName("GTiff"), osDst.c_str());
+    return err;
+}
+
+}
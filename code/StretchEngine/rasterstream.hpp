@@ -0,0 +1,104 @@
+﻿#ifndef RASTERSTREAM_HPP
+#define RASTERSTREAM_HPP
+
+#include "stretchengine.hpp"
+#include "clahe.hpp"
+
+#include <string>
+#include <vector>
+
+// 分块流式处理大影像
+// 第一遍逐块累加统计信息和直方图，第二遍逐块拉伸并写出
+// 局部自适应拉伸(SA_Clahe)在两遍之间再按网格读取一遍，生成各网格的颜色表
+// 内存占用只与分块大小有关，与影像大小无关
+namespace rsisa
+{
+
+class ThreadPool;
+
+// 分块处理参数
+struct StreamOptions
+{
+    int    nWindowXSize = 0;    // 分块大小，为0时按第一个波段的自然块大小
+    int    nWindowYSize = 0;
+    double dfNoData = 0.0;      // 无效值，为NaN时表示没有无效值
+    bool   bUseBandNoData = false;  // 优先使用波段自身设置的无效值
+    bool   bUseStatsCache = true;   // 使用并更新磁盘上的统计信息缓存(见statscache.hpp)
+    ThreadPool* pPool = nullptr;    // 分块并行使用的线程池，为空时使用 ThreadPool::Global()
+    GDALProgressFunc pfnProgress = nullptr;     // GDAL进度回调，返回FALSE时中止处理(CPLE_UserInterrupt)
+    void*  pProgressData = nullptr;             // 可能在线程池的线程中调用，调用之间已加锁
+};
+
+// 输出格式
+enum OutputFormat
+{
+    OF_GTiff = 0,       // 分块存储的GeoTIFF
+    OF_COG              // Cloud Optimized GeoTIFF(需要GDAL 3.1以上的COG驱动)
+};
+
+// 输出参数
+struct OutputOptions
+{
+    OutputFormat eFormat = OF_GTiff;
+    bool bAlpha = true;                         // 输出RGBA，否则输出RGB
+    std::vector<std::string> creationOptions;   // 传给驱动的创建选项(NAME=VALUE)，覆盖默认选项
+};
+
+// 影像上的一个窗口
+struct RasterWindow
+{
+    int nXOff;
+    int nYOff;
+    int nXSize;
+    int nYSize;
+};
+
+// 计算分块窗口，按行优先顺序排列
+// 自然块是单行条带时，合并多行使每块约有1M像素
+std::vector<RasterWindow> ComputeWindows(GDALDatasetH hDset, int iBand, const StreamOptions& opts);
+
+// 波段使用的无效值
+double BandNoData(GDALRasterBandH hBand, const StreamOptions& opts);
+
+// 读取一个波段的窗口数据，按 BufferTypeFor 选定的类型存放到buffer中
+CPLErr ReadWindow(GDALRasterBandH hBand, const RasterWindow& win, double dfNoData,
+                  std::vector<uint8_t>& buffer, BandView& view);
+
+// 第一遍：分块统计指定的nBandCount个波段，结果写入pStats
+// 已有缓存的波段直接读取缓存，新统计的波段写入缓存
+// 每完成一块报告一次进度，被进度回调中止时返回CE_Failure
+CPLErr ComputeStreamStats(GDALDatasetH hDset, const int* iBands, int nBandCount,
+                          const StreamOptions& opts, BandStats* pStats);
+
+// 第二遍：分块拉伸三个波段，写出到hDst的前四个波段(RGBA，Byte类型)
+// hDst的大小必须与hSrc相同，只有三个波段时不写出透明通道
+// 每写出一块报告一次进度，被进度回调中止时返回CE_Failure
+CPLErr StreamStretchRGBA(GDALDatasetH hSrc, const int iBands[3],
+                         const StretchTransform* transforms[3],
+                         GDALDatasetH hDst, const StreamOptions& opts);
+
+// CLAHE：按网格行读取nBandCount个波段，生成各网格的颜色表，结果写入pGrids
+// pStats为这些波段整幅影像的统计信息(ComputeStreamStats的结果)
+// 每行网格的每个波段只读取一次(影像整宽、网格高的窗口，覆盖完整的分块)，再并行生成该行各网格的颜色表
+// 同时只需要一个波段一行网格的数据
+CPLErr ComputeStreamClahe(GDALDatasetH hDset, const int* iBands, int nBandCount, const BandStats* pStats,
+                          const ClaheOptions& clahe, const StreamOptions& opts, ClaheGrid* pGrids);
+
+// 与StreamStretchRGBA相同，按CLAHE颜色表网格拉伸
+CPLErr StreamClaheRGBA(GDALDatasetH hSrc, const int iBands[3], const ClaheGrid* grids[3],
+                       GDALDatasetH hDst, const StreamOptions& opts);
+
+// 完整流程：两遍分块处理，将拉伸结果写出为分块存储的RGB(A) GeoTIFF，保留地理参考
+// 输出COG时先分块写出临时GeoTIFF，再由COG驱动转换并生成概览，完成后删除临时文件
+// 进度按统计、(CLAHE网格、)拉伸写出(和COG转换)分段报告，中止时删除未完成的输出文件
+// clahe只在eAlg为SA_Clahe时使用
+// pStats不为空时为三个波段使用的统计信息(例如多景影像的镶嵌统计，见mosaic.hpp)，不再统计hSrc
+CPLErr StretchToGeoTIFF(GDALDatasetH hSrc, const char* pszDstFile, const int iBands[3],
+                        StretchAlgorithm eAlg, const StreamOptions& opts,
+                        const OutputOptions& output = OutputOptions(),
+                        const ClaheOptions& clahe = ClaheOptions(),
+                        const BandStats* pStats = nullptr);
+
+}
+
+#endif // RASTERSTREAM_HPP
@@ -0,0 +1,487 @@
+﻿#include "statscache.hpp"
+#include "trace.hpp"
+
+#include <cpl_conv.h>
+#include <cpl_multiproc.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rsisa
+{
+
+namespace
+{
+
+const char CACHE_MAGIC[8] = {'R','S','I','S','A','S','T','A'};
+const uint32_t CACHE_VERSION = 2;
+
+// 缓存的键
+struct CacheKey
+{
+    std::string osPath;         // 规范化的绝对路径
+    uint64_t nFileSize;
+    int64_t  nMTime;            // 修改时间(纳秒)
+    uint64_t nFilesHash;        // 数据集其它文件的路径、大小和修改时间的散列
+    int32_t  iBand;
+    double   dfNoData;
+};
+
+// 缓存文件头，之后依次为:
+// 影像路径(补齐到8字节)、HIST_BINS个double的直方图、nUsedCount个uint64_t的像素值分布桶计数
+struct CacheHeader
+{
+    char     szMagic[8];
+    uint32_t nVersion;
+    int32_t  iBand;
+    uint64_t nFileSize;
+    int64_t  nMTime;
+    uint64_t nFilesHash;
+    double   dfNoData;
+    uint32_t nPathLength;
+    int32_t  eType;
+    double   dfMin;
+    double   dfMax;
+    double   dfMean;
+    double   dfStddev;
+    uint64_t nValidCount;
+    uint32_t nHistBins;
+    int32_t  nDistExp;
+    int64_t  nDistOrigin;
+    int32_t  nDistBins;
+    uint32_t bDistInteger;
+    int32_t  nUsedOffset;       // 有计数的桶在窗口中的起始位置和个数
+    int32_t  nUsedCount;
+};
+
+static_assert(sizeof(CacheHeader) == 128, "CacheHeader must not contain padding");
+
+size_t PaddedPathLength(size_t nLength)
+{
+    return (nLength + 7) / 8 * 8;
+}
+
+// FNV-1a 64位散列
+uint64_t HashBytes(uint64_t nHash, const void* pData, size_t nSize)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(pData);
+    for(size_t i=0;i<nSize;++i){
+        nHash = (nHash ^ p[i]) * 1099511628211ULL;
+    }
+    return nHash;
+}
+
+// 数据集的所有文件都是本地普通文件时生成键
+// 主文件以外的文件(头文件、辅助文件、VRT的源文件等)计入nFilesHash，任一文件被修改时键随之改变
+bool MakeKey(GDALDatasetH hDset, int iBand, double dfNoData, CacheKey& key)
+{
+    if(!StatLocalFile(GDALGetDescription(hDset), key.osPath, key.nFileSize, key.nMTime)){
+        return false;
+    }
+    key.nFilesHash = 14695981039346656037ULL;
+    char** papszFiles = GDALGetFileList(hDset);
+    bool bOk = true;
+    for(int i=1;bOk && papszFiles != nullptr && papszFiles[i] != nullptr;++i){
+        std::string osPath;
+        uint64_t nSize = 0;
+        int64_t nMTime = 0;
+        bOk = StatLocalFile(papszFiles[i], osPath, nSize, nMTime);
+        key.nFilesHash = HashBytes(key.nFilesHash, osPath.c_str(), osPath.size() + 1);
+        key.nFilesHash = HashBytes(key.nFilesHash, &nSize, sizeof(nSize));
+        key.nFilesHash = HashBytes(key.nFilesHash, &nMTime, sizeof(nMTime));
+    }
+    CSLDestroy(papszFiles);
+    key.iBand = iBand;
+    key.dfNoData = dfNoData;
+    return bOk;
+}
+
+// 缓存文件名：前一段为路径、波段和无效值的散列，后一段为文件大小和修改时间的散列
+// 影像被修改后新缓存与旧缓存的前一段相同，保存新缓存时据此删除旧缓存
+std::string CacheFileName(const std::string& osDir, const CacheKey& key)
+{
+    uint64_t nPrefix = 14695981039346656037ULL;
+    nPrefix = HashBytes(nPrefix, key.osPath.data(), key.osPath.size());
+    nPrefix = HashBytes(nPrefix, &key.iBand, sizeof(key.iBand));
+    nPrefix = HashBytes(nPrefix, &key.dfNoData, sizeof(key.dfNoData));
+    uint64_t nHash = 14695981039346656037ULL;
+    nHash = HashBytes(nHash, &key.nFileSize, sizeof(key.nFileSize));
+    nHash = HashBytes(nHash, &key.nMTime, sizeof(key.nMTime));
+    nHash = HashBytes(nHash, &key.nFilesHash, sizeof(key.nFilesHash));
+    char szName[40];
+    snprintf(szName, sizeof(szName), "%016llx_%016llx", static_cast<unsigned long long>(nPrefix),
+             static_cast<unsigned long long>(nHash));
+    return CPLFormFilename(osDir.c_str(), szName, "stats");
+}
+
+// 缓存目录的大小上限(字节)，配置项RSISA_STATS_CACHE_MB，为0时不限制
+uint64_t CacheBudget()
+{
+    const int nBudgetMB = atoi(CPLGetConfigOption("RSISA_STATS_CACHE_MB", "1024"));
+    return static_cast<uint64_t>(std::max(0, nBudgetMB)) * 1024 * 1024;
+}
+
+// 保存osFile后整理缓存目录：
+// 删除同一影像同一波段的旧缓存(文件名前一段相同)，总大小超过上限时按修改时间从旧到新删除
+void TrimCache(const std::string& osDir, const std::string& osFile)
+{
+    TraceScope scope("stats_cache_trim");
+    const std::string osName = CPLGetFilename(osFile.c_str());
+    const std::string osPrefix = osName.substr(0, osName.find('_') + 1);
+    const uint64_t nBudget = CacheBudget();
+
+    struct Entry
+    {
+        std::string osPath;
+        uint64_t nSize;
+        int64_t nMTime;
+    };
+    std::vector<Entry> entries;
+    uint64_t nTotal = 0;
+    char** papszFiles = VSIReadDir(osDir.c_str());
+    for(int i=0;papszFiles != nullptr && papszFiles[i] != nullptr;++i){
+        const char* pszName = papszFiles[i];
+        if(!EQUAL(CPLGetExtension(pszName), "stats") || osName == pszName){
+            continue;
+        }
+        const std::string osPath = CPLFormFilename(osDir.c_str(), pszName, nullptr);
+        if(strncmp(pszName, osPrefix.c_str(), osPrefix.size()) == 0){
+            VSIUnlink(osPath.c_str());
+            TraceCount("stats_cache_evict");
+            continue;
+        }
+        VSIStatBufL sStat;
+        if(nBudget > 0 && VSIStatL(osPath.c_str(), &sStat) == 0){
+            Entry entry = {osPath, static_cast<uint64_t>(sStat.st_size), static_cast<int64_t>(sStat.st_mtime)};
+            entries.push_back(entry);
+            nTotal += entry.nSize;
+        }
+    }
+    CSLDestroy(papszFiles);
+
+    VSIStatBufL sStat;
+    if(nBudget == 0 || VSIStatL(osFile.c_str(), &sStat) != 0){
+        return;
+    }
+    nTotal += static_cast<uint64_t>(sStat.st_size);
+    if(nTotal <= nBudget){
+        return;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){ return a.nMTime < b.nMTime; });
+    for(size_t i=0;i<entries.size() && nTotal > nBudget;++i){
+        if(VSIUnlink(entries[i].osPath.c_str()) == 0){
+            nTotal -= entries[i].nSize;
+            TraceCount("stats_cache_evict");
+        }
+    }
+}
+
+// 只读内存映射一个文件
+class MappedFile
+{
+public:
+    MappedFile() : m_pData(nullptr), m_nSize(0) {}
+    ~MappedFile() { Close(); }
+
+    bool Open(const std::string& osPath);
+    void Close();
+
+    const uint8_t* Data() const { return static_cast<const uint8_t*>(m_pData); }
+    size_t Size() const { return m_nSize; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    void*  m_pData;
+    size_t m_nSize;
+};
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& osPath)
+{
+    wchar_t* pwszPath = CPLRecodeToWChar(osPath.c_str(), CPL_ENC_UTF8, CPL_ENC_UCS2);
+    HANDLE hFile = CreateFileW(pwszPath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    CPLFree(pwszPath);
+    if(hFile == INVALID_HANDLE_VALUE){
+        return false;
+    }
+    LARGE_INTEGER nSize;
+    HANDLE hMapping = nullptr;
+    if(GetFileSizeEx(hFile, &nSize) && nSize.QuadPart > 0){
+        hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    CloseHandle(hFile);
+    if(hMapping == nullptr){
+        return false;
+    }
+    m_pData = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if(m_pData == nullptr){
+        return false;
+    }
+    m_nSize = static_cast<size_t>(nSize.QuadPart);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(m_pData != nullptr){
+        UnmapViewOfFile(m_pData);
+    }
+    m_pData = nullptr;
+    m_nSize = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& osPath)
+{
+    int fd = open(osPath.c_str(), O_RDONLY);
+    if(fd < 0){
+        return false;
+    }
+    struct stat sStat;
+    if(fstat(fd, &sStat) != 0 || sStat.st_size <= 0){
+        close(fd);
+        return false;
+    }
+    void* pData = mmap(nullptr, static_cast<size_t>(sStat.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(pData == MAP_FAILED){
+        return false;
+    }
+    m_pData = pData;
+    m_nSize = static_cast<size_t>(sStat.st_size);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(m_pData != nullptr){
+        munmap(m_pData, m_nSize);
+    }
+    m_pData = nullptr;
+    m_nSize = 0;
+}
+
+#endif
+
+}
+
+bool StatLocalFile(const char* pszPath, std::string& osPath, uint64_t& nSize, int64_t& nMTime)
+{
+    if(pszPath == nullptr || pszPath[0] == '\0' || strncmp(pszPath, "/vsi", 4) == 0){
+        return false;
+    }
+#ifdef _WIN32
+    wchar_t* pwszPath = CPLRecodeToWChar(pszPath, CPL_ENC_UTF8, CPL_ENC_UCS2);
+    std::vector<wchar_t> full(GetFullPathNameW(pwszPath, 0, nullptr, nullptr) + 1);
+    const DWORD nLength = GetFullPathNameW(pwszPath, static_cast<DWORD>(full.size()), full.data(), nullptr);
+    CPLFree(pwszPath);
+    WIN32_FILE_ATTRIBUTE_DATA sData;
+    if(nLength == 0 || nLength >= full.size()
+            || !GetFileAttributesExW(full.data(), GetFileExInfoStandard, &sData)
+            || (sData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0){
+        return false;
+    }
+    char* pszFull = CPLRecodeFromWChar(full.data(), CPL_ENC_UCS2, CPL_ENC_UTF8);
+    osPath = pszFull;
+    CPLFree(pszFull);
+    nSize = (static_cast<uint64_t>(sData.nFileSizeHigh) << 32) | sData.nFileSizeLow;
+    // FILETIME以100纳秒为单位
+    const uint64_t nTime = (static_cast<uint64_t>(sData.ftLastWriteTime.dwHighDateTime) << 32)
+            | sData.ftLastWriteTime.dwLowDateTime;
+    nMTime = static_cast<int64_t>(nTime) * 100;
+#else
+    char* pszFull = realpath(pszPath, nullptr);
+    if(pszFull == nullptr){
+        return false;
+    }
+    osPath = pszFull;
+    free(pszFull);
+    struct stat sStat;
+    if(stat(osPath.c_str(), &sStat) != 0 || !S_ISREG(sStat.st_mode)){
+        return false;
+    }
+    nSize = static_cast<uint64_t>(sStat.st_size);
+#ifdef __APPLE__
+    nMTime = static_cast<int64_t>(sStat.st_mtimespec.tv_sec) * 1000000000 + sStat.st_mtimespec.tv_nsec;
+#else
+    nMTime = static_cast<int64_t>(sStat.st_mtim.tv_sec) * 1000000000 + sStat.st_mtim.tv_nsec;
+#endif
+#endif
+    return true;
+}
+
+std::string StatsCacheDirectory()
+{
+    if(!CPLTestBool(CPLGetConfigOption("RSISA_STATS_CACHE", "YES"))){
+        return std::string();
+    }
+    const char* pszDir = CPLGetConfigOption("RSISA_STATS_CACHE_DIR", nullptr);
+    if(pszDir != nullptr && pszDir[0] != '\0'){
+        return pszDir;
+    }
+#ifdef _WIN32
+    const char* pszHome = getenv("USERPROFILE");
+#else
+    const char* pszHome = getenv("HOME");
+#endif
+    if(pszHome == nullptr || pszHome[0] == '\0'){
+        return std::string();
+    }
+    return std::string(CPLFormFilename(pszHome, ".rsisa", nullptr)) + "/stats";
+}
+
+bool LoadCachedStats(GDALDatasetH hDset, int iBand, double dfNoData, BandStats& stats)
+{
+    TraceScope scope("stats_cache_load");
+    TraceCount("stats_cache_lookup");
+    const std::string osDir = StatsCacheDirectory();
+    CacheKey key;
+    if(osDir.empty() || !MakeKey(hDset, iBand, dfNoData, key)){
+        return false;
+    }
+    MappedFile file;
+    if(!file.Open(CacheFileName(osDir, key)) || file.Size() < sizeof(CacheHeader)){
+        return false;
+    }
+
+    // 检查文件头和键，散列值相同但键不同时也视为没有缓存
+    CacheHeader header;
+    memcpy(&header, file.Data(), sizeof(header));
+    if(memcmp(header.szMagic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+            || header.nVersion != CACHE_VERSION
+            || header.iBand != key.iBand
+            || header.nFileSize != key.nFileSize
+            || header.nMTime != key.nMTime
+            || header.nFilesHash != key.nFilesHash
+            || memcmp(&header.dfNoData, &key.dfNoData, sizeof(double)) != 0
+            || header.nPathLength != key.osPath.size()
+            || header.nHistBins != static_cast<uint32_t>(HIST_BINS)
+            || header.nDistBins < 2 || header.nDistBins % 2 != 0
+            || header.nUsedOffset < 0 || header.nUsedCount < 0
+            || header.nUsedCount > header.nDistBins - header.nUsedOffset){
+        return false;
+    }
+    const size_t nPathBytes = PaddedPathLength(header.nPathLength);
+    const size_t nHistOffset = sizeof(CacheHeader) + nPathBytes;
+    const size_t nCountsOffset = nHistOffset + sizeof(double) * HIST_BINS;
+    if(file.Size() != nCountsOffset + sizeof(uint64_t) * static_cast<size_t>(header.nUsedCount)
+            || memcmp(file.Data() + sizeof(CacheHeader), key.osPath.data(), key.osPath.size()) != 0){
+        return false;
+    }
+
+    // 映射的地址按页对齐，各部分的偏移都是8的倍数，可以直接按数组访问
+    const double* pHist = reinterpret_cast<const double*>(file.Data() + nHistOffset);
+    const uint64_t* pCounts = reinterpret_cast<const uint64_t*>(file.Data() + nCountsOffset);
+    stats.dfMin = header.dfMin;
+    stats.dfMax = header.dfMax;
+    stats.dfMean = header.dfMean;
+    stats.dfStddev = header.dfStddev;
+    stats.nValidCount = header.nValidCount;
+    stats.eType = static_cast<GDALDataType>(header.eType);
+    stats.histogram.assign(pHist, pHist + HIST_BINS);
+    stats.distribution = StreamHistogram::FromCounts(header.nDistBins, header.nDistExp, header.nDistOrigin,
+                                                     header.bDistInteger != 0, header.nUsedOffset,
+                                                     pCounts, header.nUsedCount);
+    TraceCount("stats_cache_hit");
+    return true;
+}
+
+bool SaveCachedStats(GDALDatasetH hDset, int iBand, double dfNoData, const BandStats& stats)
+{
+    const std::string osDir = StatsCacheDirectory();
+    CacheKey key;
+    if(osDir.empty() || !MakeKey(hDset, iBand, dfNoData, key)
+            || stats.histogram.size() != static_cast<size_t>(HIST_BINS)){
+        return false;
+    }
+    VSIStatBufL sStat;
+    if(VSIStatL(osDir.c_str(), &sStat) != 0 && VSIMkdirRecursive(osDir.c_str(), 0755) != 0){
+        CPLDebug("RSISA", "Cannot create stats cache directory %s", osDir.c_str());
+        return false;
+    }
+
+    const StreamHistogram& dist = stats.distribution;
+    int nFirst = 0, nLast = -1;
+    dist.UsedBins(nFirst, nLast);
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.szMagic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.nVersion = CACHE_VERSION;
+    header.iBand = key.iBand;
+    header.nFileSize = key.nFileSize;
+    header.nMTime = key.nMTime;
+    header.nFilesHash = key.nFilesHash;
+    header.dfNoData = key.dfNoData;
+    header.nPathLength = static_cast<uint32_t>(key.osPath.size());
+    header.eType = static_cast<int32_t>(stats.eType);
+    header.dfMin = stats.dfMin;
+    header.dfMax = stats.dfMax;
+    header.dfMean = stats.dfMean;
+    header.dfStddev = stats.dfStddev;
+    header.nValidCount = stats.nValidCount;
+    header.nHistBins = static_cast<uint32_t>(HIST_BINS);
+    header.nDistExp = dist.Exp();
+    header.nDistOrigin = dist.Origin();
+    header.nDistBins = dist.Bins();
+    header.bDistInteger = dist.IsInteger()? 1 : 0;
+    header.nUsedOffset = (nLast >= nFirst)? nFirst : 0;
+    header.nUsedCount = nLast - nFirst + 1;
+
+    std::vector<char> path(PaddedPathLength(key.osPath.size()), 0);
+    memcpy(path.data(), key.osPath.data(), key.osPath.size());
+
+    // 先写入临时文件再改名，读取时不会看到写了一半的文件
+    // 临时文件名区分进程和线程，同时保存同一波段时互不影响
+    const std::string osFile = CacheFileName(osDir, key);
+    const std::string osTemp = osFile + CPLSPrintf(".%d_%llx.tmp", CPLGetPID(),
+        static_cast<unsigned long long>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+    VSILFILE* fp = VSIFOpenL(osTemp.c_str(), "wb");
+    if(fp == nullptr){
+        CPLDebug("RSISA", "Cannot write stats cache file %s", osTemp.c_str());
+        return false;
+    }
+    bool bOk = VSIFWriteL(&header, sizeof(header), 1, fp) == 1
+            && (path.empty() || VSIFWriteL(path.data(), path.size(), 1, fp) == 1)
+            && VSIFWriteL(stats.histogram.data(), sizeof(double), HIST_BINS, fp) == static_cast<size_t>(HIST_BINS);
+    if(bOk && header.nUsedCount > 0){
+        const uint64_t* pCounts = dist.Counts().data() + header.nUsedOffset;
+        bOk = VSIFWriteL(pCounts, sizeof(uint64_t), header.nUsedCount, fp) == static_cast<size_t>(header.nUsedCount);
+    }
+    bOk = (VSIFCloseL(fp) == 0) && bOk;
+    if(bOk && VSIRename(osTemp.c_str(), osFile.c_str()) != 0){
+        // Windows上目标文件已存在时不能改名，删除失效的旧文件后重试
+        VSIUnlink(osFile.c_str());
+        bOk = VSIRename(osTemp.c_str(), osFile.c_str()) == 0;
+    }
+    if(!bOk){
+        VSIUnlink(osTemp.c_str());
+        return false;
+    }
+    TrimCache(osDir, osFile);
+    return true;
+}
+
+}
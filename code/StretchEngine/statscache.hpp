@@ -0,0 +1,35 @@
+﻿#ifndef STATSCACHE_HPP
+#define STATSCACHE_HPP
+
+#include "stretchengine.hpp"
+
+#include <string>
+
+// 波段统计信息的磁盘缓存
+// 每个波段的统计信息保存为缓存目录下的一个文件，以影像的规范化路径、文件大小、修改时间(纳秒)、波段序号和无效值为键
+// 数据集的其它文件(头文件、VRT的源文件等)的路径、大小和修改时间也计入键，任一文件被修改后键随之改变，旧的缓存不再使用
+// 只缓存所有文件都是本地普通文件的数据集
+// 保存时删除同一影像同一波段的旧缓存；缓存目录超过配置项RSISA_STATS_CACHE_MB(默认1024，为0时不限制)时，
+// 按修改时间从最早的缓存开始删除
+// 缓存目录为配置项RSISA_STATS_CACHE_DIR，默认为用户目录下的 .rsisa/stats
+// 配置项RSISA_STATS_CACHE=NO时不使用缓存
+namespace rsisa
+{
+
+// 本地普通文件的规范化绝对路径、大小和修改时间(纳秒)
+// 同一文件用相对路径、符号链接等不同方式打开时得到相同的路径
+// 不是本地普通文件(包括/vsi虚拟文件)时返回false
+bool StatLocalFile(const char* pszPath, std::string& osPath, uint64_t& nSize, int64_t& nMTime);
+
+// 缓存目录，不使用缓存时返回空字符串
+std::string StatsCacheDirectory();
+
+// 读取缓存的统计信息(内存映射缓存文件)，没有缓存或缓存与影像不一致时返回false
+bool LoadCachedStats(GDALDatasetH hDset, int iBand, double dfNoData, BandStats& stats);
+
+// 保存统计信息到缓存并整理缓存目录，数据集的文件不都是本地普通文件或无法写入缓存目录时返回false
+bool SaveCachedStats(GDALDatasetH hDset, int iBand, double dfNoData, const BandStats& stats);
+
+}
+
+#endif // STATSCACHE_HPP
@@ -0,0 +1,238 @@
+﻿#include "streamhistogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rsisa
+{
+
+namespace
+{
+
+// floor(k / 2^nShift)
+int64_t ShiftDown(int64_t k, int nShift)
+{
+    if(nShift <= 0){ return k; }
+    if(nShift > 62){ return (k < 0)? -1 : 0; }
+    return (k >= 0)? (k >> nShift) : -((-(k + 1)) >> nShift) - 1;
+}
+
+// 桶序号超过该值时认为溢出，需要加大桶宽度
+const double MAX_BIN_INDEX = 4611686018427387904.0;    // 2^62
+
+}
+
+StreamHistogram::StreamHistogram(int nBins, int nExp, bool bInteger)
+    : m_counts(static_cast<size_t>(std::max(2, nBins + (nBins & 1))), 0),
+      m_nExp(nExp),
+      m_nOrigin(-static_cast<int64_t>(m_counts.size() / 2)),
+      m_bInteger(bInteger),
+      m_nTotal(0)
+{
+    m_dfInvWidth = std::ldexp(1.0, -m_nExp);
+    m_dfOrigin = static_cast<double>(m_nOrigin);
+    m_dfBins = static_cast<double>(m_counts.size());
+}
+
+StreamHistogram StreamHistogram::ForIntegerRange(int64_t nMinValue, int64_t nMaxValue)
+{
+    StreamHistogram hist(static_cast<int>(nMaxValue - nMinValue + 1), 0, true);
+    hist.m_nOrigin = nMinValue;
+    hist.m_dfOrigin = static_cast<double>(nMinValue);
+    return hist;
+}
+
+StreamHistogram StreamHistogram::FromCounts(int nBins, int nExp, int64_t nOrigin, bool bInteger,
+                                            int nOffset, const uint64_t* pCounts, int nCount)
+{
+    StreamHistogram hist(nBins, nExp, bInteger);
+    hist.m_nOrigin = nOrigin;
+    hist.m_dfOrigin = static_cast<double>(nOrigin);
+    for(int i=0;i<nCount;++i){
+        hist.m_counts[static_cast<size_t>(nOffset + i)] = pCounts[i];
+        hist.m_nTotal += pCounts[i];
+    }
+    return hist;
+}
+
+bool StreamHistogram::UsedBins(int& nFirst, int& nLast) const
+{
+    int64_t nLo = 0, nHi = 0;
+    if(!UsedRange(nLo, nHi)){ return false; }
+    nFirst = static_cast<int>(nLo - m_nOrigin);
+    nLast = static_cast<int>(nHi - m_nOrigin);
+    return true;
+}
+
+double StreamHistogram::BinValue(int64_t k) const
+{
+    const double w = BinWidth();
+    if(m_bInteger && w >= 1.0){
+        // 桶内为 k*w ... k*w+w-1 这些整数
+        return k * w + (w - 1.0) * 0.5;
+    }
+    return (k + 0.5) * w;
+}
+
+bool StreamHistogram::UsedRange(int64_t& nLo, int64_t& nHi) const
+{
+    if(m_nTotal == 0){ return false; }
+    size_t i = 0, j = m_counts.size() - 1;
+    while(m_counts[i] == 0){ ++i; }
+    while(m_counts[j] == 0){ --j; }
+    nLo = m_nOrigin + static_cast<int64_t>(i);
+    nHi = m_nOrigin + static_cast<int64_t>(j);
+    return true;
+}
+
+void StreamHistogram::Rebase(int nExp, int64_t nOrigin)
+{
+    if(nExp == m_nExp && nOrigin == m_nOrigin){ return; }
+    std::vector<uint64_t> counts(m_counts.size(), 0);
+    const int nShift = nExp - m_nExp;
+    for(size_t i=0;i<m_counts.size();++i){
+        if(m_counts[i] == 0){ continue; }
+        int64_t k = ShiftDown(m_nOrigin + static_cast<int64_t>(i), nShift) - nOrigin;
+        counts[static_cast<size_t>(k)] += m_counts[i];
+    }
+    m_counts.swap(counts);
+    m_nExp = nExp;
+    m_nOrigin = nOrigin;
+    m_dfInvWidth = std::ldexp(1.0, -m_nExp);
+    m_dfOrigin = static_cast<double>(m_nOrigin);
+}
+
+void StreamHistogram::AddSlow(double value)
+{
+    const int64_t nBins = static_cast<int64_t>(m_counts.size());
+    int64_t nLo = 0, nHi = 0;
+    const bool bUsed = UsedRange(nLo, nHi);
+
+    // 找到能同时容纳已有数据和新值的最小桶宽度
+    int nExp = m_nExp;
+    int64_t k = 0;
+    for(;;){
+        double f = std::floor(std::ldexp(value, -nExp));
+        if(std::fabs(f) >= MAX_BIN_INDEX){
+            nExp += 1; continue;
+        }
+        k = static_cast<int64_t>(f);
+        int64_t nUsedLo = bUsed? ShiftDown(nLo, nExp - m_nExp) : k;
+        int64_t nUsedHi = bUsed? ShiftDown(nHi, nExp - m_nExp) : k;
+        nUsedLo = std::min(nUsedLo, k); nUsedHi = std::max(nUsedHi, k);
+        if(nUsedHi - nUsedLo + 1 > nBins){
+            nExp += 1; continue;
+        }
+        // 窗口居中放置，两侧留出相同的余量
+        Rebase(nExp, nUsedLo - (nBins - (nUsedHi - nUsedLo + 1)) / 2);
+        break;
+    }
+    m_counts[static_cast<size_t>(k - m_nOrigin)] += 1;
+    m_nTotal += 1;
+}
+
+void StreamHistogram::Merge(const StreamHistogram& other)
+{
+    if(other.m_nTotal == 0){ return; }
+    if(other.m_nExp == m_nExp && other.m_nOrigin == m_nOrigin
+            && other.m_counts.size() == m_counts.size()){
+        // 窗口相同时直接累加，不移动窗口
+        for(size_t i=0;i<m_counts.size();++i){
+            m_counts[i] += other.m_counts[i];
+        }
+        m_nTotal += other.m_nTotal;
+        return;
+    }
+    const int64_t nBins = static_cast<int64_t>(m_counts.size());
+    int64_t nLoA = 0, nHiA = 0, nLoB = 0, nHiB = 0;
+    const bool bUsedA = UsedRange(nLoA, nHiA);
+    other.UsedRange(nLoB, nHiB);
+
+    int nExp = std::max(m_nExp, other.m_nExp);
+    int64_t nLo = 0, nHi = 0;
+    for(;;){
+        nLo = ShiftDown(nLoB, nExp - other.m_nExp);
+        nHi = ShiftDown(nHiB, nExp - other.m_nExp);
+        if(bUsedA){
+            nLo = std::min(nLo, ShiftDown(nLoA, nExp - m_nExp));
+            nHi = std::max(nHi, ShiftDown(nHiA, nExp - m_nExp));
+        }
+        if(nHi - nLo + 1 > nBins){
+            nExp += 1; continue;
+        }
+        break;
+    }
+    Rebase(nExp, nLo - (nBins - (nHi - nLo + 1)) / 2);
+
+    const int nShift = nExp - other.m_nExp;
+    for(size_t i=0;i<other.m_counts.size();++i){
+        if(other.m_counts[i] == 0){ continue; }
+        int64_t k = ShiftDown(other.m_nOrigin + static_cast<int64_t>(i), nShift) - m_nOrigin;
+        m_counts[static_cast<size_t>(k)] += other.m_counts[i];
+    }
+    m_nTotal += other.m_nTotal;
+}
+
+std::vector<double> StreamHistogram::Resample(double dfMin, double dfMax, int nBins) const
+{
+    std::vector<double> histogram(static_cast<size_t>(nBins), 0.0);
+    const double dfScale = (dfMax > dfMin)? nBins / (dfMax - dfMin) : 0.0;
+    const double w = BinWidth();
+    // 宽度为1的整数桶只有一个值，整个桶归入该值所在的灰度级
+    const bool bPoint = (m_bInteger && w <= 1.0) || dfScale == 0.0;
+    for(size_t i=0;i<m_counts.size();++i){
+        if(m_counts[i] == 0){ continue; }
+        const int64_t k = m_nOrigin + static_cast<int64_t>(i);
+        const double dfCount = static_cast<double>(m_counts[i]);
+        // 其它桶覆盖[k*w,(k+1)*w)，限制在[dfMin,dfMax]内后按与各灰度级重叠的长度分配
+        // 桶比灰度级宽时不会只落在间隔的灰度级上，直方图不会出现梳状的空缺
+        const double a = std::max(k * w, dfMin);
+        const double b = std::min((k + 1) * w, dfMax);
+        if(bPoint || b <= a){
+            double v = std::min(std::max(BinValue(k), dfMin), dfMax);
+            double idx = std::min(std::max((v - dfMin) * dfScale, 0.0), nBins - 1.0);
+            histogram[static_cast<size_t>(idx)] += dfCount;
+            continue;
+        }
+        const double x0 = (a - dfMin) * dfScale;
+        const double x1 = (b - dfMin) * dfScale;
+        const double dfDensity = dfCount / (x1 - x0);
+        const int j0 = std::min(static_cast<int>(x0), nBins - 1);
+        const int j1 = std::max(j0, std::min(static_cast<int>(std::ceil(x1)) - 1, nBins - 1));
+        for(int j=j0;j<=j1;++j){
+            const double dfLo = std::max(x0, static_cast<double>(j));
+            const double dfHi = (j == j1)? x1 : std::min(x1, j + 1.0);
+            histogram[static_cast<size_t>(j)] += (dfHi - dfLo) * dfDensity;
+        }
+    }
+    return histogram;
+}
+
+double StreamHistogram::Quantile(double dfFraction) const
+{
+    if(m_nTotal == 0){
+        return 0.0;
+    }
+    dfFraction = std::min(std::max(dfFraction, 0.0), 1.0);
+    const double dfTarget = dfFraction * static_cast<double>(m_nTotal);
+    const double w = BinWidth();
+    double dfCum = 0.0;
+    int64_t k = m_nOrigin;
+    for(size_t i=0;i<m_counts.size();++i){
+        if(m_counts[i] == 0){ continue; }
+        k = m_nOrigin + static_cast<int64_t>(i);
+        const double dfNext = dfCum + static_cast<double>(m_counts[i]);
+        if(dfNext >= dfTarget){
+            // 在桶内按均匀分布插值
+            const double dfFrac = (dfTarget - dfCum) / static_cast<double>(m_counts[i]);
+            if(m_bInteger && w >= 1.0){
+                return k * w + std::floor(dfFrac * (w - 1.0) + 0.5);
+            }
+            return (k + dfFrac) * w;
+        }
+        dfCum = dfNext;
+    }
+    return (k + 1) * w;
+}
+
+}
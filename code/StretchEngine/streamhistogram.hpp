@@ -0,0 +1,87 @@
+﻿#ifndef STREAMHISTOGRAM_HPP
+#define STREAMHISTOGRAM_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace rsisa
+{
+
+// 可以逐个像素累加、可以相互合并的直方图
+// 桶宽度为2^nExp，全局第k个桶覆盖[k*2^nExp, (k+1)*2^nExp)
+// 只保存从nOrigin开始的nBins个桶，数据范围超出时平移窗口或将相邻两个桶合并(宽度加倍)
+// 桶的边界始终对齐到桶宽度的整数倍，因此任意两个直方图都可以无损地合并，结果与累加和合并的顺序无关
+class StreamHistogram
+{
+public:
+    // nBins     桶的个数(偶数)
+    // nExp      初始桶宽度的指数
+    // bInteger  数据是否全部为整数(决定桶的代表值)
+    explicit StreamHistogram(int nBins = 4096, int nExp = 0, bool bInteger = false);
+
+    // 覆盖整数范围[nMinValue,nMaxValue]的精确直方图，每个整数一个桶
+    // 数据都在该范围内时窗口不会移动，桶宽度始终为1
+    static StreamHistogram ForIntegerRange(int64_t nMinValue, int64_t nMaxValue);
+
+    // 从保存的桶计数恢复直方图
+    // 窗口为从nOrigin开始的nBins个桶，pCounts为其中从第nOffset个桶开始的nCount个桶的计数
+    static StreamHistogram FromCounts(int nBins, int nExp, int64_t nOrigin, bool bInteger,
+                                      int nOffset, const uint64_t* pCounts, int nCount);
+
+    // 有计数的桶在窗口中的范围[nFirst,nLast]，返回false表示为空
+    bool UsedBins(int& nFirst, int& nLast) const;
+
+    // 累加一个有效值(不能是NaN或无穷大)
+    inline void Add(double value)
+    {
+        double idx = std::floor(value * m_dfInvWidth) - m_dfOrigin;
+        if(idx >= 0.0 && idx < m_dfBins){
+            m_counts[static_cast<size_t>(idx)] += 1;
+            m_nTotal += 1;
+            return;
+        }
+        AddSlow(value);
+    }
+
+    // 合并另一个直方图
+    void Merge(const StreamHistogram& other);
+
+    // 分位数：累计比例达到dfFraction的值，桶内按均匀分布插值
+    double Quantile(double dfFraction) const;
+
+    // 重新统计为[dfMin,dfMax]之间nBins个灰度级的直方图(桶按与各灰度级重叠的范围按比例分配，宽度为1的整数桶整体归入其值所在的灰度级)
+    std::vector<double> Resample(double dfMin, double dfMax, int nBins) const;
+
+    int Bins() const { return static_cast<int>(m_counts.size()); }
+    int Exp() const { return m_nExp; }
+    int64_t Origin() const { return m_nOrigin; }
+    bool IsInteger() const { return m_bInteger; }
+    uint64_t Total() const { return m_nTotal; }
+    const std::vector<uint64_t>& Counts() const { return m_counts; }
+
+    // 桶的宽度和全局第k个桶的代表值
+    double BinWidth() const { return std::ldexp(1.0, m_nExp); }
+    double BinValue(int64_t k) const;
+
+private:
+    void AddSlow(double value);
+    // 已使用的全局桶序号范围，返回false表示为空
+    bool UsedRange(int64_t& nLo, int64_t& nHi) const;
+    // 将桶宽度改为2^nExp(不能比当前小)，窗口起点改为nOrigin
+    void Rebase(int nExp, int64_t nOrigin);
+
+    std::vector<uint64_t> m_counts;
+    int      m_nExp;
+    int64_t  m_nOrigin;
+    bool     m_bInteger;
+    uint64_t m_nTotal;
+    // 快速累加使用的缓存值
+    double   m_dfInvWidth;
+    double   m_dfOrigin;
+    double   m_dfBins;
+};
+
+}
+
+#endif // STREAMHISTOGRAM_HPP
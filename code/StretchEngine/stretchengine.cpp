@@ -0,0 +1,326 @@
+﻿#include "stretchengine.hpp"
+#include "bandstats.hpp"
+#include "stretchkernel.hpp"
+#include "stretchsimd.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#ifndef PI
+#define PI 3.141592653589793
+#endif
+
+namespace rsisa
+{
+
+namespace
+{
+
+// 正态分布概率密度函数
+// mu    数学期望(平均值)
+// sigma 标准差
+double normpdf(double x, double mu, double sigma)
+{
+    return( (1.0 /(sigma *  sqrt(2.0 * PI))) * exp( -1 * (x-mu)*(x-mu)/(2*sigma*sigma)));
+}
+
+// 线性拉伸：[dfMin,dfMax]线性映射到0-255
+StretchTransform LinearTransform(double dfMin, double dfMax)
+{
+    StretchTransform tr;
+    tr.dfMin = dfMin;
+    tr.dfScale = (dfMax > dfMin)? 255.0 / (dfMax - dfMin) : 0.0;
+    return tr;
+}
+
+// 按拉伸变换计算一个像素值的输出，与MapBandT的计算相同
+uint8_t TransformValue(const StretchTransform& tr, double v)
+{
+    const double dfUpper = tr.lut.empty()? 255.0 : static_cast<double>(tr.lut.size() - 1);
+    const int idx = static_cast<int>(kernel::ClampIndex((v - tr.dfMin) * tr.dfScale, dfUpper));
+    return tr.lut.empty()? static_cast<uint8_t>(idx) : tr.lut[static_cast<size_t>(idx)];
+}
+
+// 生成8位和16位整数数据的直接映射表
+// 直方图均衡化在精确直方图上按每个像素值的累计概率计算，不再先归并为HIST_BINS个灰度级
+// 其它算法逐个像素值计算拉伸变换的结果
+void BuildValueLut(StretchAlgorithm eAlg, const BandStats& stats, StretchTransform& tr)
+{
+    int32_t nMinValue = 0, nValueCount = 0;
+    if(!IntegerValueRange(stats.eType, nMinValue, nValueCount)){
+        return;
+    }
+    tr.eValueType = stats.eType;
+    tr.nValueOrigin = nMinValue;
+    tr.valueLut.assign(static_cast<size_t>(nValueCount), 0);
+
+    const StreamHistogram& hist = stats.distribution;
+    if((eAlg == SA_Equalize || eAlg == SA_Clahe) && stats.nValidCount > 0 && hist.Exp() == 0){
+        const double factor = 1.0 / stats.nValidCount;
+        const std::vector<uint64_t>& counts = hist.Counts();
+        double cdf = 0.0;
+        for(int32_t i=0;i<nValueCount;++i){
+            const int64_t k = nMinValue + i - hist.Origin();
+            if(k >= 0 && k < static_cast<int64_t>(counts.size())){
+                cdf += static_cast<double>(counts[static_cast<size_t>(k)]) * factor;
+            }
+            tr.valueLut[i] = static_cast<uint8_t>(kernel::ClampIndex(cdf*255, 255.0));
+        }
+        return;
+    }
+    for(int32_t i=0;i<nValueCount;++i){
+        tr.valueLut[i] = TransformValue(tr, nMinValue + i);
+    }
+}
+
+// 直接映射表拉伸一个波段
+typedef void (*GatherBandFn)(const void* pData, size_t nCount, const uint8_t* pValueLut,
+                             int32_t nValueOrigin, int32_t nNoData, uint8_t* pOut, uint8_t* pValid);
+
+template<typename T>
+void GatherBand(const void* pData, size_t nCount, const uint8_t* pValueLut,
+                int32_t nValueOrigin, int32_t nNoData, uint8_t* pOut, uint8_t* pValid)
+{
+    kernel::GatherBandT(static_cast<const T*>(pData), nCount, pValueLut, nValueOrigin,
+                        nNoData, pOut, pValid);
+}
+
+GatherBandFn GatherBandFor(GDALDataType eType)
+{
+    switch(eType){
+    case GDT_Byte:   return GatherBand<uint8_t>;
+    case GDT_UInt16: return GatherBand<uint16_t>;
+    case GDT_Int16:  return GatherBand<int16_t>;
+    default:         return nullptr;
+    }
+}
+
+}
+
+bool IntegerValueRange(GDALDataType eType, int32_t& nMinValue, int32_t& nValueCount)
+{
+    switch(eType){
+    case GDT_Byte:   nMinValue = 0;      nValueCount = 256;   return true;
+    case GDT_UInt16: nMinValue = 0;      nValueCount = 65536; return true;
+    case GDT_Int16:  nMinValue = -32768; nValueCount = 65536; return true;
+    default:
+        return false;
+    }
+}
+
+bool IsSupportedType(GDALDataType eType)
+{
+    switch(eType){
+    case GDT_Byte: case GDT_UInt16: case GDT_Int16:
+    case GDT_UInt32: case GDT_Float32: case GDT_Float64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+GDALDataType BufferTypeFor(GDALDataType eType)
+{
+    return IsSupportedType(eType)? eType : GDT_Float64;
+}
+
+BandStats ComputeBandStats(const BandView& band, ThreadPool* pPool)
+{
+    TraceScope scope("stats");
+    TraceCount("stats_pixels", static_cast<int64_t>(band.nCount));
+    // 每个任务统计一段像素，最大最小值和矩按任务顺序合并
+    // 像素值分布每个线程一个，跨任务累加，最后合并
+    const size_t TASK_PIXELS = 1 << 18;
+    const size_t nTypeBytes = static_cast<size_t>(GDALGetDataTypeSizeBytes(band.eType));
+    BandAccumulator total(band.eType);
+    HistogramPool hists(band.eType);
+    ParallelReduce(pPool? *pPool : ThreadPool::Global(), (band.nCount + TASK_PIXELS - 1) / TASK_PIXELS,
+                   BandAccumulator::WithoutHistogram(band.eType),
+        [&](size_t iTask, BandAccumulator& acc){
+            BandView part = band;
+            part.pData = static_cast<const uint8_t*>(band.pData) + iTask * TASK_PIXELS * nTypeBytes;
+            part.nCount = std::min(TASK_PIXELS, band.nCount - iTask * TASK_PIXELS);
+            StreamHistogram* pHist = hists.Acquire();
+            acc.Add(part, *pHist);
+            hists.Release(pHist);
+        },
+        [&](const BandAccumulator& acc){
+            total.Merge(acc);
+        });
+    hists.MergeInto(total.histogram);
+    return total.Finalize();
+}
+
+BandStats MergeBandStats(const BandStats* pStats, size_t nCount)
+{
+    TraceScope scope("stats_merge");
+    GDALDataType eType = GDT_Unknown;
+    for(size_t i=0;i<nCount;++i){
+        if(pStats[i].eType == GDT_Unknown){ continue; }
+        eType = (eType == GDT_Unknown)? pStats[i].eType : GDALDataTypeUnion(eType, pStats[i].eType);
+    }
+    BandAccumulator total(eType);
+    for(size_t i=0;i<nCount;++i){
+        total.Merge(pStats[i]);
+    }
+    return total.Finalize();
+}
+
+double Percentile(const BandStats& stats, double dfFraction)
+{
+    if(stats.nValidCount == 0){
+        return 0.0;
+    }
+    return std::min(std::max(stats.distribution.Quantile(dfFraction), stats.dfMin), stats.dfMax);
+}
+
+namespace
+{
+
+// 按数据范围生成拉伸变换(适用于所有数据类型)
+StretchTransform BuildRangeTransform(StretchAlgorithm eAlg, const BandStats& stats)
+{
+    double dfMin = stats.dfMin, dfMax = stats.dfMax;
+
+    if(eAlg == SA_None) {
+        return StretchTransform();
+    }
+    else if(eAlg == SA_Linear) {
+        // 0-255线性映射到[最小值,最大值]。
+        return LinearTransform(dfMin, dfMax);
+    }
+    else if(eAlg == SA_PercentClip) {
+        // 0-255线性映射到[2%分位数,98%分位数]，两端各2%的像素截断
+        return LinearTransform(Percentile(stats, 0.02), Percentile(stats, 0.98));
+    }
+    else if(eAlg == SA_Equalize || eAlg == SA_Clahe) {
+        StretchTransform tr;
+        tr.dfMin = dfMin;
+        tr.dfScale = (dfMax > dfMin)? HIST_BINS / (dfMax - dfMin) : 0.0;
+        tr.lut.assign(HIST_BINS, 0);
+        if(stats.nValidCount == 0 || stats.histogram.size() != HIST_BINS){
+            return tr;
+        }
+        // 计算颜色表(计算1024个灰度级别，按出现概率映射的0-255的值)
+        // 颜色值重新映射后再计算直方图，应该每个像素值出现的概率是相同的
+        kernel::EqualizeLut(stats.histogram.data(), static_cast<double>(stats.nValidCount), tr.lut.data());
+        return tr;
+    }
+    else if(eAlg == SA_GaussSpec) {
+        // 直方图规定化即以一个给定的直方图来替代原图的直方图
+        // 这里直接用正态分布概率密度曲线（高斯曲线）来替代
+        const double dfMean = stats.dfMean, dfStddev = stats.dfStddev;
+        if(!(dfStddev > 0.0)){
+            return LinearTransform(dfMin, dfMax);
+        }
+        // 将最大最小值限制在均值左右各2.5倍标准差的范围内
+        dfMin = dfMean - dfStddev*2.5; dfMax = dfMean + dfStddev*2.5;
+        const double dfSpace = (dfMax - dfMin) / (HIST_BINS - 1);
+
+        // 根据平均值和标准差生成直方图(概率值)
+        std::vector<double> histogram(HIST_BINS, 0.0);
+        for(size_t i=0;i<HIST_BINS;++i){
+            histogram[i] = normpdf(dfMin + i*dfSpace, dfMean, dfStddev);
+        }
+        // 计算颜色表，需要计算归化概率累计值到[0,255]区间的 比率系数=255/概率值总和
+        const double sumHist = std::accumulate(histogram.begin(), histogram.end(), 0.0);
+        StretchTransform tr;
+        tr.dfMin = dfMin;
+        tr.dfScale = 1.0 / dfSpace;
+        tr.lut.assign(HIST_BINS, 0);
+        double cdf = 0.0;
+        for(size_t i=0;i<HIST_BINS;++i){
+            cdf += histogram[i];
+            tr.lut[i] = static_cast<uint8_t>(kernel::ClampIndex(cdf*255/sumHist, 255.0));
+        }
+        return tr;
+    }
+    return StretchTransform();
+}
+
+}
+
+StretchTransform BuildTransform(StretchAlgorithm eAlg, const BandStats& stats)
+{
+    TraceScope scope("build_lut");
+    StretchTransform tr = BuildRangeTransform(eAlg, stats);
+    if(eAlg != SA_None){
+        BuildValueLut(eAlg, stats, tr);
+    }
+    return tr;
+}
+
+void ApplyStretchRGBA(const BandView bands[3], const StretchTransform* transforms[3],
+                      uint8_t* pRGBA, ThreadPool* pPool)
+{
+    TraceScope scope("apply");
+    TraceCount("apply_pixels", static_cast<int64_t>(bands[0].nCount));
+    const simd::KernelTable& kernels = simd::ActiveKernels();
+
+    // 颜色表扩展为32位，便于向量化查表
+    std::vector<int32_t> luts[3];
+    simd::MapParams params[3];
+    simd::MapBandFn mapBand[3];
+    GatherBandFn gatherBand[3];
+    int32_t nNoData[3];
+    for(int c=0;c<3;++c){
+        const StretchTransform& tr = *transforms[c];
+        luts[c].assign(tr.lut.begin(), tr.lut.end());
+        params[c].dfMin = tr.dfMin;
+        params[c].dfScale = tr.dfScale;
+        params[c].dfUpper = tr.lut.empty()? 255.0 : static_cast<double>(tr.lut.size() - 1);
+        params[c].pLut = tr.lut.empty()? nullptr : luts[c].data();
+        params[c].dfNoData = bands[c].dfNoData;
+        mapBand[c] = (bands[c].eType > GDT_Unknown && bands[c].eType < GDT_TypeCount)?
+                    kernels.mapBand[bands[c].eType] : nullptr;
+        // 直接映射表与数据类型一致时只查表
+        gatherBand[c] = (!tr.valueLut.empty() && tr.eValueType == bands[c].eType)?
+                    GatherBandFor(bands[c].eType) : nullptr;
+        nNoData[c] = INT32_MIN;
+        const double dfNoData = bands[c].dfNoData;
+        if(gatherBand[c] != nullptr && dfNoData == std::floor(dfNoData)
+                && dfNoData >= tr.nValueOrigin
+                && dfNoData < tr.nValueOrigin + static_cast<double>(tr.valueLut.size())){
+            nNoData[c] = static_cast<int32_t>(dfNoData);
+        }
+    }
+
+    // 分段并行处理，每段内再按CHUNK分小段，使中间结果保持在缓存中
+    const size_t CHUNK = 4096;
+    const size_t TASK_PIXELS = CHUNK * 16;
+    const size_t nCount = bands[0].nCount;
+    ThreadPool& pool = pPool? *pPool : ThreadPool::Global();
+    pool.ParallelFor((nCount + TASK_PIXELS - 1) / TASK_PIXELS, [&](size_t iTask){
+        std::vector<uint8_t> work(CHUNK * 6);
+        uint8_t* pValues[3] = {&work[0], &work[CHUNK], &work[CHUNK*2]};
+        uint8_t* pValids[3] = {&work[CHUNK*3], &work[CHUNK*4], &work[CHUNK*5]};
+        const size_t nEnd = std::min(nCount, (iTask + 1) * TASK_PIXELS);
+        for(size_t nOff=iTask*TASK_PIXELS;nOff<nEnd;nOff+=CHUNK){
+            const size_t n = std::min(CHUNK, nEnd - nOff);
+            for(int c=0;c<3;++c){
+                if(mapBand[c] == nullptr){
+                    memset(pValues[c], 0, n); memset(pValids[c], 0, n);
+                    continue;
+                }
+                const uint8_t* pData = static_cast<const uint8_t*>(bands[c].pData)
+                        + nOff * GDALGetDataTypeSizeBytes(bands[c].eType);
+                if(gatherBand[c] != nullptr){
+                    const StretchTransform& tr = *transforms[c];
+                    gatherBand[c](pData, n, tr.valueLut.data(), tr.nValueOrigin, nNoData[c],
+                                  pValues[c], pValids[c]);
+                }
+                else {
+                    mapBand[c](pData, n, params[c], pValues[c], pValids[c]);
+                }
+            }
+            kernels.interleave(pValues[0], pValues[1], pValues[2],
+                               pValids[0], pValids[1], pValids[2], n, pRGBA + nOff*4);
+        }
+    });
+}
+
+}
@@ -0,0 +1,132 @@
+﻿#ifndef STRETCHENGINE_HPP
+#define STRETCHENGINE_HPP
+
+#include <gdal.h>
+
+#include "streamhistogram.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 与界面无关的影像拉伸引擎
+// 使用流程: 统计波段信息(ComputeBandStats) -> 生成拉伸变换(BuildTransform) -> 输出RGBA(ApplyStretchRGBA)
+// 局部自适应拉伸在统计信息之上再按网格生成颜色表(BuildClaheGrid) -> 输出RGBA(ApplyClaheRGBA)
+// 波段数据以原始数据类型参与计算，不再统一转换为double
+namespace rsisa
+{
+
+class ThreadPool;
+
+// 拉伸算法
+enum StretchAlgorithm
+{
+    SA_None = 0,        // 不拉伸，像素值直接截断到[0,255]
+    SA_Linear,          // 线性拉伸
+    SA_PercentClip,     // 2%线性拉伸
+    SA_Equalize,        // 直方图均衡化
+    SA_GaussSpec,       // 直方图规定化(正态分布)
+    SA_Clahe            // 限制对比度的局部自适应直方图均衡化，按网格拉伸(见clahe.hpp)
+                        // BuildTransform 对其返回全局直方图均衡化的变换
+};
+
+// 直方图统计的灰度级数
+const int HIST_BINS = 1024;
+
+// 一个波段的数据(不持有内存)
+struct BandView
+{
+    const void*  pData = nullptr;
+    GDALDataType eType = GDT_Unknown;
+    size_t       nCount = 0;        // 像素个数
+    double       dfNoData = 0.0;    // 无效值，不参与统计；三个波段都为无效值的像素输出为透明
+                                    // 为NaN时表示没有无效值(NaN和无穷大总是无效)
+};
+
+// 波段统计信息
+struct BandStats
+{
+    double   dfMin = 0.0;
+    double   dfMax = 0.0;
+    double   dfMean = 0.0;
+    double   dfStddev = 0.0;
+    uint64_t nValidCount = 0;       // 有效像素个数
+    // 在[dfMin,dfMax]之间分为HIST_BINS个灰度级的像素个数
+    std::vector<double> histogram;
+    // 更精细的像素值分布，用于计算分位数
+    // 8位和16位整数数据为每个整数一个桶的精确直方图
+    StreamHistogram distribution;
+    GDALDataType eType = GDT_Unknown;   // 统计的数据类型
+};
+
+// 拉伸变换
+// 先计算 idx = (value - dfMin) * dfScale
+// lut为空时输出 clamp(idx,0,255)，否则输出 lut[clamp(idx,0,lut.size()-1)]
+// 8位和16位整数数据另外生成覆盖整个取值范围的直接映射表，
+// 拉伸同类型的数据时每个像素只查一次表，不需要浮点计算
+struct StretchTransform
+{
+    double dfMin = 0.0;
+    double dfScale = 1.0;
+    std::vector<uint8_t> lut;       // color lookup table
+
+    GDALDataType eValueType = GDT_Unknown;  // 直接映射表适用的数据类型
+    int32_t nValueOrigin = 0;               // 直接映射表第一项对应的像素值
+    std::vector<uint8_t> valueLut;          // 像素值v输出 valueLut[v - nValueOrigin]
+};
+
+// 像素拉伸使用的指令集
+enum SimdLevel
+{
+    SIMD_Scalar = 0,
+    SIMD_SSE42,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// CPU支持的最高指令集
+SimdLevel DetectSimdLevel();
+
+// 当前使用的指令集，默认为CPU支持的最高指令集
+// 可以用配置项RSISA_SIMD(scalar/sse42/avx2/avx512)限制
+SimdLevel GetSimdLevel();
+
+// 设置使用的指令集(不超过CPU支持的级别)，返回实际使用的级别
+SimdLevel SetSimdLevel(SimdLevel eLevel);
+
+const char* SimdLevelName(SimdLevel eLevel);
+
+// 引擎是否直接支持该数据类型
+bool IsSupportedType(GDALDataType eType);
+
+// 读取数据时应使用的缓冲区类型(不支持的类型统一读取为GDT_Float64)
+GDALDataType BufferTypeFor(GDALDataType eType);
+
+// 8位和16位整数类型的取值范围，这些类型使用精确直方图和直接映射表
+// 其它类型返回false
+bool IntegerValueRange(GDALDataType eType, int32_t& nMinValue, int32_t& nValueCount);
+
+// 一次遍历统计波段的最大最小值、均值、标准差、直方图和像素值分布
+// pPool为并行使用的线程池，为空时使用 ThreadPool::Global()
+BandStats ComputeBandStats(const BandView& band, ThreadPool* pPool = nullptr);
+
+// 合并nCount组统计信息(例如镶嵌中各景影像的同一波段)，结果与把这些像素放在一起统计相同
+// 最大最小值、均值方差和像素值分布都可以合并，结果与合并的顺序和分组无关(均值方差只差舍入误差)
+// 因此已合并的结果可以保存下来，有新的影像时再与新影像的统计信息合并
+// 数据类型不同时结果为能容纳这些类型的类型(GDALDataTypeUnion)
+BandStats MergeBandStats(const BandStats* pStats, size_t nCount);
+
+// 分位数：有效像素中比例为dfFraction的像素值不大于返回值，结果限制在[dfMin,dfMax]内
+double Percentile(const BandStats& stats, double dfFraction);
+
+// 根据统计信息生成拉伸变换
+StretchTransform BuildTransform(StretchAlgorithm eAlg, const BandStats& stats);
+
+// 将RGB三个波段拉伸后输出为RGBA8888，pRGBA需要有 bands[0].nCount*4 字节
+// 三个波段的像素个数必须相同，数据类型可以不同
+void ApplyStretchRGBA(const BandView bands[3], const StretchTransform* transforms[3],
+                      uint8_t* pRGBA, ThreadPool* pPool = nullptr);
+
+}
+
+#endif // STRETCHENGINE_HPP
@@ -0,0 +1,16 @@
+# 链接影像拉伸引擎
+# 使用引擎的子项目 include 此文件，并在 rsisa.pro 中声明对 StretchEngine 的依赖
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+win32:CONFIG(release, debug|release): STRETCHENGINE_DIR = $$OUT_PWD/../StretchEngine/release
+else:win32:CONFIG(debug, debug|release): STRETCHENGINE_DIR = $$OUT_PWD/../StretchEngine/debug
+else: STRETCHENGINE_DIR = $$OUT_PWD/../StretchEngine
+
+LIBS += -L$$STRETCHENGINE_DIR -lStretchEngine
+
+win32-g++|unix: PRE_TARGETDEPS += $$STRETCHENGINE_DIR/libStretchEngine.a
+else:win32: PRE_TARGETDEPS += $$STRETCHENGINE_DIR/StretchEngine.lib
+
+include(../gdal.pri)
@@ -0,0 +1,143 @@
+﻿#ifndef STRETCHKERNEL_HPP
+#define STRETCHKERNEL_HPP
+
+#include "stretchengine.hpp"
+#include "bandstats.hpp"
+#include "stretchsimd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+// 按数据类型模板化的拉伸计算核心，只在引擎内部使用
+namespace rsisa
+{
+namespace kernel
+{
+
+// 判断像素是否有效(不是无效值，也不是NaN或无穷大)
+template<typename T>
+inline bool IsValid(T value, double dfNoData)
+{
+    double v = static_cast<double>(value);
+    return v - v == 0.0 && v != dfNoData;
+}
+
+// 限制到[0,dfUpper]，NaN按0处理
+inline double ClampIndex(double x, double dfUpper)
+{
+    x = (x > 0.0)? x : 0.0;
+    return (x < dfUpper)? x : dfUpper;
+}
+
+// 按直方图的累计概率生成HIST_BINS级的均衡化颜色表，dfTotal为直方图的像素总数
+inline void EqualizeLut(const double* pHist, double dfTotal, uint8_t* pLut)
+{
+    const double factor = 1.0 / dfTotal;
+    double cdf = 0.0;
+    for(int i=0;i<HIST_BINS;++i){
+        cdf += pHist[i] * factor;
+        pLut[i] = static_cast<uint8_t>(ClampIndex(cdf*255, 255.0));
+    }
+}
+
+// 合并两组样本的个数、均值和离差平方和(Chan等人的并行Welford算法)
+inline void MergeMoments(uint64_t& nCount, double& dfMean, double& dfM2,
+                         uint64_t nCountB, double dfMeanB, double dfM2B)
+{
+    if(nCountB == 0){ return; }
+    if(nCount == 0){
+        nCount = nCountB; dfMean = dfMeanB; dfM2 = dfM2B;
+        return;
+    }
+    const double n = static_cast<double>(nCount), nB = static_cast<double>(nCountB);
+    const double delta = dfMeanB - dfMean;
+    dfMean += delta * nB / (n + nB);
+    dfM2 += dfM2B + delta * delta * n * nB / (n + nB);
+    nCount += nCountB;
+}
+
+// 一次遍历累加统计信息，像素值分布累加到hist中
+// 每MOMENT_CHUNK个像素以第一个有效值为参考点累加一阶和二阶矩，再按Welford算法合并，
+// 精度与逐个像素的Welford更新相同，但内层循环中没有除法
+const size_t MOMENT_CHUNK = 4096;
+
+template<typename T>
+void AccumulateT(const T* pData, size_t nCount, double dfNoData, BandAccumulator& acc, StreamHistogram& hist)
+{
+    double dfMin = acc.dfMin, dfMax = acc.dfMax;
+    for(size_t nBegin=0;nBegin<nCount;nBegin+=MOMENT_CHUNK){
+        const size_t nEnd = std::min(nCount, nBegin + MOMENT_CHUNK);
+        double dfShift = 0.0, dfS1 = 0.0, dfS2 = 0.0;
+        uint64_t nValid = 0;
+        for(size_t i=nBegin;i<nEnd;++i){
+            if(!IsValid(pData[i], dfNoData)){ continue; }
+            double v = static_cast<double>(pData[i]);
+            if(nValid == 0){ dfShift = v; }
+            double d = v - dfShift;
+            dfS1 += d; dfS2 += d*d; nValid += 1;
+            dfMin = std::min(dfMin,v); dfMax = std::max(dfMax,v);
+            hist.Add(v);
+        }
+        if(nValid > 0){
+            MergeMoments(acc.nValidCount, acc.dfMean, acc.dfM2,
+                         nValid, dfShift + dfS1 / nValid, std::max(0.0, dfS2 - dfS1 * dfS1 / nValid));
+        }
+    }
+    acc.dfMin = dfMin; acc.dfMax = dfMax;
+}
+
+// 拉伸一个波段(标量实现，向量化实现必须与之结果完全相同)
+// pOut为8位结果，pValid为有效标记(有效0xFF，无效0)，无效像素输出0
+template<typename T>
+void MapBandT(const T* pData, size_t nCount, const simd::MapParams& params,
+              uint8_t* pOut, uint8_t* pValid)
+{
+    for(size_t i=0;i<nCount;++i){
+        if(!IsValid(pData[i], params.dfNoData)){
+            pOut[i] = 0; pValid[i] = 0; continue;
+        }
+        double x = ClampIndex((static_cast<double>(pData[i]) - params.dfMin) * params.dfScale, params.dfUpper);
+        int idx = static_cast<int>(x);
+        pOut[i] = static_cast<uint8_t>(params.pLut? params.pLut[idx] : idx);
+        pValid[i] = 0xFF;
+    }
+}
+
+// 用直接映射表拉伸8位或16位整数波段，每个像素只查一次表
+// nNoData为无效值，不在该类型取值范围内时使用INT32_MIN表示没有无效值
+template<typename T>
+void GatherBandT(const T* pData, size_t nCount, const uint8_t* pValueLut, int32_t nValueOrigin,
+                 int32_t nNoData, uint8_t* pOut, uint8_t* pValid)
+{
+    for(size_t i=0;i<nCount;++i){
+        const int32_t v = static_cast<int32_t>(pData[i]);
+        const uint8_t valid = (v == nNoData)? 0 : 0xFF;
+        pOut[i] = pValueLut[v - nValueOrigin] & valid;
+        pValid[i] = valid;
+    }
+}
+
+// CLAHE一行像素的双线性插值(标量实现，向量化实现必须与之结果完全相同)，参数见simd::InterpolateFn
+// 定点计算：先在左右网格之间插值，再在上下两行之间插值，最后四舍五入
+inline void InterpolateRow(const uint16_t* pIdx, const uint8_t* pValid, size_t nCount,
+                           const uint8_t* pLuts0, const uint8_t* pLuts1, int32_t nWy,
+                           const int32_t* pOff0, const int32_t* pOff1, const int32_t* pWx, uint8_t* pOut)
+{
+    const int32_t nOne = 1 << simd::INTERP_WEIGHT_BITS;
+    const int32_t nWy0 = nOne - nWy;
+    for(size_t i=0;i<nCount;++i){
+        const int32_t v = pIdx[i];
+        const int32_t wx = pWx[i];
+        const int32_t a = pLuts0[pOff0[i] + v] * (nOne - wx) + pLuts0[pOff1[i] + v] * wx;
+        const int32_t b = pLuts1[pOff0[i] + v] * (nOne - wx) + pLuts1[pOff1[i] + v] * wx;
+        const int32_t out = (a * nWy0 + b * nWy + (1 << (2 * simd::INTERP_WEIGHT_BITS - 1)))
+                >> (2 * simd::INTERP_WEIGHT_BITS);
+        pOut[i] = static_cast<uint8_t>(out) & pValid[i];
+    }
+}
+
+}
+}
+
+#endif // STRETCHKERNEL_HPP
@@ -0,0 +1,174 @@
+﻿#include "stretchsimd.hpp"
+#include "stretchkernel.hpp"
+
+#include <cpl_conv.h>
+
+#include <atomic>
+#include <cstring>
+
+#if defined(RSISA_SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace rsisa
+{
+
+namespace
+{
+
+template<typename T>
+void MapBandScalar(const void* pData, size_t nCount, const simd::MapParams& params,
+                   uint8_t* pOut, uint8_t* pValid)
+{
+    kernel::MapBandT(static_cast<const T*>(pData), nCount, params, pOut, pValid);
+}
+
+void InterleaveScalar(const uint8_t* pR, const uint8_t* pG, const uint8_t* pB,
+                      const uint8_t* pValidR, const uint8_t* pValidG, const uint8_t* pValidB,
+                      size_t nCount, uint8_t* pRGBA)
+{
+    for(size_t i=0;i<nCount;++i){
+        pRGBA[i*4+0] = pR[i];
+        pRGBA[i*4+1] = pG[i];
+        pRGBA[i*4+2] = pB[i];
+        pRGBA[i*4+3] = pValidR[i] | pValidG[i] | pValidB[i];
+    }
+}
+
+// 各级指令集的内核，低一级的内核作为高一级中未实现类型的后备
+struct KernelTables
+{
+    simd::KernelTable tables[SIMD_AVX512 + 1];
+
+    KernelTables()
+    {
+        simd::KernelTable& scalar = tables[SIMD_Scalar];
+        memset(&scalar, 0, sizeof(scalar));
+        scalar.mapBand[GDT_Byte] = MapBandScalar<uint8_t>;
+        scalar.mapBand[GDT_UInt16] = MapBandScalar<uint16_t>;
+        scalar.mapBand[GDT_Int16] = MapBandScalar<int16_t>;
+        scalar.mapBand[GDT_UInt32] = MapBandScalar<uint32_t>;
+        scalar.mapBand[GDT_Float32] = MapBandScalar<float>;
+        scalar.mapBand[GDT_Float64] = MapBandScalar<double>;
+        scalar.interleave = InterleaveScalar;
+        scalar.interpolate = kernel::InterpolateRow;
+
+        tables[SIMD_SSE42] = tables[SIMD_Scalar];
+        simd::FillSSE42Kernels(tables[SIMD_SSE42]);
+        tables[SIMD_AVX2] = tables[SIMD_SSE42];
+        simd::FillAVX2Kernels(tables[SIMD_AVX2]);
+        tables[SIMD_AVX512] = tables[SIMD_AVX2];
+        simd::FillAVX512Kernels(tables[SIMD_AVX512]);
+    }
+};
+
+// 当前使用的指令集，-1表示尚未初始化
+std::atomic<int> g_nSimdLevel(-1);
+
+// 配置项RSISA_SIMD限制的最高指令集
+SimdLevel ConfiguredSimdLevel()
+{
+    const char* pszLevel = CPLGetConfigOption("RSISA_SIMD", nullptr);
+    if(pszLevel == nullptr){
+        return SIMD_AVX512;
+    }
+    for(int i=SIMD_Scalar;i<=SIMD_AVX512;++i){
+        if(strcmp(pszLevel, SimdLevelName(static_cast<SimdLevel>(i))) == 0){
+            return static_cast<SimdLevel>(i);
+        }
+    }
+    return SIMD_AVX512;
+}
+
+}
+
+SimdLevel DetectSimdLevel()
+{
+#if defined(RSISA_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512f")
+            && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw")){
+        return SIMD_AVX512;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        return SIMD_AVX2;
+    }
+    if(__builtin_cpu_supports("sse4.2")){
+        return SIMD_SSE42;
+    }
+#elif defined(RSISA_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int nIds = info[0];
+    __cpuid(info, 1);
+    const bool bSSE42 = (info[2] & (1 << 20)) != 0;
+    const bool bOSXSave = (info[2] & (1 << 27)) != 0;
+    // 操作系统需要保存YMM/ZMM寄存器
+    const unsigned long long xcr0 = bOSXSave? _xgetbv(0) : 0;
+    const bool bAVXState = (xcr0 & 0x6) == 0x6;
+    const bool bAVX512State = (xcr0 & 0xe6) == 0xe6;
+    bool bAVX2 = false, bAVX512 = false;
+    if(nIds >= 7){
+        __cpuidex(info, 7, 0);
+        bAVX2 = (info[1] & (1 << 5)) != 0;
+        bAVX512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0
+                && (info[1] & (1u << 31)) != 0;
+    }
+    if(bAVX2 && bAVX512 && bAVX512State){
+        return SIMD_AVX512;
+    }
+    if(bAVX2 && bAVXState){
+        return SIMD_AVX2;
+    }
+    if(bSSE42){
+        return SIMD_SSE42;
+    }
+#endif
+    return SIMD_Scalar;
+}
+
+SimdLevel GetSimdLevel()
+{
+    int nLevel = g_nSimdLevel.load();
+    if(nLevel < 0){
+        SimdLevel eDetected = DetectSimdLevel();
+        SimdLevel eConfigured = ConfiguredSimdLevel();
+        nLevel = (eConfigured < eDetected)? eConfigured : eDetected;
+        g_nSimdLevel.store(nLevel);
+    }
+    return static_cast<SimdLevel>(nLevel);
+}
+
+SimdLevel SetSimdLevel(SimdLevel eLevel)
+{
+    SimdLevel eDetected = DetectSimdLevel();
+    if(eLevel > eDetected){
+        eLevel = eDetected;
+    }
+    g_nSimdLevel.store(eLevel);
+    return eLevel;
+}
+
+const char* SimdLevelName(SimdLevel eLevel)
+{
+    switch(eLevel){
+    case SIMD_SSE42:  return "sse42";
+    case SIMD_AVX2:   return "avx2";
+    case SIMD_AVX512: return "avx512";
+    default:          return "scalar";
+    }
+}
+
+namespace simd
+{
+
+const KernelTable& ActiveKernels()
+{
+    static const KernelTables kernels;
+    return kernels.tables[GetSimdLevel()];
+}
+
+}
+
+}
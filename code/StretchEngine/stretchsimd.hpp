@@ -0,0 +1,80 @@
+﻿#ifndef STRETCHSIMD_HPP
+#define STRETCHSIMD_HPP
+
+#include <gdal.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// 像素拉伸的向量化实现，运行时按CPU支持的指令集选择
+// 各指令集的实现分别放在 stretchsimd_*.cpp 中，这些文件只使用内置指令和普通指针，
+// 不能包含带有内联函数或模板的头文件，避免高指令集编译出的代码被其它文件链接使用
+namespace rsisa
+{
+namespace simd
+{
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RSISA_SIMD_X86 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RSISA_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RSISA_TARGET(isa)
+#endif
+
+// 单个波段的映射参数
+// 有效像素 x = clamp((value - dfMin) * dfScale, 0, dfUpper)
+// 输出 pLut为空时为 int(x)，否则为 pLut[int(x)]
+struct MapParams
+{
+    double         dfMin;
+    double         dfScale;
+    double         dfUpper;
+    const int32_t* pLut;        // 扩展为32位的颜色表，便于gather
+    double         dfNoData;
+};
+
+// 映射一个波段：pOut为8位结果，pValid为有效标记(有效0xFF，无效0)，无效像素输出0
+typedef void (*MapBandFn)(const void* pData, size_t nCount, const MapParams& params,
+                          uint8_t* pOut, uint8_t* pValid);
+
+// 将三个通道交错为RGBA，alpha为三个有效标记的或
+typedef void (*InterleaveFn)(const uint8_t* pR, const uint8_t* pG, const uint8_t* pB,
+                             const uint8_t* pValidR, const uint8_t* pValidG, const uint8_t* pValidB,
+                             size_t nCount, uint8_t* pRGBA);
+
+// CLAHE插值的定点权重位数，权重范围为[0, 1<<INTERP_WEIGHT_BITS]
+const int INTERP_WEIGHT_BITS = 8;
+
+// CLAHE：一行像素在上下两行网格的颜色表之间双线性插值
+// pIdx为灰度级，pValid为有效标记，无效像素输出0
+// pLuts0/pLuts1为上下两行网格的颜色表，nWy为下一行网格的权重
+// pOff0/pOff1为每个像素左右网格颜色表的偏移，pWx为右侧网格的权重
+// 向量化实现按32位gather读取颜色表，颜色表最后一项之后需要至少3字节可读
+typedef void (*InterpolateFn)(const uint16_t* pIdx, const uint8_t* pValid, size_t nCount,
+                              const uint8_t* pLuts0, const uint8_t* pLuts1, int32_t nWy,
+                              const int32_t* pOff0, const int32_t* pOff1, const int32_t* pWx,
+                              uint8_t* pOut);
+
+// 一组内核，mapBand按GDALDataType索引，为空表示该类型使用标量实现
+struct KernelTable
+{
+    MapBandFn     mapBand[GDT_TypeCount];
+    InterleaveFn  interleave;
+    InterpolateFn interpolate;
+};
+
+// 用各指令集的实现替换table中对应的内核，不支持的平台返回false
+bool FillSSE42Kernels(KernelTable& table);
+bool FillAVX2Kernels(KernelTable& table);
+bool FillAVX512Kernels(KernelTable& table);
+
+// 当前使用的内核
+const KernelTable& ActiveKernels();
+
+}
+}
+
+#endif // STRETCHSIMD_HPP
@@ -0,0 +1,213 @@
+﻿#include "stretchsimd.hpp"
+
+#ifdef RSISA_SIMD_X86
+
+#include <immintrin.h>
+#include <cstring>
+
+#define AVX2_TARGET RSISA_TARGET("avx2")
+
+namespace rsisa
+{
+namespace simd
+{
+
+namespace
+{
+
+// 读取4个像素，转换为double
+AVX2_TARGET inline __m256d Load4(const uint8_t* p)
+{
+    int32_t x; memcpy(&x, p, sizeof(x));
+    return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(x)));
+}
+
+AVX2_TARGET inline __m256d Load4(const uint16_t* p)
+{
+    return _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+
+AVX2_TARGET inline __m256d Load4(const int16_t* p)
+{
+    return _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+
+AVX2_TARGET inline __m256d Load4(const float* p)
+{
+    return _mm256_cvtps_pd(_mm_loadu_ps(p));
+}
+
+AVX2_TARGET inline __m256d Load4(const double* p)
+{
+    return _mm256_loadu_pd(p);
+}
+
+struct Consts
+{
+    __m256d vMin, vScale, vUpper, vZero, vNoData;
+};
+
+// 映射4个像素，返回32位的值和有效标记
+// max/min遇到NaN时返回第二个参数，与标量实现一致
+template<bool bLut>
+AVX2_TARGET inline void Map4(__m256d v, const Consts& k, const int32_t* pLut,
+                             __m128i& vals, __m128i& valid)
+{
+    __m256d m = _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(v, v), k.vZero, _CMP_EQ_OQ),
+                              _mm256_cmp_pd(v, k.vNoData, _CMP_NEQ_UQ));
+    __m256d x = _mm256_mul_pd(_mm256_sub_pd(v, k.vMin), k.vScale);
+    x = _mm256_min_pd(_mm256_max_pd(x, k.vZero), k.vUpper);
+    __m128i idx = _mm256_cvttpd_epi32(x);
+    if(bLut){
+        idx = _mm_i32gather_epi32(pLut, idx, 4);
+    }
+    __m128 mLo = _mm256_castps256_ps128(_mm256_castpd_ps(m));
+    __m128 mHi = _mm256_extractf128_ps(_mm256_castpd_ps(m), 1);
+    valid = _mm_castps_si128(_mm_shuffle_ps(mLo, mHi, _MM_SHUFFLE(2,0,2,0)));
+    vals = _mm_and_si128(idx, valid);
+}
+
+template<typename T, bool bLut>
+AVX2_TARGET void MapBlock8(const T* p, const Consts& k, const int32_t* pLut,
+                           uint8_t* pOut, uint8_t* pValid)
+{
+    __m128i vals0, valid0, vals1, valid1;
+    Map4<bLut>(Load4(p), k, pLut, vals0, valid0);
+    Map4<bLut>(Load4(p + 4), k, pLut, vals1, valid1);
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pOut),
+                     _mm_packus_epi16(_mm_packus_epi32(vals0, vals1), zero));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pValid),
+                     _mm_packs_epi16(_mm_packs_epi32(valid0, valid1), zero));
+}
+
+template<typename T, bool bLut>
+AVX2_TARGET void MapBandImpl(const T* p, size_t nCount, const MapParams& params,
+                             uint8_t* pOut, uint8_t* pValid)
+{
+    Consts k;
+    k.vMin = _mm256_set1_pd(params.dfMin);
+    k.vScale = _mm256_set1_pd(params.dfScale);
+    k.vUpper = _mm256_set1_pd(params.dfUpper);
+    k.vZero = _mm256_setzero_pd();
+    k.vNoData = _mm256_set1_pd(params.dfNoData);
+
+    size_t i = 0;
+    for(;i+8<=nCount;i+=8){
+        MapBlock8<T, bLut>(p + i, k, params.pLut, pOut + i, pValid + i);
+    }
+    if(i < nCount){
+        // 不足8个像素时复制到临时缓冲区计算
+        T tail[8] = {};
+        uint8_t out[8], valid[8];
+        memcpy(tail, p + i, (nCount - i) * sizeof(T));
+        MapBlock8<T, bLut>(tail, k, params.pLut, out, valid);
+        memcpy(pOut + i, out, nCount - i);
+        memcpy(pValid + i, valid, nCount - i);
+    }
+}
+
+template<typename T>
+AVX2_TARGET void MapBand(const void* pData, size_t nCount, const MapParams& params,
+                         uint8_t* pOut, uint8_t* pValid)
+{
+    const T* p = static_cast<const T*>(pData);
+    if(params.pLut){
+        MapBandImpl<T, true>(p, nCount, params, pOut, pValid);
+    }
+    else{
+        MapBandImpl<T, false>(p, nCount, params, pOut, pValid);
+    }
+}
+
+
+// 8个像素的双线性插值：每个像素的4个颜色表值用gather按32位读取后取最低字节
+AVX2_TARGET void Interpolate8(const uint16_t* pIdx, const uint8_t* pValid,
+                              const uint8_t* pLuts0, const uint8_t* pLuts1, __m256i vWy0, __m256i vWy,
+                              const int32_t* pOff0, const int32_t* pOff1, const int32_t* pWx, uint8_t* pOut)
+{
+    const __m256i vByte = _mm256_set1_epi32(0xFF);
+    const __m256i vOne = _mm256_set1_epi32(1 << INTERP_WEIGHT_BITS);
+    const __m256i vRound = _mm256_set1_epi32(1 << (2 * INTERP_WEIGHT_BITS - 1));
+    const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pIdx)));
+    const __m256i o0 = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pOff0)), v);
+    const __m256i o1 = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pOff1)), v);
+    const int* p0 = reinterpret_cast<const int*>(pLuts0);
+    const int* p1 = reinterpret_cast<const int*>(pLuts1);
+    const __m256i l00 = _mm256_and_si256(_mm256_i32gather_epi32(p0, o0, 1), vByte);
+    const __m256i l01 = _mm256_and_si256(_mm256_i32gather_epi32(p0, o1, 1), vByte);
+    const __m256i l10 = _mm256_and_si256(_mm256_i32gather_epi32(p1, o0, 1), vByte);
+    const __m256i l11 = _mm256_and_si256(_mm256_i32gather_epi32(p1, o1, 1), vByte);
+    const __m256i wx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pWx));
+    const __m256i wx0 = _mm256_sub_epi32(vOne, wx);
+    const __m256i a = _mm256_add_epi32(_mm256_mullo_epi32(l00, wx0), _mm256_mullo_epi32(l01, wx));
+    const __m256i b = _mm256_add_epi32(_mm256_mullo_epi32(l10, wx0), _mm256_mullo_epi32(l11, wx));
+    const __m256i out = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(a, vWy0),
+                                                                            _mm256_mullo_epi32(b, vWy)), vRound),
+                                          2 * INTERP_WEIGHT_BITS);
+    // 打包按128位分别进行，两半的低4字节拼为8字节
+    __m256i packed = _mm256_packus_epi32(out, out);
+    packed = _mm256_packus_epi16(packed, packed);
+    const __m128i bytes = _mm_unpacklo_epi32(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+    const __m128i valid = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pValid));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pOut), _mm_and_si128(bytes, valid));
+}
+
+AVX2_TARGET void Interpolate(const uint16_t* pIdx, const uint8_t* pValid, size_t nCount,
+                             const uint8_t* pLuts0, const uint8_t* pLuts1, int32_t nWy,
+                             const int32_t* pOff0, const int32_t* pOff1, const int32_t* pWx, uint8_t* pOut)
+{
+    const __m256i vWy = _mm256_set1_epi32(nWy);
+    const __m256i vWy0 = _mm256_set1_epi32((1 << INTERP_WEIGHT_BITS) - nWy);
+    size_t i = 0;
+    for(;i+8<=nCount;i+=8){
+        Interpolate8(pIdx + i, pValid + i, pLuts0, pLuts1, vWy0, vWy, pOff0 + i, pOff1 + i, pWx + i, pOut + i);
+    }
+    if(i < nCount){
+        // 不足8个像素时复制到临时缓冲区计算，补齐的像素读取颜色表的第一项
+        uint16_t idx[8] = {};
+        uint8_t valid[8] = {}, out[8];
+        int32_t off0[8] = {}, off1[8] = {}, wx[8] = {};
+        const size_t n = nCount - i;
+        memcpy(idx, pIdx + i, n * sizeof(uint16_t));
+        memcpy(valid, pValid + i, n);
+        memcpy(off0, pOff0 + i, n * sizeof(int32_t));
+        memcpy(off1, pOff1 + i, n * sizeof(int32_t));
+        memcpy(wx, pWx + i, n * sizeof(int32_t));
+        Interpolate8(idx, valid, pLuts0, pLuts1, vWy0, vWy, off0, off1, wx, out);
+        memcpy(pOut + i, out, n);
+    }
+}
+
+}
+
+bool FillAVX2Kernels(KernelTable& table)
+{
+    table.mapBand[GDT_Byte] = MapBand<uint8_t>;
+    table.mapBand[GDT_UInt16] = MapBand<uint16_t>;
+    table.mapBand[GDT_Int16] = MapBand<int16_t>;
+    table.mapBand[GDT_Float32] = MapBand<float>;
+    table.mapBand[GDT_Float64] = MapBand<double>;
+    table.interpolate = Interpolate;
+    return true;
+}
+
+}
+}
+
+#else
+
+namespace rsisa
+{
+namespace simd
+{
+
+bool FillAVX2Kernels(KernelTable&)
+{
+    return false;
+}
+
+}
+}
+
+#endif
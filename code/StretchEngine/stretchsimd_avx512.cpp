@@ -0,0 +1,192 @@
+﻿#include "stretchsimd.hpp"
+
+#ifdef RSISA_SIMD_X86
+
+#include <immintrin.h>
+#include <cstring>
+
+#define AVX512_TARGET RSISA_TARGET("avx2,avx512f,avx512vl,avx512bw")
+
+namespace rsisa
+{
+namespace simd
+{
+
+namespace
+{
+
+// 读取8个像素，转换为double
+AVX512_TARGET inline __m512d Load8(const uint8_t* p)
+{
+    return _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+
+AVX512_TARGET inline __m512d Load8(const uint16_t* p)
+{
+    return _mm512_cvtepi32_pd(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+}
+
+AVX512_TARGET inline __m512d Load8(const int16_t* p)
+{
+    return _mm512_cvtepi32_pd(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+}
+
+AVX512_TARGET inline __m512d Load8(const float* p)
+{
+    return _mm512_cvtps_pd(_mm256_loadu_ps(p));
+}
+
+AVX512_TARGET inline __m512d Load8(const double* p)
+{
+    return _mm512_loadu_pd(p);
+}
+
+struct Consts
+{
+    __m512d vMin, vScale, vUpper, vZero, vNoData;
+};
+
+// 映射8个像素
+// max/min遇到NaN时返回第二个参数，与标量实现一致
+template<typename T, bool bLut>
+AVX512_TARGET void MapBlock8(const T* p, const Consts& k, const int32_t* pLut,
+                             uint8_t* pOut, uint8_t* pValid)
+{
+    __m512d v = Load8(p);
+    __mmask8 m = _mm512_cmp_pd_mask(_mm512_sub_pd(v, v), k.vZero, _CMP_EQ_OQ)
+               & _mm512_cmp_pd_mask(v, k.vNoData, _CMP_NEQ_UQ);
+    __m512d x = _mm512_mul_pd(_mm512_sub_pd(v, k.vMin), k.vScale);
+    x = _mm512_min_pd(_mm512_max_pd(x, k.vZero), k.vUpper);
+    __m256i idx = _mm512_cvttpd_epi32(x);
+    if(bLut){
+        idx = _mm256_i32gather_epi32(pLut, idx, 4);
+    }
+    idx = _mm256_maskz_mov_epi32(m, idx);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pOut), _mm256_cvtepi32_epi8(idx));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pValid), _mm_movm_epi8(static_cast<__mmask16>(m)));
+}
+
+template<typename T, bool bLut>
+AVX512_TARGET void MapBandImpl(const T* p, size_t nCount, const MapParams& params,
+                               uint8_t* pOut, uint8_t* pValid)
+{
+    Consts k;
+    k.vMin = _mm512_set1_pd(params.dfMin);
+    k.vScale = _mm512_set1_pd(params.dfScale);
+    k.vUpper = _mm512_set1_pd(params.dfUpper);
+    k.vZero = _mm512_setzero_pd();
+    k.vNoData = _mm512_set1_pd(params.dfNoData);
+
+    size_t i = 0;
+    for(;i+8<=nCount;i+=8){
+        MapBlock8<T, bLut>(p + i, k, params.pLut, pOut + i, pValid + i);
+    }
+    if(i < nCount){
+        // 不足8个像素时复制到临时缓冲区计算
+        T tail[8] = {};
+        uint8_t out[8], valid[8];
+        memcpy(tail, p + i, (nCount - i) * sizeof(T));
+        MapBlock8<T, bLut>(tail, k, params.pLut, out, valid);
+        memcpy(pOut + i, out, nCount - i);
+        memcpy(pValid + i, valid, nCount - i);
+    }
+}
+
+template<typename T>
+AVX512_TARGET void MapBand(const void* pData, size_t nCount, const MapParams& params,
+                           uint8_t* pOut, uint8_t* pValid)
+{
+    const T* p = static_cast<const T*>(pData);
+    if(params.pLut){
+        MapBandImpl<T, true>(p, nCount, params, pOut, pValid);
+    }
+    else{
+        MapBandImpl<T, false>(p, nCount, params, pOut, pValid);
+    }
+}
+
+
+// 16个像素的双线性插值：每个像素的4个颜色表值用gather按32位读取后取最低字节
+AVX512_TARGET void Interpolate16(const uint16_t* pIdx, const uint8_t* pValid,
+                                 const uint8_t* pLuts0, const uint8_t* pLuts1, __m512i vWy0, __m512i vWy,
+                                 const int32_t* pOff0, const int32_t* pOff1, const int32_t* pWx, uint8_t* pOut)
+{
+    const __m512i vByte = _mm512_set1_epi32(0xFF);
+    const __m512i vOne = _mm512_set1_epi32(1 << INTERP_WEIGHT_BITS);
+    const __m512i vRound = _mm512_set1_epi32(1 << (2 * INTERP_WEIGHT_BITS - 1));
+    const __m512i v = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pIdx)));
+    const __m512i o0 = _mm512_add_epi32(_mm512_loadu_si512(pOff0), v);
+    const __m512i o1 = _mm512_add_epi32(_mm512_loadu_si512(pOff1), v);
+    const __m512i l00 = _mm512_and_si512(_mm512_i32gather_epi32(o0, pLuts0, 1), vByte);
+    const __m512i l01 = _mm512_and_si512(_mm512_i32gather_epi32(o1, pLuts0, 1), vByte);
+    const __m512i l10 = _mm512_and_si512(_mm512_i32gather_epi32(o0, pLuts1, 1), vByte);
+    const __m512i l11 = _mm512_and_si512(_mm512_i32gather_epi32(o1, pLuts1, 1), vByte);
+    const __m512i wx = _mm512_loadu_si512(pWx);
+    const __m512i wx0 = _mm512_sub_epi32(vOne, wx);
+    const __m512i a = _mm512_add_epi32(_mm512_mullo_epi32(l00, wx0), _mm512_mullo_epi32(l01, wx));
+    const __m512i b = _mm512_add_epi32(_mm512_mullo_epi32(l10, wx0), _mm512_mullo_epi32(l11, wx));
+    const __m512i out = _mm512_srli_epi32(_mm512_add_epi32(_mm512_add_epi32(_mm512_mullo_epi32(a, vWy0),
+                                                                            _mm512_mullo_epi32(b, vWy)), vRound),
+                                          2 * INTERP_WEIGHT_BITS);
+    const __m128i valid = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pValid));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut), _mm_and_si128(_mm512_cvtepi32_epi8(out), valid));
+}
+
+AVX512_TARGET void Interpolate(const uint16_t* pIdx, const uint8_t* pValid, size_t nCount,
+                               const uint8_t* pLuts0, const uint8_t* pLuts1, int32_t nWy,
+                               const int32_t* pOff0, const int32_t* pOff1, const int32_t* pWx, uint8_t* pOut)
+{
+    const __m512i vWy = _mm512_set1_epi32(nWy);
+    const __m512i vWy0 = _mm512_set1_epi32((1 << INTERP_WEIGHT_BITS) - nWy);
+    size_t i = 0;
+    for(;i+16<=nCount;i+=16){
+        Interpolate16(pIdx + i, pValid + i, pLuts0, pLuts1, vWy0, vWy, pOff0 + i, pOff1 + i, pWx + i, pOut + i);
+    }
+    if(i < nCount){
+        // 不足16个像素时复制到临时缓冲区计算，补齐的像素读取颜色表的第一项
+        uint16_t idx[16] = {};
+        uint8_t valid[16] = {}, out[16];
+        int32_t off0[16] = {}, off1[16] = {}, wx[16] = {};
+        const size_t n = nCount - i;
+        memcpy(idx, pIdx + i, n * sizeof(uint16_t));
+        memcpy(valid, pValid + i, n);
+        memcpy(off0, pOff0 + i, n * sizeof(int32_t));
+        memcpy(off1, pOff1 + i, n * sizeof(int32_t));
+        memcpy(wx, pWx + i, n * sizeof(int32_t));
+        Interpolate16(idx, valid, pLuts0, pLuts1, vWy0, vWy, off0, off1, wx, out);
+        memcpy(pOut + i, out, n);
+    }
+}
+
+}
+
+bool FillAVX512Kernels(KernelTable& table)
+{
+    table.mapBand[GDT_Byte] = MapBand<uint8_t>;
+    table.mapBand[GDT_UInt16] = MapBand<uint16_t>;
+    table.mapBand[GDT_Int16] = MapBand<int16_t>;
+    table.mapBand[GDT_Float32] = MapBand<float>;
+    table.mapBand[GDT_Float64] = MapBand<double>;
+    table.interpolate = Interpolate;
+    return true;
+}
+
+}
+}
+
+#else
+
+namespace rsisa
+{
+namespace simd
+{
+
+bool FillAVX512Kernels(KernelTable&)
+{
+    return false;
+}
+
+}
+}
+
+#endif
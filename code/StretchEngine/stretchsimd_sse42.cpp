@@ -0,0 +1,264 @@
+﻿#include "stretchsimd.hpp"
+
+#ifdef RSISA_SIMD_X86
+
+#include <immintrin.h>
+#include <cstring>
+
+#define SSE42_TARGET RSISA_TARGET("sse4.2")
+
+namespace rsisa
+{
+namespace simd
+{
+
+namespace
+{
+
+// 读取4个像素，转换为两组double
+SSE42_TARGET inline void Load4(const uint8_t* p, __m128d& d0, __m128d& d1)
+{
+    int32_t x; memcpy(&x, p, sizeof(x));
+    __m128i i = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(x));
+    d0 = _mm_cvtepi32_pd(i); d1 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(i, i));
+}
+
+SSE42_TARGET inline void Load4(const uint16_t* p, __m128d& d0, __m128d& d1)
+{
+    __m128i i = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    d0 = _mm_cvtepi32_pd(i); d1 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(i, i));
+}
+
+SSE42_TARGET inline void Load4(const int16_t* p, __m128d& d0, __m128d& d1)
+{
+    __m128i i = _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+    d0 = _mm_cvtepi32_pd(i); d1 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(i, i));
+}
+
+SSE42_TARGET inline void Load4(const float* p, __m128d& d0, __m128d& d1)
+{
+    __m128 f = _mm_loadu_ps(p);
+    d0 = _mm_cvtps_pd(f); d1 = _mm_cvtps_pd(_mm_movehl_ps(f, f));
+}
+
+SSE42_TARGET inline void Load4(const double* p, __m128d& d0, __m128d& d1)
+{
+    d0 = _mm_loadu_pd(p); d1 = _mm_loadu_pd(p + 2);
+}
+
+struct Consts
+{
+    __m128d vMin, vScale, vUpper, vZero, vNoData;
+};
+
+// 有效标记：不是NaN/无穷大，且不等于无效值
+SSE42_TARGET inline __m128d ValidMask(__m128d v, const Consts& k)
+{
+    return _mm_and_pd(_mm_cmpeq_pd(_mm_sub_pd(v, v), k.vZero), _mm_cmpneq_pd(v, k.vNoData));
+}
+
+// 计算映射位置，max/min遇到NaN时返回第二个参数，与标量实现一致
+SSE42_TARGET inline __m128i Index2(__m128d v, const Consts& k)
+{
+    __m128d x = _mm_mul_pd(_mm_sub_pd(v, k.vMin), k.vScale);
+    x = _mm_min_pd(_mm_max_pd(x, k.vZero), k.vUpper);
+    return _mm_cvttpd_epi32(x);
+}
+
+// 映射4个像素，返回32位的值和有效标记
+template<bool bLut>
+SSE42_TARGET inline void Map4(__m128d d0, __m128d d1, const Consts& k, const int32_t* pLut,
+                              __m128i& vals, __m128i& valid)
+{
+    __m128i idx = _mm_unpacklo_epi64(Index2(d0, k), Index2(d1, k));
+    if(bLut){
+        idx = _mm_set_epi32(pLut[_mm_extract_epi32(idx, 3)], pLut[_mm_extract_epi32(idx, 2)],
+                            pLut[_mm_extract_epi32(idx, 1)], pLut[_mm_extract_epi32(idx, 0)]);
+    }
+    valid = _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(ValidMask(d0, k)),
+                                            _mm_castpd_ps(ValidMask(d1, k)), _MM_SHUFFLE(2,0,2,0)));
+    vals = _mm_and_si128(idx, valid);
+}
+
+template<typename T, bool bLut>
+SSE42_TARGET void MapBlock8(const T* p, const Consts& k, const int32_t* pLut,
+                            uint8_t* pOut, uint8_t* pValid)
+{
+    __m128d d0, d1;
+    __m128i vals0, valid0, vals1, valid1;
+    Load4(p, d0, d1);
+    Map4<bLut>(d0, d1, k, pLut, vals0, valid0);
+    Load4(p + 4, d0, d1);
+    Map4<bLut>(d0, d1, k, pLut, vals1, valid1);
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pOut),
+                     _mm_packus_epi16(_mm_packus_epi32(vals0, vals1), zero));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(pValid),
+                     _mm_packs_epi16(_mm_packs_epi32(valid0, valid1), zero));
+}
+
+template<typename T, bool bLut>
+SSE42_TARGET void MapBandImpl(const T* p, size_t nCount, const MapParams& params,
+                              uint8_t* pOut, uint8_t* pValid)
+{
+    Consts k;
+    k.vMin = _mm_set1_pd(params.dfMin);
+    k.vScale = _mm_set1_pd(params.dfScale);
+    k.vUpper = _mm_set1_pd(params.dfUpper);
+    k.vZero = _mm_setzero_pd();
+    k.vNoData = _mm_set1_pd(params.dfNoData);
+
+    size_t i = 0;
+    for(;i+8<=nCount;i+=8){
+        MapBlock8<T, bLut>(p + i, k, params.pLut, pOut + i, pValid + i);
+    }
+    if(i < nCount){
+        // 不足8个像素时复制到临时缓冲区计算
+        T tail[8] = {};
+        uint8_t out[8], valid[8];
+        memcpy(tail, p + i, (nCount - i) * sizeof(T));
+        MapBlock8<T, bLut>(tail, k, params.pLut, out, valid);
+        memcpy(pOut + i, out, nCount - i);
+        memcpy(pValid + i, valid, nCount - i);
+    }
+}
+
+template<typename T>
+SSE42_TARGET void MapBand(const void* pData, size_t nCount, const MapParams& params,
+                          uint8_t* pOut, uint8_t* pValid)
+{
+    const T* p = static_cast<const T*>(pData);
+    if(params.pLut){
+        MapBandImpl<T, true>(p, nCount, params, pOut, pValid);
+    }
+    else{
+        MapBandImpl<T, false>(p, nCount, params, pOut, pValid);
+    }
+}
+
+SSE42_TARGET void Interleave(const uint8_t* pR, const uint8_t* pG, const uint8_t* pB,
+                             const uint8_t* pValidR, const uint8_t* pValidG, const uint8_t* pValidB,
+                             size_t nCount, uint8_t* pRGBA)
+{
+    size_t i = 0;
+    for(;i+16<=nCount;i+=16){
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pR + i));
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pG + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pB + i));
+        __m128i a = _mm_or_si128(_mm_or_si128(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pValidR + i)),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pValidG + i))),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pValidB + i)));
+        __m128i rgLo = _mm_unpacklo_epi8(r, g), rgHi = _mm_unpackhi_epi8(r, g);
+        __m128i baLo = _mm_unpacklo_epi8(b, a), baHi = _mm_unpackhi_epi8(b, a);
+        __m128i* pOut = reinterpret_cast<__m128i*>(pRGBA + i*4);
+        _mm_storeu_si128(pOut + 0, _mm_unpacklo_epi16(rgLo, baLo));
+        _mm_storeu_si128(pOut + 1, _mm_unpackhi_epi16(rgLo, baLo));
+        _mm_storeu_si128(pOut + 2, _mm_unpacklo_epi16(rgHi, baHi));
+        _mm_storeu_si128(pOut + 3, _mm_unpackhi_epi16(rgHi, baHi));
+    }
+    for(;i<nCount;++i){
+        pRGBA[i*4+0] = pR[i];
+        pRGBA[i*4+1] = pG[i];
+        pRGBA[i*4+2] = pB[i];
+        pRGBA[i*4+3] = pValidR[i] | pValidG[i] | pValidB[i];
+    }
+}
+
+
+// 4个像素的双线性插值，l00/l01为上一行左右网格的颜色表值，l10/l11为下一行的
+SSE42_TARGET inline __m128i Blend4(__m128i l00, __m128i l01, __m128i l10, __m128i l11,
+                                   __m128i wx, __m128i vWy0, __m128i vWy)
+{
+    const __m128i vOne = _mm_set1_epi32(1 << INTERP_WEIGHT_BITS);
+    const __m128i vRound = _mm_set1_epi32(1 << (2 * INTERP_WEIGHT_BITS - 1));
+    const __m128i wx0 = _mm_sub_epi32(vOne, wx);
+    const __m128i a = _mm_add_epi32(_mm_mullo_epi32(l00, wx0), _mm_mullo_epi32(l01, wx));
+    const __m128i b = _mm_add_epi32(_mm_mullo_epi32(l10, wx0), _mm_mullo_epi32(l11, wx));
+    return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(a, vWy0), _mm_mullo_epi32(b, vWy)), vRound),
+                          2 * INTERP_WEIGHT_BITS);
+}
+
+// SSE4.2没有gather，颜色表逐个读取，插值计算向量化
+SSE42_TARGET void Interpolate4(const uint16_t* pIdx, const uint8_t* pValid,
+                               const uint8_t* pLuts0, const uint8_t* pLuts1, __m128i vWy0, __m128i vWy,
+                               const int32_t* pOff0, const int32_t* pOff1, const int32_t* pWx, uint8_t* pOut)
+{
+    const __m128i v = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pIdx)));
+    int32_t o0[4], o1[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(o0),
+                     _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pOff0)), v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(o1),
+                     _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pOff1)), v));
+    const __m128i l00 = _mm_setr_epi32(pLuts0[o0[0]], pLuts0[o0[1]], pLuts0[o0[2]], pLuts0[o0[3]]);
+    const __m128i l01 = _mm_setr_epi32(pLuts0[o1[0]], pLuts0[o1[1]], pLuts0[o1[2]], pLuts0[o1[3]]);
+    const __m128i l10 = _mm_setr_epi32(pLuts1[o0[0]], pLuts1[o0[1]], pLuts1[o0[2]], pLuts1[o0[3]]);
+    const __m128i l11 = _mm_setr_epi32(pLuts1[o1[0]], pLuts1[o1[1]], pLuts1[o1[2]], pLuts1[o1[3]]);
+    const __m128i wx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pWx));
+    const __m128i out = Blend4(l00, l01, l10, l11, wx, vWy0, vWy);
+    const __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(out, out), out);
+    int32_t nValid, nOut;
+    memcpy(&nValid, pValid, sizeof(nValid));
+    nOut = _mm_cvtsi128_si32(bytes) & nValid;
+    memcpy(pOut, &nOut, sizeof(nOut));
+}
+
+SSE42_TARGET void Interpolate(const uint16_t* pIdx, const uint8_t* pValid, size_t nCount,
+                              const uint8_t* pLuts0, const uint8_t* pLuts1, int32_t nWy,
+                              const int32_t* pOff0, const int32_t* pOff1, const int32_t* pWx, uint8_t* pOut)
+{
+    const __m128i vWy = _mm_set1_epi32(nWy);
+    const __m128i vWy0 = _mm_set1_epi32((1 << INTERP_WEIGHT_BITS) - nWy);
+    size_t i = 0;
+    for(;i+4<=nCount;i+=4){
+        Interpolate4(pIdx + i, pValid + i, pLuts0, pLuts1, vWy0, vWy, pOff0 + i, pOff1 + i, pWx + i, pOut + i);
+    }
+    if(i < nCount){
+        // 不足4个像素时复制到临时缓冲区计算，补齐的像素读取颜色表的第一项
+        uint16_t idx[4] = {};
+        uint8_t valid[4] = {}, out[4];
+        int32_t off0[4] = {}, off1[4] = {}, wx[4] = {};
+        const size_t n = nCount - i;
+        memcpy(idx, pIdx + i, n * sizeof(uint16_t));
+        memcpy(valid, pValid + i, n);
+        memcpy(off0, pOff0 + i, n * sizeof(int32_t));
+        memcpy(off1, pOff1 + i, n * sizeof(int32_t));
+        memcpy(wx, pWx + i, n * sizeof(int32_t));
+        Interpolate4(idx, valid, pLuts0, pLuts1, vWy0, vWy, off0, off1, wx, out);
+        memcpy(pOut + i, out, n);
+    }
+}
+
+}
+
+bool FillSSE42Kernels(KernelTable& table)
+{
+    table.mapBand[GDT_Byte] = MapBand<uint8_t>;
+    table.mapBand[GDT_UInt16] = MapBand<uint16_t>;
+    table.mapBand[GDT_Int16] = MapBand<int16_t>;
+    table.mapBand[GDT_Float32] = MapBand<float>;
+    table.mapBand[GDT_Float64] = MapBand<double>;
+    table.interleave = Interleave;
+    table.interpolate = Interpolate;
+    return true;
+}
+
+}
+}
+
+#else
+
+namespace rsisa
+{
+namespace simd
+{
+
+bool FillSSE42Kernels(KernelTable&)
+{
+    return false;
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,168 @@
+﻿#include "threadpool.hpp"
+
+#include <cpl_conv.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+namespace rsisa
+{
+
+namespace
+{
+
+// 当前线程是否正在执行并行任务
+thread_local bool t_bInParallel = false;
+
+struct ParallelScope
+{
+    bool bSaved;
+    ParallelScope() : bSaved(t_bInParallel) { t_bInParallel = true; }
+    ~ParallelScope() { t_bInParallel = bSaved; }
+};
+
+}
+
+struct ThreadPool::Job
+{
+    std::function<void(size_t)> fn;
+    size_t nTasks;
+    std::atomic<size_t> nNext;
+    std::atomic<bool> bFailed;
+    size_t nDone;
+    std::exception_ptr error;       // 第一个任务抛出的异常
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    Job(size_t n, const std::function<void(size_t)>& f)
+        : fn(f), nTasks(n), nNext(0), bFailed(false), nDone(0) {}
+};
+
+ThreadPool::ThreadPool(int nThreads)
+    : m_bStop(false)
+{
+    if(nThreads <= 0){
+        nThreads = DefaultThreadCount();
+    }
+    for(int i=1;i<nThreads;++i){
+        m_workers.push_back(std::thread(&ThreadPool::WorkerMain, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_cond.notify_all();
+    for(size_t i=0;i<m_workers.size();++i){
+        m_workers[i].join();
+    }
+}
+
+ThreadPool& ThreadPool::Global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+int ThreadPool::DefaultThreadCount()
+{
+    const char* pszThreads = CPLGetConfigOption("RSISA_NUM_THREADS", nullptr);
+    if(pszThreads != nullptr && strcmp(pszThreads, "ALL_CPUS") != 0){
+        return std::max(1, atoi(pszThreads));
+    }
+    return std::max(1, CPLGetNumCPUs());
+}
+
+void ThreadPool::RunTasks(Job& job)
+{
+    ParallelScope scope;
+    size_t nRun = 0;
+    for(;;){
+        size_t i = job.nNext.fetch_add(1);
+        if(i >= job.nTasks){ break; }
+        nRun += 1;
+        // 已有任务失败时只计数，不再执行
+        if(job.bFailed.load()){ continue; }
+        try {
+            job.fn(i);
+        }
+        catch(...){
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if(!job.error){
+                job.error = std::current_exception();
+            }
+            job.bFailed.store(true);
+        }
+    }
+    if(nRun > 0){
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.nDone += nRun;
+        if(job.nDone == job.nTasks){
+            job.cond.notify_all();
+        }
+    }
+}
+
+void ThreadPool::WorkerMain()
+{
+    for(;;){
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]{ return m_bStop || !m_jobs.empty(); });
+            if(m_bStop){ return; }
+            job = m_jobs.front();
+            // 任务已经全部领取，从队列中移除
+            if(job->nNext.load() >= job->nTasks){
+                m_jobs.pop_front();
+                continue;
+            }
+        }
+        RunTasks(*job);
+    }
+}
+
+void ThreadPool::ParallelFor(size_t nTasks, const std::function<void(size_t)>& fn)
+{
+    if(nTasks == 0){
+        return;
+    }
+    // 嵌套调用、没有工作线程或只有一个任务时串行执行
+    if(t_bInParallel || m_workers.empty() || nTasks == 1){
+        ParallelScope scope;
+        for(size_t i=0;i<nTasks;++i){
+            fn(i);
+        }
+        return;
+    }
+
+    std::shared_ptr<Job> job = std::make_shared<Job>(nTasks, fn);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(job);
+    }
+    m_cond.notify_all();
+
+    RunTasks(*job);
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->cond.wait(lock, [&job]{ return job->nDone == job->nTasks; });
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::deque<std::shared_ptr<Job> >::iterator it = std::find(m_jobs.begin(), m_jobs.end(), job);
+        if(it != m_jobs.end()){
+            m_jobs.erase(it);
+        }
+    }
+    if(job->error){
+        std::rethrow_exception(job->error);
+    }
+}
+
+}
@@ -0,0 +1,104 @@
+﻿#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rsisa
+{
+
+// 简单的线程池，用于按行条带或分块并行统计和拉伸
+// 调用ParallelFor的线程也参与执行；在并行任务中再次调用ParallelFor时直接串行执行
+class ThreadPool
+{
+public:
+    // nThreads 参与计算的线程总数(包括调用线程)，为0时使用 DefaultThreadCount()
+    explicit ThreadPool(int nThreads = 0);
+    ~ThreadPool();
+
+    int ThreadCount() const { return static_cast<int>(m_workers.size()) + 1; }
+
+    // 并行执行 fn(0) ... fn(nTasks-1)，全部完成后返回
+    // 任务抛出异常时不再执行尚未开始的任务，等待已开始的任务结束后在调用线程重新抛出第一个异常
+    void ParallelFor(size_t nTasks, const std::function<void(size_t)>& fn);
+
+    // 引擎默认使用的线程池
+    static ThreadPool& Global();
+
+    // 默认线程数：配置项RSISA_NUM_THREADS(数字或ALL_CPUS)，默认为CPU核数
+    static int DefaultThreadCount();
+
+private:
+    struct Job;
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void WorkerMain();
+    // 执行任务直到没有可领取的任务为止
+    static void RunTasks(Job& job);
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::shared_ptr<Job> > m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_bStop;
+};
+
+// 并行执行nTasks个任务，每个任务填充一个部分结果，部分结果按任务顺序依次合并
+// 合并顺序固定，因此结果与线程数无关
+// 第i个任务要等到 i < 已合并的个数 + 2*线程数 时才开始，前面的任务较慢时后面的任务不会越积越多，
+// 已完成未合并的部分结果不超过2*线程数个
+// task(i, partial)  计算第i个任务的部分结果
+// merge(partial)    合并一个部分结果(串行调用)
+// task或merge抛出异常时其余任务不再开始，异常在调用线程重新抛出
+template<typename Partial, typename TaskFn, typename MergeFn>
+void ParallelReduce(ThreadPool& pool, size_t nTasks, const Partial& init,
+                    TaskFn task, MergeFn merge)
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::map<size_t, Partial> pending;
+    size_t nNext = 0;
+    bool bFailed = false;
+    const size_t nWindow = static_cast<size_t>(pool.ThreadCount()) * 2;
+    pool.ParallelFor(nTasks, [&](size_t i){
+        // 任务按序号顺序领取，序号为nNext的任务总在执行中，等待的任务最终都能开始
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]{ return bFailed || i < nNext + nWindow; });
+            if(bFailed){ return; }
+        }
+        try {
+            Partial partial(init);
+            task(i, partial);
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.insert(std::make_pair(i, std::move(partial)));
+            // 合并已经连续完成的部分结果
+            for(typename std::map<size_t, Partial>::iterator it = pending.begin();
+                    it != pending.end() && it->first == nNext; it = pending.begin()){
+                merge(it->second);
+                pending.erase(it);
+                nNext += 1;
+            }
+        }
+        catch(...){
+            std::lock_guard<std::mutex> lock(mutex);
+            bFailed = true;
+            cond.notify_all();
+            throw;
+        }
+        cond.notify_all();
+    });
+}
+}
+
+#endif // THREADPOOL_HPP
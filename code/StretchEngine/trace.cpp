@@ -0,0 +1,234 @@
+﻿#include "trace.hpp"
+
+#include <cpl_conv.h>
+#include <cpl_error.h>
+#include <cpl_multiproc.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace rsisa
+{
+
+namespace
+{
+
+// 保存的单条记录个数上限(约40MB)
+const size_t MAX_EVENTS = 1 << 20;
+
+// 一条记录：耗时(nDuration>=0)或计数器的累计值(nDuration<0)
+struct TraceEvent
+{
+    const char* pszName;
+    int64_t nBegin;         // 微秒，从记录开始计时
+    int64_t nDuration;
+    int64_t nValue;
+    int     nThread;
+};
+
+// 一个阶段的汇总
+struct StageTotal
+{
+    int64_t nCount = 0;
+    int64_t nTotal = 0;
+    int64_t nMax = 0;
+};
+
+struct TraceState
+{
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::vector<TraceEvent> events;
+    std::map<std::string, StageTotal> stages;
+    std::map<std::string, int64_t> counters;
+};
+
+TraceState& State()
+{
+    static TraceState state;
+    return state;
+}
+
+// -1表示还没有读取配置项
+std::atomic<int> g_nTraceEnabled(-1);
+
+// 记录线程的编号，按第一次记录的顺序从1开始
+std::atomic<int> g_nThreadCount(0);
+thread_local int t_nThread = 0;
+
+int ThreadNumber()
+{
+    if(t_nThread == 0){
+        t_nThread = ++g_nThreadCount;
+    }
+    return t_nThread;
+}
+
+int64_t NowMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - State().epoch).count();
+}
+
+bool IsJsonFile(const char* pszValue)
+{
+    return EQUAL(CPLGetExtension(pszValue), "json");
+}
+
+// JSON字符串中需要转义的字符(阶段名称都是常量，只处理引号和反斜杠)
+std::string JsonEscape(const char* pszText)
+{
+    std::string osText;
+    for(const char* p=pszText;*p!='\0';++p){
+        if(*p == '"' || *p == '\\'){ osText += '\\'; }
+        osText += *p;
+    }
+    return osText;
+}
+
+}
+
+bool IsTraceEnabled()
+{
+    int nEnabled = g_nTraceEnabled.load(std::memory_order_relaxed);
+    if(nEnabled < 0){
+        const char* pszValue = CPLGetConfigOption("RSISA_TRACE", "NO");
+        nEnabled = (CPLTestBool(pszValue) || IsJsonFile(pszValue))? 1 : 0;
+        g_nTraceEnabled.store(nEnabled);
+    }
+    return nEnabled != 0;
+}
+
+void SetTraceEnabled(bool bEnabled)
+{
+    g_nTraceEnabled.store(bEnabled? 1 : 0);
+}
+
+std::string TraceOutputFile()
+{
+    const char* pszValue = CPLGetConfigOption("RSISA_TRACE", "NO");
+    return IsJsonFile(pszValue)? std::string(pszValue) : std::string();
+}
+
+TraceScope::TraceScope(const char* pszName)
+    : m_pszName(nullptr), m_nBegin(0)
+{
+    if(IsTraceEnabled()){
+        m_pszName = pszName;
+        m_nBegin = NowMicros();
+    }
+}
+
+TraceScope::~TraceScope()
+{
+    if(m_pszName == nullptr){
+        return;
+    }
+    const int64_t nDuration = NowMicros() - m_nBegin;
+    const int nThread = ThreadNumber();
+    TraceState& state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    StageTotal& total = state.stages[m_pszName];
+    total.nCount += 1;
+    total.nTotal += nDuration;
+    total.nMax = std::max(total.nMax, nDuration);
+    if(state.events.size() < MAX_EVENTS){
+        const TraceEvent event = {m_pszName, m_nBegin, nDuration, 0, nThread};
+        state.events.push_back(event);
+    }
+}
+
+void TraceCount(const char* pszName, int64_t nValue)
+{
+    if(!IsTraceEnabled()){
+        return;
+    }
+    const int64_t nNow = NowMicros();
+    const int nThread = ThreadNumber();
+    TraceState& state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    int64_t& nTotal = state.counters[pszName];
+    nTotal += nValue;
+    if(state.events.size() < MAX_EVENTS){
+        const TraceEvent event = {pszName, nNow, -1, nTotal, nThread};
+        state.events.push_back(event);
+    }
+}
+
+std::string TraceSummary()
+{
+    TraceState& state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    // 按总耗时从多到少排列
+    std::vector<std::pair<std::string, StageTotal> > stages(state.stages.begin(), state.stages.end());
+    std::sort(stages.begin(), stages.end(),
+              [](const std::pair<std::string, StageTotal>& a, const std::pair<std::string, StageTotal>& b){
+                  return a.second.nTotal > b.second.nTotal;
+              });
+    std::string osSummary;
+    char szLine[256];
+    snprintf(szLine, sizeof(szLine), "%-24s %10s %12s %12s\n", "stage", "count", "total(ms)", "max(ms)");
+    osSummary += szLine;
+    for(size_t i=0;i<stages.size();++i){
+        const StageTotal& total = stages[i].second;
+        snprintf(szLine, sizeof(szLine), "%-24s %10lld %12.3f %12.3f\n", stages[i].first.c_str(),
+                 static_cast<long long>(total.nCount), total.nTotal / 1000.0, total.nMax / 1000.0);
+        osSummary += szLine;
+    }
+    for(std::map<std::string, int64_t>::const_iterator it = state.counters.begin(); it != state.counters.end(); ++it){
+        snprintf(szLine, sizeof(szLine), "%-24s %10lld\n", it->first.c_str(), static_cast<long long>(it->second));
+        osSummary += szLine;
+    }
+    return osSummary;
+}
+
+bool WriteTraceJson(const char* pszFilename)
+{
+    VSILFILE* fp = VSIFOpenL(pszFilename, "wb");
+    if(fp == nullptr){
+        CPLError(CE_Failure, CPLE_OpenFailed, "Cannot create %s", pszFilename);
+        return false;
+    }
+    const int nPid = static_cast<int>(CPLGetPID());
+    TraceState& state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    bool bOk = VSIFPrintfL(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n") > 0;
+    for(size_t i=0;i<state.events.size() && bOk;++i){
+        const TraceEvent& event = state.events[i];
+        const std::string osName = JsonEscape(event.pszName);
+        if(event.nDuration >= 0){
+            bOk = VSIFPrintfL(fp, "%s{\"name\":\"%s\",\"cat\":\"rsisa\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d}",
+                              i == 0? "" : ",\n", osName.c_str(), static_cast<long long>(event.nBegin),
+                              static_cast<long long>(event.nDuration), nPid, event.nThread) > 0;
+        }
+        else {
+            bOk = VSIFPrintfL(fp, "%s{\"name\":\"%s\",\"cat\":\"rsisa\",\"ph\":\"C\",\"ts\":%lld,\"pid\":%d,\"args\":{\"value\":%lld}}",
+                              i == 0? "" : ",\n", osName.c_str(), static_cast<long long>(event.nBegin),
+                              nPid, static_cast<long long>(event.nValue)) > 0;
+        }
+    }
+    bOk = bOk && VSIFPrintfL(fp, "\n]}\n") > 0;
+    bOk = (VSIFCloseL(fp) == 0) && bOk;
+    if(!bOk){
+        CPLError(CE_Failure, CPLE_FileIO, "Failed to write %s", pszFilename);
+    }
+    return bOk;
+}
+
+void ClearTrace()
+{
+    TraceState& state = State();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.events.clear();
+    state.stages.clear();
+    state.counters.clear();
+}
+
+}
@@ -0,0 +1,54 @@
+﻿#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <string>
+
+// 各处理阶段的耗时和计数记录，用于分析刷新或批量处理慢在哪一步
+// 配置项RSISA_TRACE：为YES时开始记录，为.json文件名时同时指定Chrome trace的输出文件
+// 没有开启时计时器和计数器只读取一个标志，不取时间也不加锁
+// 计时器按阶段(分块、瓦片、波段)记录，不在逐像素循环中使用
+namespace rsisa
+{
+
+// 是否正在记录
+bool IsTraceEnabled();
+
+// 开始或停止记录(覆盖配置项)
+void SetTraceEnabled(bool bEnabled);
+
+// 配置项指定的Chrome trace输出文件，没有指定时为空
+std::string TraceOutputFile();
+
+// 记录一段耗时：构造时开始，析构时结束
+// pszName必须是字符串常量，同名的记录在汇总中合并
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* pszName);
+    ~TraceScope();
+
+private:
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+
+    const char* m_pszName;      // 没有记录时为空
+    int64_t m_nBegin;
+};
+
+// 累加计数器(像素个数、读取字节数、缓存命中次数等)，pszName必须是字符串常量
+void TraceCount(const char* pszName, int64_t nValue = 1);
+
+// 各阶段的次数、总耗时和最长耗时，以及各计数器的总和，每项一行
+std::string TraceSummary();
+
+// 写出Chrome trace JSON(可以用chrome://tracing或Perfetto打开)，失败时返回false
+// 记录超过上限后只更新汇总，不再保存单条记录
+bool WriteTraceJson(const char* pszFilename);
+
+// 清空已有的记录
+void ClearTrace();
+
+}
+
+#endif // TRACE_HPP
@@ -1,53 +1,48 @@
-#-------------------------------------------------
-#
-# Project created by QtCreator 2019-02-27T15:57:58
-#
-#-------------------------------------------------
-
-QT       += core gui
-
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
-
-TARGET = VisualEffect
-TEMPLATE = app
-
-# The following define makes your compiler emit warnings if you use
-# any feature of Qt which has been marked as deprecated (the exact warnings
-# depend on your compiler). Please consult the documentation of the
-# deprecated API in order to know how to port your code away from it.
-DEFINES += QT_DEPRECATED_WARNINGS
-
-# You can also make your code fail to compile if you use deprecated APIs.
-# In order to do so, uncomment the following line.
-# You can also select to disable deprecated APIs only up to a certain version of Qt.
-#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
-
-CONFIG += c++11
-
-SOURCES += \
-        main.cpp \
-        visualeffect.cpp
-
-HEADERS += \
-        visualeffect.hpp
-
-# Default rules for deployment.
-qnx: target.path = /tmp/$${TARGET}/bin
-else: unix:!android: target.path = /opt/$${TARGET}/bin
-!isEmpty(target.path): INSTALLS += target
-
-
-unix:!macx {
-    INCLUDEPATH += $$PWD/3rd/gdal/include
-    LIBS += -L$$PWD -lgdal_i
-}
-else:win32-g++ {
-    INCLUDEPATH += C:/msys64/mingw64/inlude
-    LIBS += -L/mingw64/lib/ -lgdal
-    # 拷贝所需动态库
-    # ldd VisualEffect.exe |grep /mingw64/bin/|awk '{print $3}'|xargs -I{} cp {} ./
-}
-else:win32:!win32-g++ {
-    INCLUDEPATH += $$PWD/3rd/gdal/include
-    LIBS += -L$$PWD/../../ -lgdal_i
-}
+#-------------------------------------------------
+#
+# Project created by QtCreator 2019-02-27T15:57:58
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = VisualEffect
+TEMPLATE = app
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which has been marked as deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# You can also make your code fail to compile if you use deprecated APIs.
+# In order to do so, uncomment the following line.
+# You can also select to disable deprecated APIs only up to a certain version of Qt.
+#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+CONFIG += c++11
+
+SOURCES += \
+        main.cpp \
+        renderjob.cpp \
+        sessioncache.cpp \
+        tilesource.cpp \
+        tileview.cpp \
+        visualeffect.cpp
+
+HEADERS += \
+        renderjob.hpp \
+        sessioncache.hpp \
+        tilesource.hpp \
+        tileview.hpp \
+        visualeffect.hpp
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
+
+
+include(../StretchEngine/stretchengine.pri)
@@ -0,0 +1,343 @@
+﻿#include "renderjob.hpp"
+
+#include <gdal.h>
+#include <cpl_auto_close.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "preview.hpp"
+#include "rasterstream.hpp"
+#include "statscache.hpp"
+#include "trace.hpp"
+
+namespace
+{
+
+// 逐条输出预览时每条的行数
+const int TILE_ROWS = 64;
+
+// 进度回调的参数，dfComplete映射到阶段stage中[dfMin,dfMax]的区间
+struct JobProgress
+{
+    JobNotifier* pNotifier;
+    int nJob;
+    const std::atomic<bool>* pCancelled;
+    QString stage;
+    double dfMin;
+    double dfMax;
+    int nLastPercent;
+};
+
+// GDAL进度回调：百分比变化时发出进度信号，任务被取消时返回FALSE中止处理
+int CPL_STDCALL JobProgressFunc(double dfComplete, const char* /*pszMessage*/, void* pProgressArg)
+{
+    JobProgress* pProgress = static_cast<JobProgress*>(pProgressArg);
+    const double dfStage = pProgress->dfMin + (pProgress->dfMax - pProgress->dfMin) * dfComplete;
+    const int nPercent = std::min(100, std::max(0, static_cast<int>(dfStage * 100)));
+    if(nPercent != pProgress->nLastPercent){
+        pProgress->nLastPercent = nPercent;
+        emit pProgress->pNotifier->progress(pProgress->nJob, pProgress->stage, nPercent);
+    }
+    return *pProgress->pCancelled? FALSE : TRUE;
+}
+
+// 预览数据中从第nYOff行开始的nRows行
+rsisa::BandView RowsOf(const rsisa::BandView& view, int nXSize, int nYOff, int nRows)
+{
+    const size_t nPixelBytes = GDALGetDataTypeSizeBytes(view.eType);
+    rsisa::BandView rows = view;
+    rows.pData = static_cast<const uint8_t*>(view.pData) + static_cast<size_t>(nYOff) * nXSize * nPixelBytes;
+    rows.nCount = static_cast<size_t>(nRows) * nXSize;
+    return rows;
+}
+
+// 与前面的通道是同一波段时返回前面通道的序号，否则返回-1
+int SameBandAs(const RenderRequest& request, int c)
+{
+    for(int p=0;p<c;++p){
+        if(request.bands[p].iBand == request.bands[c].iBand){ return p; }
+    }
+    return -1;
+}
+
+// 同一波段的通道使用相同的数据
+void ShareSameBands(RenderRequest& request)
+{
+    for(int c=1;c<3;++c){
+        const int p = SameBandAs(request, c);
+        if(p >= 0){
+            request.bands[c] = request.bands[p];
+        }
+    }
+}
+
+}
+
+JobNotifier::JobNotifier(QObject* parent)
+    : QObject(parent)
+{
+}
+
+RenderJob::RenderJob(int nJob, const RenderRequest& request, const CancelFlag& cancelled, JobNotifier* pNotifier)
+    : m_nJob(nJob), m_request(request), m_cancelled(cancelled), m_pNotifier(pNotifier)
+{
+}
+
+void RenderJob::run()
+{
+    rsisa::TraceScope scope("render_job");
+    std::shared_ptr<RenderResult> result = std::make_shared<RenderResult>();
+    result->request = m_request;
+    RenderRequest& request = result->request;
+
+    // 只在需要读取数据或统计时打开影像
+    GDALDatasetH hDset = nullptr;
+    CPL_AUTO_CLOSE_WARP(hDset,GDALClose);
+    for(int c=0;c<3;++c){
+        if(request.bands[c].preview && request.bands[c].transform){
+            continue;
+        }
+        hDset = GDALOpen(request.filename.constData(),GA_ReadOnly);
+        if(hDset == nullptr){
+            Fail();
+            return;
+        }
+        break;
+    }
+
+    // 先读取磁盘缓存的统计信息，统计信息齐全时读取预览数据的同时即可输出拉伸结果
+    for(int c=0;c<3;++c){
+        RenderBand& band = request.bands[c];
+        if(band.stats || SameBandAs(request,c) >= 0){
+            continue;
+        }
+        rsisa::BandStats stats;
+        if(rsisa::LoadCachedStats(hDset,band.iBand,request.dfNoData,stats)){
+            band.stats = std::make_shared<rsisa::BandStats>(stats);
+            band.eSource = SessionCache::SS_Full;
+        }
+    }
+    for(int c=0;c<3;++c){
+        RenderBand& band = request.bands[c];
+        if(band.stats && !band.transform){
+            band.transform = std::make_shared<rsisa::StretchTransform>(rsisa::BuildTransform(request.eAlg,*band.stats));
+        }
+    }
+    ShareSameBands(request);
+
+    bool bStretched = false;
+    if(!ReadPreviews(hDset,*result,bStretched) || !ComputeTransforms(hDset,*result)){
+        Fail();
+        return;
+    }
+
+    // 读取预览数据时还没有统计信息的，统计完成后再逐条输出拉伸结果
+    if(!bStretched){
+        for(int nYOff=0;nYOff<request.nBufYSize;nYOff+=TILE_ROWS){
+            if(Cancelled()){
+                Fail();
+                return;
+            }
+            const int nYEnd = std::min(request.nBufYSize, nYOff + TILE_ROWS);
+            RenderRows(request,true,nYOff,nYEnd,result->output.stretched);
+            emit m_pNotifier->progress(m_nJob, QStringLiteral("拉伸"), nYEnd * 100 / request.nBufYSize);
+            emit m_pNotifier->tileReady(m_nJob, nYOff,
+                                        result->output.original.copy(0,nYOff,request.nBufXSize,nYEnd-nYOff),
+                                        result->output.stretched.copy(0,nYOff,request.nBufXSize,nYEnd-nYOff));
+        }
+    }
+    emit m_pNotifier->rendered(m_nJob, result);
+}
+
+bool RenderJob::ReadPreviews(GDALDatasetH hDset, RenderResult& result, bool& bStretched)
+{
+    RenderRequest& request = result.request;
+    bStretched = request.bands[0].transform && request.bands[1].transform && request.bands[2].transform;
+
+    // 为缺少预览数据的波段分配内存，读取的同时逐条显示
+    std::vector<int> missing;
+    std::shared_ptr<SessionCache::PreviewBand> previews[3];
+    for(int c=0;c<3;++c){
+        RenderBand& band = request.bands[c];
+        if(band.preview || SameBandAs(request,c) >= 0){
+            continue;
+        }
+        GDALRasterBandH hBand = GDALGetRasterBand(hDset,band.iBand);
+        if(hBand == nullptr){
+            return false;
+        }
+        previews[c] = std::make_shared<SessionCache::PreviewBand>();
+        rsisa::BandView& view = previews[c]->view;
+        view.eType = rsisa::BufferTypeFor(GDALGetRasterDataType(hBand));
+        view.nCount = static_cast<size_t>(request.nBufXSize) * request.nBufYSize;
+        view.dfNoData = request.dfNoData;
+        previews[c]->data.resize(view.nCount * GDALGetDataTypeSizeBytes(view.eType));
+        view.pData = previews[c]->data.data();
+        band.preview = previews[c];
+        missing.push_back(c);
+    }
+    ShareSameBands(request);
+
+    result.output.original = QImage(request.nBufXSize,request.nBufYSize,QImage::Format_RGBA8888);
+    result.output.stretched = QImage(request.nBufXSize,request.nBufYSize,QImage::Format_RGBA8888);
+    // 像素交叉存储且类型相同的多个波段按波段映射一次读取，否则逐波段读取
+    bool bBandMap = missing.size() > 1 && rsisa::IsPixelInterleaved(hDset);
+    std::vector<int> iMissingBands;
+    for(size_t b=0;b<missing.size();++b){
+        iMissingBands.push_back(request.bands[missing[b]].iBand);
+        bBandMap = bBandMap && previews[missing[b]]->view.eType == previews[missing[0]]->view.eType;
+    }
+    const size_t nReads = bBandMap? 1 : missing.size();
+    std::vector<uint8_t> strip;
+
+    const int nTiles = (request.nBufYSize + TILE_ROWS - 1) / TILE_ROWS;
+    for(int nYOff=0,iTile=0;nYOff<request.nBufYSize;nYOff+=TILE_ROWS,++iTile){
+        const int nYEnd = std::min(request.nBufYSize, nYOff + TILE_ROWS);
+        for(size_t r=0;r<nReads;++r){
+            JobProgress progress = {m_pNotifier, m_nJob, m_cancelled.get(), QStringLiteral("读取预览数据"),
+                                    static_cast<double>(iTile * nReads + r) / (nTiles * nReads),
+                                    static_cast<double>(iTile * nReads + r + 1) / (nTiles * nReads),
+                                    -1};
+            const rsisa::BandView& view = previews[missing[r]]->view;
+            const size_t nRowBytes = static_cast<size_t>(request.nBufXSize) * GDALGetDataTypeSizeBytes(view.eType);
+            const size_t nOffset = nYOff * nRowBytes;
+            const size_t nStripBytes = (nYEnd - nYOff) * nRowBytes;
+            if(!bBandMap){
+                CPLErr err = rsisa::ReadPreviewRows(GDALGetRasterBand(hDset,iMissingBands[r]),
+                                                    request.nBufXSize,request.nBufYSize,nYOff,nYEnd-nYOff,
+                                                    previews[missing[r]]->data.data()+nOffset,
+                                                    JobProgressFunc,&progress);
+                if(err != CE_None){
+                    return false;
+                }
+                continue;
+            }
+            // 各波段的这一段行依次存放在strip中，再复制到各波段的预览数据
+            strip.resize(nStripBytes * missing.size());
+            CPLErr err = rsisa::ReadPreviewRows(hDset,static_cast<int>(iMissingBands.size()),iMissingBands.data(),
+                                                view.eType,request.nBufXSize,request.nBufYSize,nYOff,nYEnd-nYOff,
+                                                strip.data(),JobProgressFunc,&progress);
+            if(err != CE_None){
+                return false;
+            }
+            for(size_t b=0;b<missing.size();++b){
+                memcpy(previews[missing[b]]->data.data()+nOffset,strip.data()+b*nStripBytes,nStripBytes);
+            }
+        }
+        if(Cancelled()){
+            return false;
+        }
+        RenderRows(request,false,nYOff,nYEnd,result.output.original);
+        QImage stretched;
+        if(bStretched){
+            RenderRows(request,true,nYOff,nYEnd,result.output.stretched);
+            stretched = result.output.stretched.copy(0,nYOff,request.nBufXSize,nYEnd-nYOff);
+        }
+        emit m_pNotifier->tileReady(m_nJob, nYOff,
+                                    result.output.original.copy(0,nYOff,request.nBufXSize,nYEnd-nYOff),
+                                    stretched);
+    }
+    return true;
+}
+
+bool RenderJob::ComputeTransforms(GDALDatasetH hDset, RenderResult& result)
+{
+    RenderRequest& request = result.request;
+
+    // 快速预览时在预览数据上统计，否则分块统计全分辨率数据，多个波段在一遍读取中统计
+    std::vector<int> missing;
+    std::vector<int> iBands;
+    for(int c=0;c<3;++c){
+        RenderBand& band = request.bands[c];
+        if(band.stats || SameBandAs(request,c) >= 0){
+            continue;
+        }
+        if(request.bPreviewStats){
+            band.stats = std::make_shared<rsisa::BandStats>(rsisa::ComputeBandStats(band.preview->view));
+            band.eSource = SessionCache::SS_Preview;
+            continue;
+        }
+        missing.push_back(c);
+        iBands.push_back(band.iBand);
+    }
+    if(!missing.empty()){
+        JobProgress progress = {m_pNotifier, m_nJob, m_cancelled.get(), QStringLiteral("统计"), 0.0, 1.0, -1};
+        rsisa::StreamOptions opts;
+        opts.dfNoData = request.dfNoData;
+        opts.pfnProgress = JobProgressFunc;
+        opts.pProgressData = &progress;
+        std::vector<rsisa::BandStats> stats(missing.size());
+        CPLErr err = rsisa::ComputeStreamStats(hDset,iBands.data(),static_cast<int>(iBands.size()),
+                                               opts,stats.data());
+        if(err != CE_None){
+            return false;
+        }
+        for(size_t i=0;i<missing.size();++i){
+            request.bands[missing[i]].stats = std::make_shared<rsisa::BandStats>(stats[i]);
+            request.bands[missing[i]].eSource = SessionCache::SS_Full;
+        }
+    }
+
+    for(int c=0;c<3;++c){
+        RenderBand& band = request.bands[c];
+        if(!band.transform && SameBandAs(request,c) < 0){
+            band.transform = std::make_shared<rsisa::StretchTransform>(rsisa::BuildTransform(request.eAlg,*band.stats));
+        }
+    }
+    ShareSameBands(request);
+    return !Cancelled();
+}
+
+void RenderJob::RenderRows(const RenderRequest& request, bool bStretched, int nYOff, int nYEnd, QImage& image) const
+{
+    rsisa::TraceScope scope(bStretched? "render_stretched" : "render_original");
+    rsisa::BandView views[3];
+    for(int c=0;c<3;++c){
+        views[c] = RowsOf(request.bands[c].preview->view,request.nBufXSize,nYOff,nYEnd-nYOff);
+    }
+    // 原图使用默认的变换(直接截断到0-255)
+    rsisa::StretchTransform identity;
+    const rsisa::StretchTransform* transforms[3];
+    for(int c=0;c<3;++c){
+        transforms[c] = bStretched? request.bands[c].transform.get() : &identity;
+    }
+    rsisa::ApplyStretchRGBA(views,transforms,image.scanLine(nYOff));
+}
+
+void RenderJob::Fail()
+{
+    emit m_pNotifier->failed(m_nJob, Cancelled()? QString() : QString::fromUtf8(CPLGetLastErrorMsg()));
+}
+
+ExportJob::ExportJob(int nJob, const QByteArray& filename, const QString& dstname, const int iBands[3],
+                     rsisa::StretchAlgorithm eAlg, double dfNoData, const CancelFlag& cancelled,
+                     JobNotifier* pNotifier)
+    : m_nJob(nJob), m_filename(filename), m_dstname(dstname), m_eAlg(eAlg), m_dfNoData(dfNoData),
+      m_cancelled(cancelled), m_pNotifier(pNotifier)
+{
+    std::copy(iBands, iBands + 3, m_iBands);
+}
+
+void ExportJob::run()
+{
+    rsisa::TraceScope scope("export_job");
+    GDALDatasetH hDset = GDALOpen(m_filename.constData(),GA_ReadOnly);
+    CPL_AUTO_CLOSE_WARP(hDset,GDALClose);
+    if(hDset == nullptr){
+        emit m_pNotifier->failed(m_nJob, QString::fromUtf8(CPLGetLastErrorMsg()));
+        return;
+    }
+
+    JobProgress progress = {m_pNotifier, m_nJob, m_cancelled.get(), QStringLiteral("导出"), 0.0, 1.0, -1};
+    rsisa::StreamOptions opts;
+    opts.dfNoData = m_dfNoData;
+    opts.pfnProgress = JobProgressFunc;
+    opts.pProgressData = &progress;
+    CPLErr err = rsisa::StretchToGeoTIFF(hDset,m_dstname.toUtf8().constData(),m_iBands,m_eAlg,opts);
+    if(err != CE_None){
+        emit m_pNotifier->failed(m_nJob, *m_cancelled? QString() : QString::fromUtf8(CPLGetLastErrorMsg()));
+        return;
+    }
+    emit m_pNotifier->exported(m_nJob, m_dstname);
+}
@@ -0,0 +1,117 @@
+﻿#ifndef RENDERJOB_HPP
+#define RENDERJOB_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QMetaType>
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+
+#include <atomic>
+#include <memory>
+
+#include "sessioncache.hpp"
+
+// 在后台线程中读取、统计和拉伸，不阻塞界面
+// 任务通过 JobNotifier 的信号报告进度、逐条输出的部分结果和最终结果，信号带有任务编号，
+// 界面只处理当前任务的信号；取消标志置位后任务在下一次进度回调时中止
+
+// 一个显示波段的数据，界面线程填入会话缓存中已有的部分，其余由后台任务补齐
+struct RenderBand
+{
+    int iBand = 0;
+    SessionCache::PreviewPtr preview;           // 预览数据
+    SessionCache::StatsPtr stats;               // 统计信息
+    SessionCache::StatsSource eSource = SessionCache::SS_Full;  // stats的来源
+    SessionCache::TransformPtr transform;       // 拉伸变换
+};
+
+// 刷新显示的参数
+struct RenderRequest
+{
+    QByteArray filename;        // UTF-8文件名
+    rsisa::StretchAlgorithm eAlg = rsisa::SA_None;
+    bool bPreviewStats = true;  // 允许在预览数据上统计
+    double dfNoData = 0.0;
+    int nBufXSize = 0;          // 预览大小
+    int nBufYSize = 0;
+    RenderBand bands[3];
+};
+
+// 刷新显示的结果，由界面线程存入会话缓存
+struct RenderResult
+{
+    RenderRequest request;      // 各波段的数据已经补齐
+    SessionCache::Output output;
+};
+
+typedef std::shared_ptr<const RenderResult> RenderResultPtr;
+Q_DECLARE_METATYPE(RenderResultPtr)
+
+typedef std::shared_ptr<std::atomic<bool> > CancelFlag;
+
+// 后台任务的信号，对象属于界面线程，任务在工作线程中发出信号，由队列连接送到界面线程
+class JobNotifier : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit JobNotifier(QObject* parent = nullptr);
+
+signals:
+    // 阶段stage完成了nPercent%
+    void progress(int nJob, const QString& stage, int nPercent);
+    // 预览的第nYOff行起的一条已经完成，stretched在统计完成前为空
+    void tileReady(int nJob, int nYOff, const QImage& original, const QImage& stretched);
+    void rendered(int nJob, const RenderResultPtr& result);
+    void exported(int nJob, const QString& dstname);
+    // 失败或被取消，取消时message为空
+    void failed(int nJob, const QString& message);
+};
+
+// 读取预览数据、统计并拉伸
+class RenderJob : public QRunnable
+{
+public:
+    RenderJob(int nJob, const RenderRequest& request, const CancelFlag& cancelled, JobNotifier* pNotifier);
+
+    void run() override;
+
+private:
+    bool Cancelled() const { return *m_cancelled; }
+    // 读取缺少的预览数据，逐条输出原图(统计信息齐全时也输出拉伸结果)
+    bool ReadPreviews(GDALDatasetH hDset, RenderResult& result, bool& bStretched);
+    // 补齐统计信息和拉伸变换
+    bool ComputeTransforms(GDALDatasetH hDset, RenderResult& result);
+    // 按条拉伸预览的[nYOff,nYEnd)行到image中
+    void RenderRows(const RenderRequest& request, bool bStretched, int nYOff, int nYEnd, QImage& image) const;
+    void Fail();
+
+    int m_nJob;
+    RenderRequest m_request;
+    CancelFlag m_cancelled;
+    JobNotifier* m_pNotifier;
+};
+
+// 导出拉伸结果(分块统计和拉伸，见 rsisa::StretchToGeoTIFF)
+class ExportJob : public QRunnable
+{
+public:
+    ExportJob(int nJob, const QByteArray& filename, const QString& dstname, const int iBands[3],
+              rsisa::StretchAlgorithm eAlg, double dfNoData, const CancelFlag& cancelled, JobNotifier* pNotifier);
+
+    void run() override;
+
+private:
+    int m_nJob;
+    QByteArray m_filename;
+    QString m_dstname;
+    int m_iBands[3];
+    rsisa::StretchAlgorithm m_eAlg;
+    double m_dfNoData;
+    CancelFlag m_cancelled;
+    JobNotifier* m_pNotifier;
+};
+
+#endif // RENDERJOB_HPP
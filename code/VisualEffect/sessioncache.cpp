@@ -0,0 +1,167 @@
+﻿#include "sessioncache.hpp"
+
+#include <cpl_conv.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+
+// 最多缓存的输出图像个数，超过时清空后重新缓存
+const size_t MAX_OUTPUTS = 16;
+
+// 至少保留的预览波段个数(当前显示的RGB波段)
+const size_t MIN_PREVIEWS = 3;
+
+}
+
+bool SessionCache::OutputKey::operator<(const OutputKey& other) const
+{
+    for(int c=0;c<3;++c){
+        if(iBands[c] != other.iBands[c]){ return iBands[c] < other.iBands[c]; }
+    }
+    if(eAlg != other.eAlg){ return eAlg < other.eAlg; }
+    return bPreviewStats < other.bPreviewStats;
+}
+
+SessionCache::SessionCache()
+    : m_dfNoData(std::numeric_limits<double>::quiet_NaN()),
+      m_nPreviewXSize(0), m_nPreviewYSize(0), m_nPreviewBytes(0)
+{
+    const int nBudgetMB = atoi(CPLGetConfigOption("RSISA_BAND_CACHE_MB", "256"));
+    m_nPreviewBudget = static_cast<size_t>(std::max(1, nBudgetMB)) * 1024 * 1024;
+}
+
+void SessionCache::Reset(const QString& filename, double dfNoData)
+{
+    // 无效值按位比较，NaN也能与上次相同
+    if(filename == m_filename && memcmp(&dfNoData, &m_dfNoData, sizeof(double)) == 0){
+        return;
+    }
+    Clear();
+    m_filename = filename;
+    m_dfNoData = dfNoData;
+}
+
+void SessionCache::Clear()
+{
+    m_filename.clear();
+    m_dfNoData = std::numeric_limits<double>::quiet_NaN();
+    m_nPreviewXSize = 0;
+    m_nPreviewYSize = 0;
+    m_bands.clear();
+    m_outputs.clear();
+    m_previewLru.clear();
+    m_nPreviewBytes = 0;
+}
+
+void SessionCache::SetPreviewSize(int nXSize, int nYSize)
+{
+    if(nXSize == m_nPreviewXSize && nYSize == m_nPreviewYSize){
+        return;
+    }
+    // 预览大小改变时已有的预览数据、预览统计和输出图像都不能再用
+    m_nPreviewXSize = nXSize;
+    m_nPreviewYSize = nYSize;
+    for(std::map<int, BandEntry>::iterator it=m_bands.begin();it!=m_bands.end();++it){
+        it->second.preview.reset();
+        it->second.stats[SS_Preview].reset();
+        it->second.transforms[SS_Preview].clear();
+    }
+    m_outputs.clear();
+    m_previewLru.clear();
+    m_nPreviewBytes = 0;
+}
+
+SessionCache::PreviewPtr SessionCache::FindPreview(int iBand)
+{
+    std::map<int, BandEntry>::const_iterator it = m_bands.find(iBand);
+    if(it == m_bands.end() || !it->second.preview){
+        return PreviewPtr();
+    }
+    TouchPreview(iBand);
+    return it->second.preview;
+}
+
+void SessionCache::InsertPreview(int iBand, const PreviewPtr& preview)
+{
+    PreviewPtr& entry = m_bands[iBand].preview;
+    if(entry){
+        m_nPreviewBytes -= entry->data.size();
+    }
+    entry = preview;
+    m_nPreviewBytes += preview->data.size();
+    TouchPreview(iBand);
+    EvictPreviews();
+}
+
+void SessionCache::TouchPreview(int iBand)
+{
+    std::list<int>::iterator it = std::find(m_previewLru.begin(), m_previewLru.end(), iBand);
+    if(it != m_previewLru.end()){
+        m_previewLru.splice(m_previewLru.begin(), m_previewLru, it);
+    }
+    else {
+        m_previewLru.push_front(iBand);
+    }
+}
+
+void SessionCache::EvictPreviews()
+{
+    // 后台任务或输出图像仍在使用的数据由共享指针保持有效
+    while(m_nPreviewBytes > m_nPreviewBudget && m_previewLru.size() > MIN_PREVIEWS){
+        PreviewPtr& preview = m_bands[m_previewLru.back()].preview;
+        m_nPreviewBytes -= preview->data.size();
+        preview.reset();
+        m_previewLru.pop_back();
+    }
+}
+
+SessionCache::StatsPtr SessionCache::FindStats(int iBand, StatsSource eSource) const
+{
+    std::map<int, BandEntry>::const_iterator it = m_bands.find(iBand);
+    return (it == m_bands.end())? StatsPtr() : it->second.stats[eSource];
+}
+
+void SessionCache::InsertStats(int iBand, StatsSource eSource, const StatsPtr& stats)
+{
+    BandEntry& entry = m_bands[iBand];
+    entry.stats[eSource] = stats;
+    entry.transforms[eSource].clear();
+}
+
+SessionCache::TransformPtr SessionCache::Transform(int iBand, StatsSource eSource, rsisa::StretchAlgorithm eAlg)
+{
+    std::map<int, BandEntry>::iterator it = m_bands.find(iBand);
+    if(it == m_bands.end() || !it->second.stats[eSource]){
+        return TransformPtr();
+    }
+    TransformPtr& transform = it->second.transforms[eSource][eAlg];
+    if(!transform){
+        transform = std::make_shared<rsisa::StretchTransform>(rsisa::BuildTransform(eAlg, *it->second.stats[eSource]));
+    }
+    return transform;
+}
+
+void SessionCache::InsertTransform(int iBand, StatsSource eSource, rsisa::StretchAlgorithm eAlg,
+                                   const TransformPtr& transform)
+{
+    m_bands[iBand].transforms[eSource][eAlg] = transform;
+}
+
+const SessionCache::Output* SessionCache::FindOutput(const OutputKey& key) const
+{
+    std::map<OutputKey, Output>::const_iterator it = m_outputs.find(key);
+    return (it == m_outputs.end())? nullptr : &it->second;
+}
+
+void SessionCache::InsertOutput(const OutputKey& key, const Output& output)
+{
+    if(m_outputs.size() >= MAX_OUTPUTS){
+        m_outputs.clear();
+    }
+    m_outputs[key] = output;
+}
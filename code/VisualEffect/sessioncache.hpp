@@ -0,0 +1,113 @@
+﻿#ifndef SESSIONCACHE_HPP
+#define SESSIONCACHE_HPP
+
+#include <QImage>
+#include <QString>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "stretchengine.hpp"
+
+// 当前影像在本次运行中的缓存
+// 保存各波段的预览数据、统计信息、各算法的拉伸变换和最近的输出图像，
+// 切换算法或调换RGB波段时只需重新拉伸，输出已缓存时不需要任何计算
+// 影像或无效值改变时全部清空
+// 预览数据按最近使用顺序淘汰，总量不超过配置项RSISA_BAND_CACHE_MB(默认256MB)，
+// 浏览多波段影像时只保留最近显示过的波段；统计信息和拉伸变换较小，不淘汰
+// 缓存的数据不再修改，以共享指针交给后台任务使用，清空缓存时后台任务持有的数据仍然有效
+// 只在界面线程中访问
+class SessionCache
+{
+public:
+    // 统计信息的来源
+    enum StatsSource
+    {
+        SS_Preview = 0,     // 在预览数据上统计
+        SS_Full             // 全分辨率统计
+    };
+
+    // 输出图像的键
+    struct OutputKey
+    {
+        int iBands[3];
+        rsisa::StretchAlgorithm eAlg;
+        bool bPreviewStats;
+
+        bool operator<(const OutputKey& other) const;
+    };
+
+    // 原图和拉伸结果
+    struct Output
+    {
+        QImage original;
+        QImage stretched;
+    };
+
+    // 一个波段的预览数据
+    struct PreviewBand
+    {
+        std::vector<uint8_t> data;
+        rsisa::BandView view;       // 指向data
+    };
+
+    typedef std::shared_ptr<const PreviewBand> PreviewPtr;
+    typedef std::shared_ptr<const rsisa::BandStats> StatsPtr;
+    typedef std::shared_ptr<const rsisa::StretchTransform> TransformPtr;
+
+    SessionCache();
+
+    // 切换到影像filename和无效值dfNoData，与当前不同时清空缓存
+    void Reset(const QString& filename, double dfNoData);
+    // 清空缓存(影像文件可能已被修改)
+    void Clear();
+
+    // 预览大小，没有预览数据时为0
+    int PreviewXSize() const { return m_nPreviewXSize; }
+    int PreviewYSize() const { return m_nPreviewYSize; }
+    void SetPreviewSize(int nXSize, int nYSize);
+
+    // 波段的预览数据，没有缓存时返回空指针；找到时记为最近使用
+    PreviewPtr FindPreview(int iBand);
+    // 保存预览数据，超过内存上限时淘汰最久未使用的波段(至少保留最近的三个波段)
+    void InsertPreview(int iBand, const PreviewPtr& preview);
+
+    // 波段的统计信息，没有缓存时返回空指针
+    StatsPtr FindStats(int iBand, StatsSource eSource) const;
+    void InsertStats(int iBand, StatsSource eSource, const StatsPtr& stats);
+
+    // 波段按eAlg拉伸的变换，第一次使用时由已缓存的统计信息生成
+    // 该波段没有eSource的统计信息时返回空指针
+    TransformPtr Transform(int iBand, StatsSource eSource, rsisa::StretchAlgorithm eAlg);
+    // 保存后台任务生成的变换
+    void InsertTransform(int iBand, StatsSource eSource, rsisa::StretchAlgorithm eAlg, const TransformPtr& transform);
+
+    // 缓存的输出图像，没有时返回nullptr
+    const Output* FindOutput(const OutputKey& key) const;
+    void InsertOutput(const OutputKey& key, const Output& output);
+
+private:
+    void TouchPreview(int iBand);
+    void EvictPreviews();
+
+    struct BandEntry
+    {
+        PreviewPtr preview;
+        StatsPtr stats[2];
+        std::map<rsisa::StretchAlgorithm, TransformPtr> transforms[2];
+    };
+
+    QString m_filename;
+    double  m_dfNoData;
+    int     m_nPreviewXSize;
+    int     m_nPreviewYSize;
+    std::map<int, BandEntry> m_bands;
+    std::map<OutputKey, Output> m_outputs;
+    std::list<int> m_previewLru;    // 有预览数据的波段，最近使用的在前
+    size_t  m_nPreviewBytes;        // 预览数据占用的内存
+    size_t  m_nPreviewBudget;       // 预览数据的内存上限
+};
+
+#endif // SESSIONCACHE_HPP
@@ -0,0 +1,151 @@
+﻿#include "tilesource.hpp"
+
+#include <gdal.h>
+
+#include <algorithm>
+
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+namespace
+{
+
+// 瓦片已在多个线程中并行渲染，单个瓦片内串行拉伸
+rsisa::ThreadPool& SerialPool()
+{
+    static rsisa::ThreadPool pool(1);
+    return pool;
+}
+
+}
+
+bool TileKey::operator<(const TileKey& other) const
+{
+    if(nSource != other.nSource){ return nSource < other.nSource; }
+    if(nLevel != other.nLevel){ return nLevel < other.nLevel; }
+    if(nY != other.nY){ return nY < other.nY; }
+    return nX < other.nX;
+}
+
+bool TileKey::operator==(const TileKey& other) const
+{
+    return nSource == other.nSource && nLevel == other.nLevel && nX == other.nX && nY == other.nY;
+}
+
+TileSource::TileSource(int nId, const QByteArray& filename, int nXSize, int nYSize, const int iBands[3],
+                       double dfNoData, const SessionCache::TransformPtr transforms[3])
+    : m_nId(nId), m_filename(filename), m_nXSize(nXSize), m_nYSize(nYSize), m_nLevels(1),
+      m_dfNoData(dfNoData)
+{
+    for(int c=0;c<3;++c){
+        m_iBands[c] = iBands[c];
+        m_transforms[c] = transforms[c];
+    }
+    while(std::max(m_nXSize, m_nYSize) > (TILE_SIZE << (m_nLevels - 1))){
+        m_nLevels += 1;
+    }
+}
+
+TileSource::~TileSource()
+{
+    for(size_t i=0;i<m_datasets.size();++i){
+        GDALClose(m_datasets[i]);
+    }
+}
+
+int TileSource::TileColumns(int nLevel) const
+{
+    const int nTileSpan = TILE_SIZE << nLevel;
+    return (m_nXSize + nTileSpan - 1) / nTileSpan;
+}
+
+int TileSource::TileRows(int nLevel) const
+{
+    const int nTileSpan = TILE_SIZE << nLevel;
+    return (m_nYSize + nTileSpan - 1) / nTileSpan;
+}
+
+void TileSource::TileWindow(int nLevel, int nX, int nY, int& nXOff, int& nYOff, int& nXSize, int& nYSize) const
+{
+    const int nTileSpan = TILE_SIZE << nLevel;
+    nXOff = nX * nTileSpan;
+    nYOff = nY * nTileSpan;
+    nXSize = std::min(nTileSpan, m_nXSize - nXOff);
+    nYSize = std::min(nTileSpan, m_nYSize - nYOff);
+}
+
+bool TileSource::Render(int nLevel, int nX, int nY, Tile& tile) const
+{
+    rsisa::TraceScope scope("tile_render");
+    int nXOff = 0, nYOff = 0, nWinXSize = 0, nWinYSize = 0;
+    TileWindow(nLevel, nX, nY, nXOff, nYOff, nWinXSize, nWinYSize);
+    if(nWinXSize <= 0 || nWinYSize <= 0){
+        return false;
+    }
+    const int nScale = 1 << nLevel;
+    const int nBufXSize = (nWinXSize + nScale - 1) / nScale;
+    const int nBufYSize = (nWinYSize + nScale - 1) / nScale;
+    const size_t nCount = static_cast<size_t>(nBufXSize) * nBufYSize;
+
+    GDALDatasetH hDset = AcquireDataset();
+    if(hDset == nullptr){
+        return false;
+    }
+    // 缩小读取时GDAL自动使用合适的概览
+    std::vector<uint8_t> buffers[3];
+    rsisa::BandView views[3];
+    CPLErr err = CE_None;
+    for(int c=0;c<3 && err == CE_None;++c){
+        const int iSame = static_cast<int>(std::find(m_iBands, m_iBands + c, m_iBands[c]) - m_iBands);
+        if(iSame < c){
+            views[c] = views[iSame];
+            continue;
+        }
+        GDALRasterBandH hBand = GDALGetRasterBand(hDset, m_iBands[c]);
+        if(hBand == nullptr){
+            err = CE_Failure;
+            break;
+        }
+        const GDALDataType eType = rsisa::BufferTypeFor(GDALGetRasterDataType(hBand));
+        buffers[c].resize(nCount * GDALGetDataTypeSizeBytes(eType));
+        err = GDALRasterIO(hBand, GF_Read, nXOff, nYOff, nWinXSize, nWinYSize,
+                           buffers[c].data(), nBufXSize, nBufYSize, eType, 0, 0);
+        views[c].pData = buffers[c].data();
+        views[c].eType = eType;
+        views[c].nCount = nCount;
+        views[c].dfNoData = m_dfNoData;
+    }
+    ReleaseDataset(hDset);
+    if(err != CE_None){
+        return false;
+    }
+    rsisa::TraceCount("tile_pixels", static_cast<int64_t>(nCount));
+
+    rsisa::StretchTransform identity;
+    const rsisa::StretchTransform* originals[3] = {&identity, &identity, &identity};
+    const rsisa::StretchTransform* transforms[3] = {m_transforms[0].get(), m_transforms[1].get(), m_transforms[2].get()};
+    tile.original = QImage(nBufXSize, nBufYSize, QImage::Format_RGBA8888);
+    tile.stretched = QImage(nBufXSize, nBufYSize, QImage::Format_RGBA8888);
+    rsisa::ApplyStretchRGBA(views, originals, tile.original.bits(), &SerialPool());
+    rsisa::ApplyStretchRGBA(views, transforms, tile.stretched.bits(), &SerialPool());
+    return true;
+}
+
+GDALDatasetH TileSource::AcquireDataset() const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(!m_datasets.empty()){
+            GDALDatasetH hDset = m_datasets.back();
+            m_datasets.pop_back();
+            return hDset;
+        }
+    }
+    return GDALOpen(m_filename.constData(), GA_ReadOnly);
+}
+
+void TileSource::ReleaseDataset(GDALDatasetH hDset) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_datasets.push_back(hDset);
+}
@@ -0,0 +1,86 @@
+﻿#ifndef TILESOURCE_HPP
+#define TILESOURCE_HPP
+
+#include <QByteArray>
+#include <QImage>
+#include <QMetaType>
+
+#include <mutex>
+#include <vector>
+
+#include "sessioncache.hpp"
+
+// 按瓦片渲染影像，用于任意缩放级别的显示
+// 第nLevel级每个瓦片像素对应原影像2^nLevel*2^nLevel个像素，第0级为原分辨率
+// 瓦片按行列编号，每个瓦片TILE_SIZE*TILE_SIZE像素，右侧和下侧边缘的瓦片可能更小
+
+// 瓦片的键，nSource区分不同的渲染参数(影像、波段、算法、无效值)
+struct TileKey
+{
+    int nSource;
+    int nLevel;
+    int nX;
+    int nY;
+
+    bool operator<(const TileKey& other) const;
+    bool operator==(const TileKey& other) const;
+};
+
+// 瓦片的原图和拉伸结果
+struct Tile
+{
+    QImage original;
+    QImage stretched;
+};
+
+Q_DECLARE_METATYPE(TileKey)
+Q_DECLARE_METATYPE(Tile)
+
+// 一组渲染参数下的瓦片渲染器，可在多个线程中同时渲染
+// 拉伸变换来自整幅影像的统计信息，各瓦片的拉伸结果一致
+class TileSource
+{
+public:
+    static const int TILE_SIZE = 256;
+
+    TileSource(int nId, const QByteArray& filename, int nXSize, int nYSize, const int iBands[3],
+               double dfNoData, const SessionCache::TransformPtr transforms[3]);
+    ~TileSource();
+
+    int Id() const { return m_nId; }
+    int XSize() const { return m_nXSize; }
+    int YSize() const { return m_nYSize; }
+
+    // 级别个数，最粗一级的整幅影像不超过一个瓦片
+    int LevelCount() const { return m_nLevels; }
+    // 第nLevel级的瓦片列数和行数
+    int TileColumns(int nLevel) const;
+    int TileRows(int nLevel) const;
+    // 瓦片在原影像上的范围
+    void TileWindow(int nLevel, int nX, int nY, int& nXOff, int& nYOff, int& nXSize, int& nYSize) const;
+
+    // 渲染一个瓦片(线程安全)，读取失败时返回false
+    bool Render(int nLevel, int nX, int nY, Tile& tile) const;
+
+private:
+    TileSource(const TileSource&);
+    TileSource& operator=(const TileSource&);
+
+    // 每个渲染线程使用单独打开的数据集，用完后留给之后的瓦片
+    GDALDatasetH AcquireDataset() const;
+    void ReleaseDataset(GDALDatasetH hDset) const;
+
+    int m_nId;
+    QByteArray m_filename;
+    int m_nXSize;
+    int m_nYSize;
+    int m_nLevels;
+    int m_iBands[3];
+    double m_dfNoData;
+    SessionCache::TransformPtr m_transforms[3];
+
+    mutable std::mutex m_mutex;
+    mutable std::vector<GDALDatasetH> m_datasets;   // 空闲的数据集
+};
+
+#endif // TILESOURCE_HPP
@@ -0,0 +1,380 @@
+﻿#include "tileview.hpp"
+
+#include <cpl_conv.h>
+
+#include <QMouseEvent>
+#include <QPainter>
+#include <QWheelEvent>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "trace.hpp"
+
+namespace
+{
+
+// 最大放大倍数(显示像素/影像像素)
+const double MAX_SCALE = 16.0;
+
+// 瓦片占用的内存
+size_t TileBytes(const Tile& tile)
+{
+    return static_cast<size_t>(tile.original.width()) * tile.original.height() * 4 * 2;
+}
+
+}
+
+// 后台渲染线程：依次取出队列中的瓦片渲染，队列为空时结束
+class TileScene::Worker : public QRunnable
+{
+public:
+    explicit Worker(TileScene* pScene) : m_pScene(pScene) {}
+
+    void run() override
+    {
+        for(;;){
+            TileKey key;
+            std::shared_ptr<const TileSource> source;
+            {
+                std::lock_guard<std::mutex> lock(m_pScene->m_mutex);
+                if(m_pScene->m_queue.empty()){
+                    m_pScene->m_nWorkers -= 1;
+                    return;
+                }
+                key = m_pScene->m_queue.front();
+                m_pScene->m_queue.pop_front();
+                source = m_pScene->m_source;
+                if(!source || source->Id() != key.nSource){
+                    continue;
+                }
+                m_pScene->m_rendering.insert(key);
+            }
+            Tile tile;
+            if(source->Render(key.nLevel, key.nX, key.nY, tile)){
+                emit m_pScene->tileRendered(key, tile);
+            }
+            std::lock_guard<std::mutex> lock(m_pScene->m_mutex);
+            m_pScene->m_rendering.erase(key);
+        }
+    }
+
+private:
+    TileScene* m_pScene;
+};
+
+TileScene::TileScene(QObject* parent)
+    : QObject(parent),
+      m_nXSize(0), m_nYSize(0), m_dfScale(1.0), m_dfCenterX(0.0), m_dfCenterY(0.0),
+      m_nSourceCount(0), m_nTileBytes(0), m_nWorkers(0)
+{
+    qRegisterMetaType<TileKey>("TileKey");
+    qRegisterMetaType<Tile>("Tile");
+    const int nBudgetMB = atoi(CPLGetConfigOption("RSISA_TILE_CACHE_MB", "256"));
+    m_nTileBudget = static_cast<size_t>(std::max(1, nBudgetMB)) * 1024 * 1024;
+    connect(this,&TileScene::tileRendered,this,&TileScene::OnTileRendered,Qt::QueuedConnection);
+}
+
+TileScene::~TileScene()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.clear();
+    }
+    m_pool.waitForDone();
+}
+
+void TileScene::Reset(int nXSize, int nYSize)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_source.reset();
+        m_queue.clear();
+    }
+    m_tiles.clear();
+    m_lru.clear();
+    m_nTileBytes = 0;
+    m_previewOriginal = QImage();
+    m_previewStretched = QImage();
+    m_nXSize = nXSize;
+    m_nYSize = nYSize;
+    FitToView();
+}
+
+void TileScene::SetPreview(const QImage& original, const QImage& stretched)
+{
+    m_previewOriginal = original;
+    m_previewStretched = stretched;
+    emit changed();
+}
+
+void TileScene::SetSource(const std::shared_ptr<const TileSource>& source)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_source = source;
+        m_queue.clear();
+    }
+    UpdateRequests();
+    emit changed();
+}
+
+void TileScene::SetViewSize(int iView, const QSize& size)
+{
+    const bool bFirst = m_viewSizes[0].isEmpty() && m_viewSizes[1].isEmpty();
+    m_viewSizes[iView] = size;
+    if(bFirst){
+        FitToView();
+        return;
+    }
+    UpdateRequests();
+    emit changed();
+}
+
+void TileScene::Pan(double dfDX, double dfDY)
+{
+    m_dfCenterX += dfDX / m_dfScale;
+    m_dfCenterY += dfDY / m_dfScale;
+    m_dfCenterX = std::min(std::max(m_dfCenterX, 0.0), static_cast<double>(m_nXSize));
+    m_dfCenterY = std::min(std::max(m_dfCenterY, 0.0), static_cast<double>(m_nYSize));
+    UpdateRequests();
+    emit changed();
+}
+
+void TileScene::Zoom(double dfFactor, const QPoint& anchor, const QSize& viewSize)
+{
+    if(m_nXSize == 0 || m_nYSize == 0){
+        return;
+    }
+    // 缩小到整幅影像占视图的一半为止
+    const double dfFit = std::min(static_cast<double>(viewSize.width()) / m_nXSize,
+                                  static_cast<double>(viewSize.height()) / m_nYSize);
+    const double dfScale = std::min(std::max(m_dfScale * dfFactor, dfFit / 2), MAX_SCALE);
+    // 缩放前后anchor处的影像坐标不变
+    const double dfAnchorX = anchor.x() - viewSize.width() / 2.0;
+    const double dfAnchorY = anchor.y() - viewSize.height() / 2.0;
+    const double dfX = m_dfCenterX + dfAnchorX / m_dfScale;
+    const double dfY = m_dfCenterY + dfAnchorY / m_dfScale;
+    m_dfScale = dfScale;
+    m_dfCenterX = dfX - dfAnchorX / m_dfScale;
+    m_dfCenterY = dfY - dfAnchorY / m_dfScale;
+    UpdateRequests();
+    emit changed();
+}
+
+void TileScene::FitToView()
+{
+    m_dfCenterX = m_nXSize / 2.0;
+    m_dfCenterY = m_nYSize / 2.0;
+    const QSize viewSize = m_viewSizes[0].expandedTo(m_viewSizes[1]);
+    if(m_nXSize > 0 && m_nYSize > 0 && !viewSize.isEmpty()){
+        m_dfScale = std::min(static_cast<double>(viewSize.width()) / m_nXSize,
+                             static_cast<double>(viewSize.height()) / m_nYSize);
+    }
+    UpdateRequests();
+    emit changed();
+}
+
+int TileScene::CurrentLevel() const
+{
+    if(!m_source || m_dfScale >= 1.0){
+        return 0;
+    }
+    const int nLevel = static_cast<int>(std::floor(std::log2(1.0 / m_dfScale)));
+    return std::min(nLevel, m_source->LevelCount() - 1);
+}
+
+bool TileScene::VisibleTiles(int nLevel, int nMargin, int& nX0, int& nY0, int& nX1, int& nY1) const
+{
+    const QSize viewSize = m_viewSizes[0].expandedTo(m_viewSizes[1]);
+    if(!m_source || viewSize.isEmpty()){
+        return false;
+    }
+    const double dfSpan = static_cast<double>(TileSource::TILE_SIZE << nLevel);
+    const double dfHalfX = viewSize.width() / (2 * m_dfScale);
+    const double dfHalfY = viewSize.height() / (2 * m_dfScale);
+    nX0 = std::max(0, static_cast<int>(std::floor((m_dfCenterX - dfHalfX) / dfSpan)) - nMargin);
+    nY0 = std::max(0, static_cast<int>(std::floor((m_dfCenterY - dfHalfY) / dfSpan)) - nMargin);
+    nX1 = std::min(m_source->TileColumns(nLevel) - 1, static_cast<int>(std::floor((m_dfCenterX + dfHalfX) / dfSpan)) + nMargin);
+    nY1 = std::min(m_source->TileRows(nLevel) - 1, static_cast<int>(std::floor((m_dfCenterY + dfHalfY) / dfSpan)) + nMargin);
+    return nX0 <= nX1 && nY0 <= nY1;
+}
+
+QRectF TileScene::ViewRect(double dfX, double dfY, double dfXSize, double dfYSize, const QSize& viewSize) const
+{
+    return QRectF((dfX - m_dfCenterX) * m_dfScale + viewSize.width() / 2.0,
+                  (dfY - m_dfCenterY) * m_dfScale + viewSize.height() / 2.0,
+                  dfXSize * m_dfScale, dfYSize * m_dfScale);
+}
+
+const Tile* TileScene::FindTile(const TileKey& key) const
+{
+    std::map<TileKey, TileEntry>::const_iterator it = m_tiles.find(key);
+    return (it == m_tiles.end())? nullptr : &it->second.tile;
+}
+
+void TileScene::InsertTile(const TileKey& key, const Tile& tile)
+{
+    if(m_tiles.count(key) != 0){
+        return;
+    }
+    m_lru.push_front(key);
+    TileEntry& entry = m_tiles[key];
+    entry.tile = tile;
+    entry.itLru = m_lru.begin();
+    m_nTileBytes += TileBytes(tile);
+    while(m_nTileBytes > m_nTileBudget && m_lru.size() > 1){
+        std::map<TileKey, TileEntry>::iterator it = m_tiles.find(m_lru.back());
+        m_nTileBytes -= TileBytes(it->second.tile);
+        m_tiles.erase(it);
+        m_lru.pop_back();
+    }
+}
+
+void TileScene::UpdateRequests()
+{
+    const int nLevel = CurrentLevel();
+    int nX0 = 0, nY0 = 0, nX1 = -1, nY1 = -1;
+    if(!VisibleTiles(nLevel, 1, nX0, nY0, nX1, nY1)){
+        return;
+    }
+    const int nSource = m_source->Id();
+
+    // 可见瓦片在前，周围一圈预取的瓦片在后，各自按离视口中心由近到远排列
+    int nVisX0 = 0, nVisY0 = 0, nVisX1 = -1, nVisY1 = -1;
+    VisibleTiles(nLevel, 0, nVisX0, nVisY0, nVisX1, nVisY1);
+    const double dfSpan = static_cast<double>(TileSource::TILE_SIZE << nLevel);
+    std::vector<std::pair<double, TileKey> > wanted;
+    for(int y=nY0;y<=nY1;++y){
+        for(int x=nX0;x<=nX1;++x){
+            const TileKey key = {nSource, nLevel, x, y};
+            std::map<TileKey, TileEntry>::iterator it = m_tiles.find(key);
+            if(it != m_tiles.end()){
+                // 可见的瓦片记为最近使用
+                m_lru.splice(m_lru.begin(), m_lru, it->second.itLru);
+                rsisa::TraceCount("tile_cache_hit");
+                continue;
+            }
+            rsisa::TraceCount("tile_cache_miss");
+            const bool bVisible = x >= nVisX0 && x <= nVisX1 && y >= nVisY0 && y <= nVisY1;
+            const double dfDX = (x + 0.5) * dfSpan - m_dfCenterX;
+            const double dfDY = (y + 0.5) * dfSpan - m_dfCenterY;
+            wanted.push_back(std::make_pair((bVisible? 0.0 : 1e30) + dfDX * dfDX + dfDY * dfDY, key));
+        }
+    }
+    std::sort(wanted.begin(), wanted.end(),
+              [](const std::pair<double, TileKey>& a, const std::pair<double, TileKey>& b){
+                  return a.first < b.first;
+              });
+
+    // 替换待渲染队列，不再可见的瓦片不再渲染
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.clear();
+    for(size_t i=0;i<wanted.size();++i){
+        if(m_rendering.count(wanted[i].second) == 0){
+            m_queue.push_back(wanted[i].second);
+        }
+    }
+    while(m_nWorkers < m_pool.maxThreadCount() && static_cast<size_t>(m_nWorkers) < m_queue.size()){
+        m_nWorkers += 1;
+        m_pool.start(new Worker(this));
+    }
+}
+
+void TileScene::OnTileRendered(const TileKey& key, const Tile& tile)
+{
+    if(!m_source || key.nSource != m_source->Id()){
+        return;
+    }
+    InsertTile(key, tile);
+    emit changed();
+}
+
+void TileScene::Paint(QPainter& painter, const QSize& viewSize, bool bStretched) const
+{
+    rsisa::TraceScope scope("paint");
+    if(m_nXSize == 0 || m_nYSize == 0){
+        return;
+    }
+    // 先画整幅预览图，再画已渲染的瓦片
+    const QImage& preview = bStretched? m_previewStretched : m_previewOriginal;
+    if(!preview.isNull()){
+        painter.drawImage(ViewRect(0, 0, m_nXSize, m_nYSize, viewSize), preview);
+    }
+    const int nLevel = CurrentLevel();
+    int nX0 = 0, nY0 = 0, nX1 = -1, nY1 = -1;
+    if(!VisibleTiles(nLevel, 0, nX0, nY0, nX1, nY1)){
+        return;
+    }
+    const int nSource = m_source->Id();
+    for(int y=nY0;y<=nY1;++y){
+        for(int x=nX0;x<=nX1;++x){
+            int nXOff = 0, nYOff = 0, nXSize = 0, nYSize = 0;
+            m_source->TileWindow(nLevel, x, y, nXOff, nYOff, nXSize, nYSize);
+            const QRectF target = ViewRect(nXOff, nYOff, nXSize, nYSize, viewSize);
+            // 没有渲染完成时用更粗一级已有的瓦片中对应的部分代替
+            for(int nParent=nLevel;nParent<m_source->LevelCount();++nParent){
+                const int nShift = nParent - nLevel;
+                const TileKey key = {nSource, nParent, x >> nShift, y >> nShift};
+                const Tile* pTile = FindTile(key);
+                if(pTile == nullptr){
+                    continue;
+                }
+                int nParentXOff = 0, nParentYOff = 0, nParentXSize = 0, nParentYSize = 0;
+                m_source->TileWindow(nParent, key.nX, key.nY, nParentXOff, nParentYOff, nParentXSize, nParentYSize);
+                const double dfParentScale = static_cast<double>(1 << nParent);
+                const QRectF source((nXOff - nParentXOff) / dfParentScale, (nYOff - nParentYOff) / dfParentScale,
+                                    nXSize / dfParentScale, nYSize / dfParentScale);
+                painter.drawImage(target, bStretched? pTile->stretched : pTile->original, source);
+                break;
+            }
+        }
+    }
+}
+
+TileView::TileView(TileScene* pScene, bool bStretched, QWidget* parent)
+    : QWidget(parent), m_pScene(pScene), m_bStretched(bStretched)
+{
+    setMinimumSize(160, 120);
+    connect(m_pScene,&TileScene::changed,this,[this](){ update(); });
+}
+
+void TileView::paintEvent(QPaintEvent*)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::darkGray);
+    m_pScene->Paint(painter, size(), m_bStretched);
+}
+
+void TileView::resizeEvent(QResizeEvent*)
+{
+    m_pScene->SetViewSize(m_bStretched? 1 : 0, size());
+}
+
+void TileView::mousePressEvent(QMouseEvent* event)
+{
+    m_lastPos = event->pos();
+}
+
+void TileView::mouseMoveEvent(QMouseEvent* event)
+{
+    if(!(event->buttons() & Qt::LeftButton)){
+        return;
+    }
+    const QPoint delta = event->pos() - m_lastPos;
+    m_lastPos = event->pos();
+    m_pScene->Pan(-delta.x(), -delta.y());
+}
+
+void TileView::mouseDoubleClickEvent(QMouseEvent*)
+{
+    m_pScene->FitToView();
+}
+
+void TileView::wheelEvent(QWheelEvent* event)
+{
+    // 滚轮每格缩放1.25倍
+    const double dfFactor = std::pow(1.25, event->angleDelta().y() / 120.0);
+    m_pScene->Zoom(dfFactor, event->pos(), size());
+}
@@ -0,0 +1,129 @@
+﻿#ifndef TILEVIEW_HPP
+#define TILEVIEW_HPP
+
+#include <QImage>
+#include <QObject>
+#include <QPoint>
+#include <QRectF>
+#include <QSize>
+#include <QThreadPool>
+#include <QWidget>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "tilesource.hpp"
+
+class QPainter;
+
+// 可平移缩放的瓦片显示
+// TileScene 保存视口(缩放比例和中心点)、已渲染瓦片的缓存和待渲染队列，原图和拉伸结果两个 TileView 共用一个场景
+// 只渲染当前缩放级别下可见的瓦片和周围一圈瓦片(预取)，由后台线程按离视口中心由近到远的顺序渲染
+// 没有渲染完成的瓦片先用更粗一级的瓦片或整幅预览图代替，平移和缩放时界面线程只绘制已有的图像
+// 瓦片缓存按最近使用顺序淘汰，总量不超过配置项RSISA_TILE_CACHE_MB(默认256MB)
+class TileScene : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TileScene(QObject* parent = nullptr);
+    ~TileScene();
+
+    // 打开新影像：清空瓦片和预览图，缩放到整幅影像可见
+    void Reset(int nXSize, int nYSize);
+    // 整幅影像的预览图，瓦片没有渲染完成时显示
+    void SetPreview(const QImage& original, const QImage& stretched);
+    // 切换渲染参数，之后只显示新参数下的瓦片
+    void SetSource(const std::shared_ptr<const TileSource>& source);
+    // 生成新的渲染参数编号
+    int NewSourceId() { return m_nSourceCount++; }
+
+    // 第iView个视图(0为原图，1为拉伸结果)的大小
+    void SetViewSize(int iView, const QSize& size);
+    // 按显示像素平移
+    void Pan(double dfDX, double dfDY);
+    // 以视图中的anchor点为中心缩放
+    void Zoom(double dfFactor, const QPoint& anchor, const QSize& viewSize);
+    void FitToView();
+
+    // 绘制大小为viewSize的视图
+    void Paint(QPainter& painter, const QSize& viewSize, bool bStretched) const;
+
+signals:
+    // 视口、预览图或瓦片改变，视图需要重绘
+    void changed();
+    // 后台线程渲染完成一个瓦片(队列连接到界面线程)
+    void tileRendered(const TileKey& key, const Tile& tile);
+
+private:
+    class Worker;
+
+    // 当前视口使用的级别：瓦片像素不少于显示像素的最粗一级
+    int CurrentLevel() const;
+    // 视口在第nLevel级上覆盖的瓦片范围，nMargin为向外扩展的瓦片数
+    bool VisibleTiles(int nLevel, int nMargin, int& nX0, int& nY0, int& nX1, int& nY1) const;
+    // 原影像上的矩形在视图中的位置
+    QRectF ViewRect(double dfX, double dfY, double dfXSize, double dfYSize, const QSize& viewSize) const;
+    const Tile* FindTile(const TileKey& key) const;
+    void InsertTile(const TileKey& key, const Tile& tile);
+    // 按当前视口更新待渲染队列并启动后台线程
+    void UpdateRequests();
+    void OnTileRendered(const TileKey& key, const Tile& tile);
+
+    int    m_nXSize;            // 影像大小，没有影像时为0
+    int    m_nYSize;
+    double m_dfScale;           // 显示像素/影像像素
+    double m_dfCenterX;         // 视图中心对应的影像坐标
+    double m_dfCenterY;
+    QSize  m_viewSizes[2];
+    QImage m_previewOriginal;
+    QImage m_previewStretched;
+    int    m_nSourceCount;
+
+    struct TileEntry
+    {
+        Tile tile;
+        std::list<TileKey>::iterator itLru;
+    };
+    std::map<TileKey, TileEntry> m_tiles;
+    std::list<TileKey> m_lru;   // 最近使用的在前
+    size_t m_nTileBytes;
+    size_t m_nTileBudget;
+
+    // 以下成员由后台线程共享，访问时加锁(m_source只在界面线程中修改)
+    std::mutex m_mutex;
+    std::shared_ptr<const TileSource> m_source;
+    std::deque<TileKey> m_queue;    // 待渲染的瓦片，按优先顺序
+    std::set<TileKey> m_rendering;  // 正在渲染的瓦片
+    int m_nWorkers;                 // 正在运行的后台线程数
+    QThreadPool m_pool;
+};
+
+// 显示场景中的原图或拉伸结果，拖动平移，滚轮缩放，双击缩放到整幅影像
+class TileView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    TileView(TileScene* pScene, bool bStretched, QWidget* parent = nullptr);
+
+protected:
+    void paintEvent(QPaintEvent* event) override;
+    void resizeEvent(QResizeEvent* event) override;
+    void mousePressEvent(QMouseEvent* event) override;
+    void mouseMoveEvent(QMouseEvent* event) override;
+    void mouseDoubleClickEvent(QMouseEvent* event) override;
+    void wheelEvent(QWheelEvent* event) override;
+
+private:
+    TileScene* m_pScene;
+    bool m_bStretched;
+    QPoint m_lastPos;           // 拖动时上一次的鼠标位置
+};
+
+#endif // TILEVIEW_HPP
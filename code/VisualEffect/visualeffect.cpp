@@ -1,412 +1,410 @@
-﻿#include "visualeffect.hpp"
-
-#include <gdal.h>
-#include <cpl_auto_close.h>
-
-#include <QLabel>
-#include <QLineEdit>
-#include <QPushButton>
-#include <QComboBox>
-#include <QSpinBox>
-#include <QSplitter>
-#include <QHBoxLayout>
-#include <QVBoxLayout>
-#include <QFileDialog>
-#include <QDebug>
-
-#include <algorithm>
-#include <cmath>
-#include <cfloat>
-
-#ifndef PI
-#define PI 3.141592653589793
-#endif
-
-namespace std
-{
-template<typename T>
-inline T clamp(T minval, T val, T maxval)
-{
-    return (minval > val)? minval : (maxval < val)? maxval: val;
-}
-
-// 标准正态分布函数
-// 期望值μ=0，即曲线图象对称轴为Y轴，标准差σ=1条件下的正态分布
-double stdnormpdf(double x)
-{
-  return( (1.0 / sqrt(2.0 * PI))*exp(-0.5*x*x));
-}
-
-// 正态分布概率密度函数
-// mu    数学期望(平均值)
-// sigma 标准差
-double normpdf(double x, double mu, double sigma)
-{
-  return( (1.0 /(sigma *  sqrt(2.0 * PI))) * exp( -1 * (x-mu)*(x-mu)/(2*sigma*sigma)));
-}
-
-}
-
-
-VisualEffect::VisualEffect(QWidget *parent)
-    : QWidget(parent)
-{
-    GDALAllRegister();
-
-    QLineEdit* pLned = new QLineEdit(this);
-    QPushButton* pBtnSelFile = new QPushButton(QStringLiteral("选择影像文件"),this);
-    QPushButton* pBtnUpdate = new QPushButton(QStringLiteral("刷新显示"),this);
-
-    QHBoxLayout* pHLayout1 = new QHBoxLayout;
-    pHLayout1->addWidget(pLned);
-    pHLayout1->addWidget(pBtnSelFile);
-    pHLayout1->addWidget(pBtnUpdate);
-
-
-    QLabel* pLab = new QLabel(QStringLiteral("选择RGB波段序号"),this);
-    QSpinBox* pSBoxR = new QSpinBox(this);
-    QSpinBox* pSBoxG = new QSpinBox(this);
-    QSpinBox* pSBoxB = new QSpinBox(this);
-
-    QComboBox* pCBox = new QComboBox(this);
-    pCBox->addItems({QStringLiteral("线性拉伸"),
-                     QStringLiteral("2%线性拉伸"),
-                     QStringLiteral("直方图均衡化"),
-                     QStringLiteral("直方图规定化(正态分布)")});
-
-    QHBoxLayout* pHLayout2 = new QHBoxLayout;
-    pHLayout2->addWidget(pLab);
-    pHLayout2->addWidget(pSBoxR);
-    pHLayout2->addWidget(pSBoxG);
-    pHLayout2->addWidget(pSBoxB);
-    pHLayout2->addStretch();
-    pHLayout2->addWidget(pCBox);
-
-
-    QLabel* pLab1 = new QLabel(QStringLiteral("显示原图"),this);
-    QLabel* pLab2 = new QLabel(QStringLiteral("显示处理图"),this);
-
-    QSplitter* pSpt = new QSplitter;
-    pSpt->addWidget(pLab1);
-    pSpt->addWidget(pLab2);
-
-    QVBoxLayout* pVLayout = new QVBoxLayout(this);
-    pVLayout->addItem(pHLayout1);
-    pVLayout->addItem(pHLayout2);
-    pVLayout->addWidget(pSpt);
-
-    this->resize(640,480);
-
-    // 选择文件按钮单击处理
-    connect(pBtnSelFile,&QPushButton::clicked,[=](){
-        QString filename = QFileDialog::getOpenFileName(this,
-                                                        QStringLiteral("打开影像文件"),
-                                                        QStringLiteral("."),
-                                                        QStringLiteral("Images (*.tif *.tiff *.img *.jpg *.jpeg)"));
-        if(filename.isEmpty()){
-            return;
-        }
-        pLned->setText(filename);
-        // 打开影像
-        QByteArray u8filename = filename.toUtf8();
-        std::string u8fnstr(u8filename.data(),static_cast<size_t>(u8filename.size()));
-        GDALDatasetH hDset = GDALOpen(u8fnstr.c_str(),GA_ReadOnly);
-        CPL_AUTO_CLOSE_WARP(hDset,GDALClose);
-        if(hDset == nullptr){ return; }
-
-        // 获取波段信息
-        int nBands = GDALGetRasterCount(hDset);
-        if(nBands==0){ return; }
-        pSBoxR->setRange(1,nBands); pSBoxR->setValue(1);
-        pSBoxG->setRange(1,nBands); pSBoxG->setValue(std::min(2,nBands));
-        pSBoxB->setRange(1,nBands); pSBoxB->setValue(std::min(3,nBands));
-
-        // 获取影像大小信息
-        int nXSize = GDALGetRasterXSize(hDset);
-        int nYSize = GDALGetRasterYSize(hDset);
-
-        // 读取影像数据(全部读取为double类型)
-        int nTypeBytes = GDALGetDataTypeSizeBytes(GDT_Float64);
-        QByteArray buffer(nTypeBytes*nXSize*nYSize*nBands,'\0');
-        double* pBuffer = reinterpret_cast<double*>(buffer.data());
-        CPLErr err = GDALDatasetRasterIO(hDset,GF_Read,
-                                         0,0,nXSize,nYSize,
-                                         pBuffer,nXSize,nYSize,GDT_Float64,
-                                         nBands,nullptr,
-                                         nTypeBytes,nTypeBytes*nXSize,nTypeBytes*nXSize*nYSize);
-        if(err != CE_None){
-            qDebug()<<CPLGetLastErrorMsg();
-            return;
-        }
-
-        this->setProperty("nBands",QVariant(nBands));
-        this->setProperty("nXSize",QVariant(nXSize));
-        this->setProperty("nYSize",QVariant(nYSize));
-        this->setProperty("buffer",QVariant(buffer));
-    });
-
-    // 刷新显示按钮单击处理
-    connect(pBtnUpdate,&QPushButton::clicked,[=](){
-        QString Alg = pCBox->currentText();
-        const int nBands = this->property("nBands").toInt();
-        const int nXSize = this->property("nXSize").toInt();
-        const int nYSize = this->property("nYSize").toInt();
-        QByteArray buffer = this->property("buffer").toByteArray();
-        if(nBands == 0 || nXSize == 0 || nYSize == 0
-                || buffer.isEmpty()){
-            return;
-        }
-        const double* pBuffer = reinterpret_cast<const double*>(buffer.data());
-        const int iRBand = pSBoxR->value();
-        const int iGBand = pSBoxG->value();
-        const int iBBand = pSBoxB->value();
-        const double* pRBuffer = pBuffer + (nXSize*nYSize*(iRBand-1));
-        const double* pGBuffer = pBuffer + (nXSize*nYSize*(iGBand-1));
-        const double* pBBuffer = pBuffer + (nXSize*nYSize*(iBBand-1));
-
-        {
-            QImage image(nXSize,nYSize,QImage::Format_RGB888);
-            uchar* pOut = image.bits();
-            for(int y = 0;y<nYSize;++y){
-                for(int x=0; x<nXSize;++x){
-                    uchar* pPixel = pOut + (y*nXSize+x)*3;
-                    pPixel[0] = static_cast<uchar>(pRBuffer[y*nXSize+x]);
-                    pPixel[1] = static_cast<uchar>(pGBuffer[y*nXSize+x]);
-                    pPixel[2] = static_cast<uchar>(pBBuffer[y*nXSize+x]);
-                    // limage.setPixelColor(x,y,QColor(r,g,b));
-                }
-            }
-            pLab1->setPixmap(QPixmap::fromImage(image.scaledToWidth(640)));
-        }
-
-        {
-            // 统计三个波段的最大最小值
-            // auto mimmaxpair = std::minmax_element(pRBuffer,pRBuffer+(nXSize*nYSize));
-            // const double dfRMin = *mimmaxpair.first; const double dfRMax = *mimmaxpair.second;
-            // mimmaxpair = std::minmax_element(pGBuffer,pGBuffer+(nXSize*nYSize));
-            // const double dfGMin = *mimmaxpair.first; const double dfGMax = *mimmaxpair.second;
-            // mimmaxpair = std::minmax_element(pBBuffer,pBBuffer+(nXSize*nYSize));
-            // const double dfBMin = *mimmaxpair.first; const double dfBMax = *mimmaxpair.second;
-
-            // 不包括无效值0 统计最大最小值
-            double dfRMin = DBL_MAX,dfGMin = DBL_MAX,dfBMin = DBL_MAX;
-            double dfRMax = -DBL_MAX,dfGMax = -DBL_MAX,dfBMax = -DBL_MAX;
-            // 统计有效像素个数(至少有一个波段不为0)，累计值
-            double dfRSum = 0.0, dfGSum = 0.0, dfBSum = 0.0;
-            size_t nPixelCount = 0;
-            for(int i=0;i<nXSize*nYSize;++i){
-                double v = pRBuffer[i];
-                double isValid = v; dfRSum += v;
-                if(v != 0.0){ dfRMin = std::min(dfRMin,v); dfRMax = std::max(dfRMax,v); }
-
-                v = pGBuffer[i];
-                dfGSum += v; isValid = (v != 0? v:isValid);
-                if(v != 0.0){ dfGMin = std::min(dfRMin,v); dfGMax = std::max(dfRMax,v); }
-
-                v = pBBuffer[i];
-                dfBSum += v; isValid = (v != 0? v:isValid);
-                if(v != 0.0){ dfBMin = std::min(dfRMin,v); dfBMax = std::max(dfRMax,v); }
-                // 三个都为0，才认为像素无效
-                if(isValid){ nPixelCount += 1; }
-
-                // double valueR = pRBuffer[i];
-                // double valueG = pGBuffer[i];
-                // double valueB = pBBuffer[i];
-                // 三个都为0，才认为像素无效
-                // if(valueR == 0.0 && valueG == 0.0 && valueB == 0.0){
-                //     continue;
-                // }
-                // nPixelCount += 1;
-                // dfRSum += valueR;
-                // dfGSum += valueG;
-                // dfBSum += valueB;
-                // dfRMin = std::min(dfRMin,valueR); dfRMax = std::max(dfRMax,valueR);
-                // dfGMin = std::min(dfGMin,valueG); dfGMax = std::max(dfGMax,valueG);
-                // dfBMin = std::min(dfBMin,valueB); dfBMax = std::max(dfBMax,valueB);
-            }
-
-            QImage image(nXSize,nYSize,QImage::Format_RGBA8888);
-            uchar* pOut = image.bits();
-
-            if(Alg == QStringLiteral("线性拉伸")) {
-                for(int y = 0;y<nYSize;++y){
-                    for(int x=0; x<nXSize;++x){
-                        uchar* pPixel = pOut + (y*nXSize+x)*4;
-
-                        double valueR = pRBuffer[y*nXSize+x];
-                        double valueG = pGBuffer[y*nXSize+x];
-                        double valueB = pBBuffer[y*nXSize+x];
-                        // 判断是否是无效像素
-                        if(valueR == 0.0 && valueG == 0.0 && valueB == 0.0){
-                            pPixel[3] = 0.0; continue;
-                        }
-
-                        // 0-255线性映射到[最小值,最大值]。
-                        pPixel[0] = static_cast<uchar>((valueR -dfRMin)/(dfRMax-dfRMin) *255.0);
-                        pPixel[1] = static_cast<uchar>((valueG -dfGMin)/(dfGMax-dfGMin) *255.0);
-                        pPixel[2] = static_cast<uchar>((valueB -dfBMin)/(dfBMax-dfBMin) *255.0);
-                        pPixel[3] = 255;
-                        // limage.setPixelColor(x,y,QColor(r,g,b));
-                    }
-                }
-            }
-            else if(Alg == QStringLiteral("2%线性拉伸")) {
-                double diff = dfRMax-dfRMin;
-                dfRMin += diff * 0.02; dfRMax -= diff * 0.02;
-                diff = dfGMax-dfGMin;
-                dfGMin += diff * 0.02; dfGMax -= diff * 0.02;
-                diff = dfBMax-dfBMin;
-                dfBMin += diff * 0.02; dfBMax -= diff * 0.02;
-
-                for(int y = 0;y<nYSize;++y){
-                    for(int x=0; x<nXSize;++x){
-                        uchar* pPixel = pOut + (y*nXSize+x)*4;
-
-                        double valueR = pRBuffer[y*nXSize+x];
-                        double valueG = pGBuffer[y*nXSize+x];
-                        double valueB = pBBuffer[y*nXSize+x];
-                        // 判断是否是无效像素
-                        if(valueR == 0.0 && valueG == 0.0 && valueB == 0.0){
-                            pPixel[3] = 0.0; continue;
-                        }
-                        // 相当于0-255线性映射到[最小值+2%,最大值-%2]
-                        // 这里应该考虑像素值与最小值相减为负数的情况，已经映射值超过255的情况
-                        pPixel[0] = static_cast<uchar>(std::clamp(0.0, ((valueR -dfRMin)/(dfRMax-dfRMin) *255.0),255.0));
-                        pPixel[1] = static_cast<uchar>(std::clamp(0.0, ((valueG -dfGMin)/(dfGMax-dfGMin) *255.0),255.0));
-                        pPixel[2] = static_cast<uchar>(std::clamp(0.0, ((valueB -dfBMin)/(dfBMax-dfBMin) *255.0),255.0));
-                        pPixel[3] = 255;
-                        // limage.setPixelColor(x,y,QColor(r,g,b));
-                    }
-                }
-            }
-            else if(Alg == QStringLiteral("直方图均衡化")){
-                // 计算直方图，将RGB各个波段在最大最小值之间分为1024个灰度级进行统计
-                std::vector<double> histogramR(1024,0);
-                std::vector<double> histogramG(1024,0);
-                std::vector<double> histogramB(1024,0);
-                for(int i=0;i<nXSize*nYSize;++i){
-                    double valueR = pRBuffer[i];
-                    double valueG = pGBuffer[i];
-                    double valueB = pBBuffer[i];
-                    if(valueR !=0.0 || valueG != 0.0 || valueB != 0.0){
-                        histogramR[std::clamp<int>(0,((valueR-dfRMin)*1024/(dfRMax-dfRMin)),1023)] += 1;
-                        histogramG[std::clamp<int>(0,((valueG-dfGMin)*1024/(dfGMax-dfGMin)),1023)] += 1;
-                        histogramB[std::clamp<int>(0,((valueB-dfBMin)*1024/(dfGMax-dfBMin)),1023)] += 1;
-                    }
-                }
-                // 下面两个计算可以合二为一
-                // 计算为概率值
-                double factor = 1.0/nPixelCount;
-                for(size_t i=0;i<1024;++i){
-                    histogramR[i] *= factor;
-                    histogramG[i] *= factor;
-                    histogramB[i] *= factor;
-                }
-                // 计算颜色表(计算1024个灰度级别，按出现概率映射的0-255的值)
-                // 颜色值重新映射后再计算直方图，应该每个像素值出现的概率是相同的
-                double cdfR = 0, cdfB = 0, cdfG = 0;
-                std::vector<uchar> cltR(1024,0);    // color lookup table
-                std::vector<uchar> cltG(1024,0);
-                std::vector<uchar> cltB(1024,0);
-                for(size_t i=0;i<1024;++i){
-                    cdfR += histogramR[i]; cltR[i] = static_cast<uchar>(cdfR*255);
-                    cdfG += histogramG[i]; cltG[i] = static_cast<uchar>(cdfG*255);
-                    cdfB += histogramB[i]; cltB[i] = static_cast<uchar>(cdfB*255);
-                }
-                // 输出RGBA图像
-                for(int y = 0;y<nYSize;++y){
-                    for(int x=0; x<nXSize;++x){
-                        uchar* pPixel = pOut + (y*nXSize+x)*4;
-                        double valueR = pRBuffer[y*nXSize+x];
-                        double valueG = pGBuffer[y*nXSize+x];
-                        double valueB = pBBuffer[y*nXSize+x];
-                        // 判断是否是无效像素
-                        if(valueR == 0.0 && valueG == 0.0 && valueB == 0.0){
-                            pPixel[3] = 0.0; continue;
-                        }
-                        pPixel[0] = cltR[std::clamp<int>(0,((valueR-dfRMin)*1024/(dfRMax-dfRMin)),1023)];
-                        pPixel[1] = cltG[std::clamp<int>(0,((valueG-dfGMin)*1024/(dfGMax-dfGMin)),1023)];
-                        pPixel[2] = cltB[std::clamp<int>(0,((valueB-dfBMin)*1024/(dfGMax-dfBMin)),1023)];
-                        pPixel[3] = 255;
-                    }
-                }
-            }
-            else if(Alg == QStringLiteral("直方图规定化(正态分布)")){
-                // 直方图规定化即以一个给定的直方图来替代原图的直方图
-                // 这里直接用正态分布概率密度曲线（高斯曲线）来替代
-                // 计算三个波段的平均值和标准差
-                double dfRMean = dfRSum / nPixelCount;
-                double dfGMean = dfGSum / nPixelCount;
-                double dfBMean = dfBSum / nPixelCount;
-                double dfRStddev = 0.0, dfGStddev = 0.0, dfBStddev = 0.0;
-                for(int i=0;i<nXSize*nYSize;++i){
-                    double valueR = pRBuffer[i];
-                    double valueG = pGBuffer[i];
-                    double valueB = pBBuffer[i];
-                    if(valueR !=0.0 || valueG != 0.0 || valueB != 0.0){
-                       dfRStddev += (valueR - dfRMean)*(valueR - dfRMean);
-                       dfGStddev += (valueG - dfGMean)*(valueG - dfGMean);
-                       dfBStddev += (valueB - dfBMean)*(valueB - dfBMean);
-                    }
-                }
-                dfRStddev = sqrt(dfRStddev/nPixelCount);
-                dfGStddev = sqrt(dfGStddev/nPixelCount);
-                dfBStddev = sqrt(dfBStddev/nPixelCount);
-                // 将各个波段的最大最小值限制在均值左右各3倍标准差的范围内
-                dfRMin = dfRMean - dfRStddev*2.5; dfRMax = dfRMean + dfRStddev*2.5;
-                dfGMin = dfGMean - dfGStddev*2.5; dfGMax = dfGMean + dfGStddev*2.5;
-                dfBMin = dfBMean - dfBStddev*2.5; dfBMax = dfBMean + dfBStddev*2.5;
-                double dfRSpace = (dfRMax - dfRMin) / 1023.0;
-                double dfGSpace = (dfGMax - dfGMin) / 1023.0;
-                double dfBSpace = (dfBMax - dfBMin) / 1023.0;
-
-                // 根据三个波段的平均值和标准差生成直方图(概率值)
-                std::vector<double> histogramR(1024,0);
-                std::vector<double> histogramG(1024,0);
-                std::vector<double> histogramB(1024,0);
-                for(size_t i=0;i<1024;++i){
-                    histogramR[i] = std::normpdf(dfRMin + i*dfRSpace, dfRMean, dfRStddev);
-                    histogramG[i] = std::normpdf(dfGMin + i*dfGSpace, dfGMean, dfGStddev);
-                    histogramB[i] = std::normpdf(dfBMin + i*dfBSpace, dfBMean, dfBStddev);
-                }
-                // 计算颜色表(计算1024个灰度级别，按出现概率映射的0-255的值)
-                // 颜色值重新映射后再计算直方图，应该是符合正态分布概率密度曲线的
-                // 需要计算归化概率累计值到[0,255]区间的 比率系数=255/概率值总和
-                double sumHistR = std::accumulate(histogramR.begin(),histogramR.end(),0.0);
-                double sumHistG = std::accumulate(histogramG.begin(),histogramG.end(),0.0);
-                double sumHistB = std::accumulate(histogramB.begin(),histogramB.end(),0.0);
-                double cdfR = 0, cdfB = 0, cdfG = 0;
-                std::vector<uchar> cltR(1024,0);    // color lookup table
-                std::vector<uchar> cltG(1024,0);
-                std::vector<uchar> cltB(1024,0);
-                for(size_t i=0;i<1024;++i){
-                    cdfR += histogramR[i]; cltR[i] = static_cast<uchar>(cdfR*255/sumHistR);
-                    cdfG += histogramG[i]; cltG[i] = static_cast<uchar>(cdfG*255/sumHistG);
-                    cdfB += histogramB[i]; cltB[i] = static_cast<uchar>(cdfB*255/sumHistB);
-                }
-                // 输出RGBA图像
-                for(int y = 0;y<nYSize;++y){
-                    for(int x=0; x<nXSize;++x){
-                        uchar* pPixel = pOut + (y*nXSize+x)*4;
-                        double valueR = pRBuffer[y*nXSize+x];
-                        double valueG = pGBuffer[y*nXSize+x];
-                        double valueB = pBBuffer[y*nXSize+x];
-                        // 判断是否是无效像素
-                        if(valueR == 0.0 && valueG == 0.0 && valueB == 0.0){
-                            pPixel[3] = 0.0; continue;
-                        }
-                        pPixel[0] = cltR[std::clamp<int>(0,((valueR-dfRMin)/dfRSpace),1023)];
-                        pPixel[1] = cltG[std::clamp<int>(0,((valueG-dfGMin)/dfGSpace),1023)];
-                        pPixel[2] = cltB[std::clamp<int>(0,((valueB-dfBMin)/dfBSpace),1023)];
-                        pPixel[3] = 255;
-                    }
-                }
-            }
-            pLab2->setPixmap(QPixmap::fromImage(image.scaledToWidth(640)));
-        }
-    });
-}
-
-VisualEffect::~VisualEffect()
-{
-}
+﻿#include "visualeffect.hpp"
+
+#include <gdal.h>
+#include <cpl_auto_close.h>
+
+#include <QLabel>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QComboBox>
+#include <QCheckBox>
+#include <QSpinBox>
+#include <QSplitter>
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QFileDialog>
+#include <QProgressBar>
+#include <QPainter>
+#include <QDebug>
+
+#include <algorithm>
+#include <limits>
+
+#include "stretchengine.hpp"
+#include "preview.hpp"
+#include "tileview.hpp"
+#include "trace.hpp"
+
+namespace
+{
+
+// 预览图较长一边的大小，放大后的细节由瓦片显示
+const int DISPLAY_SIZE = 640;
+
+// 下拉框中的算法名称对应的拉伸算法
+rsisa::StretchAlgorithm AlgorithmFromText(const QString& Alg)
+{
+    if(Alg == QStringLiteral("线性拉伸")) {
+        return rsisa::SA_Linear;
+    }
+    else if(Alg == QStringLiteral("2%线性拉伸")) {
+        return rsisa::SA_PercentClip;
+    }
+    else if(Alg == QStringLiteral("直方图均衡化")){
+        return rsisa::SA_Equalize;
+    }
+    else if(Alg == QStringLiteral("直方图规定化(正态分布)")){
+        return rsisa::SA_GaussSpec;
+    }
+    return rsisa::SA_None;
+}
+
+// 无效值输入框的内容对应的无效值，为空时表示没有无效值
+double NoDataFromText(const QString& text)
+{
+    bool bOk = false;
+    const double dfNoData = text.trimmed().toDouble(&bOk);
+    return bOk ? dfNoData : std::numeric_limits<double>::quiet_NaN();
+}
+
+// 将逐条完成的部分图像画到整幅图像的第nYOff行
+void DrawTile(QImage& image, int nYOff, const QImage& tile)
+{
+    rsisa::TraceScope scope("draw_strip");
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(0,nYOff,tile);
+}
+
+}
+
+
+VisualEffect::VisualEffect(QWidget *parent)
+    : QWidget(parent),
+      m_nBands(0), m_nXSize(0), m_nYSize(0),
+      m_nJobCount(0), m_nRenderJob(-1), m_nExportJob(-1)
+{
+    GDALAllRegister();
+    qRegisterMetaType<RenderResultPtr>("RenderResultPtr");
+
+    QLineEdit* pLned = new QLineEdit(this);
+    QPushButton* pBtnSelFile = new QPushButton(QStringLiteral("选择影像文件"),this);
+    QPushButton* pBtnUpdate = new QPushButton(QStringLiteral("刷新显示"),this);
+    QPushButton* pBtnExport = new QPushButton(QStringLiteral("导出拉伸结果"),this);
+
+    QHBoxLayout* pHLayout1 = new QHBoxLayout;
+    pHLayout1->addWidget(pLned);
+    pHLayout1->addWidget(pBtnSelFile);
+    pHLayout1->addWidget(pBtnUpdate);
+    pHLayout1->addWidget(pBtnExport);
+
+    // 后台任务的进度，没有任务时隐藏
+    QProgressBar* pProgress = new QProgressBar(this);
+    QPushButton* pBtnCancel = new QPushButton(QStringLiteral("取消"),this);
+    pProgress->setVisible(false);
+    pBtnCancel->setVisible(false);
+    QHBoxLayout* pHLayout3 = new QHBoxLayout;
+    pHLayout3->addWidget(pProgress);
+    pHLayout3->addWidget(pBtnCancel);
+
+
+    QLabel* pLab = new QLabel(QStringLiteral("选择RGB波段序号"),this);
+    QSpinBox* pSBoxR = new QSpinBox(this);
+    QSpinBox* pSBoxG = new QSpinBox(this);
+    QSpinBox* pSBoxB = new QSpinBox(this);
+
+    QCheckBox* pChkPreview = new QCheckBox(QStringLiteral("快速预览"),this);
+    pChkPreview->setToolTip(QStringLiteral("在预览数据上统计，否则统计全分辨率数据"));
+    pChkPreview->setChecked(true);
+
+    QLabel* pLabNoData = new QLabel(QStringLiteral("无效值"),this);
+    QLineEdit* pLnedNoData = new QLineEdit(QStringLiteral("0"),this);
+    pLnedNoData->setToolTip(QStringLiteral("不参与统计的像素值，为空时所有像素都参与统计"));
+    pLnedNoData->setMaximumWidth(80);
+
+    QComboBox* pCBox = new QComboBox(this);
+    pCBox->addItems({QStringLiteral("线性拉伸"),
+                     QStringLiteral("2%线性拉伸"),
+                     QStringLiteral("直方图均衡化"),
+                     QStringLiteral("直方图规定化(正态分布)")});
+
+    QHBoxLayout* pHLayout2 = new QHBoxLayout;
+    pHLayout2->addWidget(pLab);
+    pHLayout2->addWidget(pSBoxR);
+    pHLayout2->addWidget(pSBoxG);
+    pHLayout2->addWidget(pSBoxB);
+    pHLayout2->addStretch();
+    pHLayout2->addWidget(pLabNoData);
+    pHLayout2->addWidget(pLnedNoData);
+    pHLayout2->addWidget(pChkPreview);
+    pHLayout2->addWidget(pCBox);
+
+
+    // 原图和处理图共用一个视口，同步平移缩放
+    TileView* pView1 = new TileView(&m_scene,false,this);
+    TileView* pView2 = new TileView(&m_scene,true,this);
+    pView1->setToolTip(QStringLiteral("显示原图，拖动平移，滚轮缩放，双击显示整幅影像"));
+    pView2->setToolTip(QStringLiteral("显示处理图，拖动平移，滚轮缩放，双击显示整幅影像"));
+
+    QSplitter* pSpt = new QSplitter;
+    pSpt->addWidget(pView1);
+    pSpt->addWidget(pView2);
+
+    QVBoxLayout* pVLayout = new QVBoxLayout(this);
+    pVLayout->addItem(pHLayout1);
+    pVLayout->addItem(pHLayout2);
+    pVLayout->addWidget(pSpt);
+    pVLayout->addItem(pHLayout3);
+
+    this->resize(640,480);
+
+    // 没有后台任务时隐藏进度
+    auto UpdateProgressVisible = [=](){
+        const bool bBusy = m_nRenderJob >= 0 || m_nExportJob >= 0;
+        pProgress->setVisible(bBusy);
+        pBtnCancel->setVisible(bBusy);
+        pBtnExport->setEnabled(m_nExportJob < 0);
+    };
+
+    // 选择文件按钮单击处理
+    connect(pBtnSelFile,&QPushButton::clicked,[=](){
+        QString filename = QFileDialog::getOpenFileName(this,
+                                                        QStringLiteral("打开影像文件"),
+                                                        QStringLiteral("."),
+                                                        QStringLiteral("Images (*.tif *.tiff *.img *.jpg *.jpeg)"));
+        if(filename.isEmpty()){
+            return;
+        }
+        pLned->setText(filename);
+        // 打开影像
+        QByteArray u8filename = filename.toUtf8();
+        std::string u8fnstr(u8filename.data(),static_cast<size_t>(u8filename.size()));
+        GDALDatasetH hDset = GDALOpen(u8fnstr.c_str(),GA_ReadOnly);
+        CPL_AUTO_CLOSE_WARP(hDset,GDALClose);
+        if(hDset == nullptr){ return; }
+
+        // 获取波段信息
+        int nBands = GDALGetRasterCount(hDset);
+        if(nBands==0){ return; }
+        pSBoxR->setRange(1,nBands); pSBoxR->setValue(1);
+        pSBoxG->setRange(1,nBands); pSBoxG->setValue(std::min(2,nBands));
+        pSBoxB->setRange(1,nBands); pSBoxB->setValue(std::min(3,nBands));
+
+        // 只记录影像大小，刷新时按需读取选中的三个波段(按显示大小)
+        m_nBands = nBands;
+        m_nXSize = GDALGetRasterXSize(hDset);
+        m_nYSize = GDALGetRasterYSize(hDset);
+
+        // 重新打开影像时文件可能已被修改，不再使用之前的缓存
+        CancelRender();
+        UpdateProgressVisible();
+        m_cache.Clear();
+        m_scene.Reset(m_nXSize,m_nYSize);
+    });
+
+    // 刷新显示按钮单击处理
+    connect(pBtnUpdate,&QPushButton::clicked,[=](){
+        QString Alg = pCBox->currentText();
+        const int nXSize = m_nXSize;
+        const int nYSize = m_nYSize;
+        QString filename = pLned->text();
+        if(m_nBands == 0 || nXSize == 0 || nYSize == 0
+                || filename.isEmpty()){
+            return;
+        }
+
+        // 影像或无效值改变时清空会话缓存
+        // 无效值不参与统计，三个波段都为无效值的像素输出为透明
+        const double dfNoData = NoDataFromText(pLnedNoData->text());
+        m_cache.Reset(filename,dfNoData);
+
+        const int iBands[3] = {pSBoxR->value(), pSBoxG->value(), pSBoxB->value()};
+        const rsisa::StretchAlgorithm eAlg = AlgorithmFromText(Alg);
+        const bool bPreviewStats = pChkPreview->isChecked();
+
+        CancelRender();
+        UpdateProgressVisible();
+
+        // 只读取显示大小的数据(优先使用概览)
+        int nBufXSize = 0, nBufYSize = 0;
+        rsisa::PreviewSize(nXSize,nYSize,DISPLAY_SIZE,nBufXSize,nBufYSize);
+        m_cache.SetPreviewSize(nBufXSize,nBufYSize);
+
+        // 已缓存的预览数据、统计信息和拉伸变换交给后台任务，其余在后台读取和统计
+        // 快速预览时优先使用全分辨率统计(会话缓存或磁盘缓存)，没有时在预览数据上统计
+        // 否则分块统计全分辨率数据，多个波段在一遍读取中统计
+        RenderRequest request;
+        request.filename = filename.toUtf8();
+        request.eAlg = eAlg;
+        request.bPreviewStats = bPreviewStats;
+        request.dfNoData = dfNoData;
+        request.nBufXSize = nBufXSize;
+        request.nBufYSize = nBufYSize;
+        for(int c=0;c<3;++c){
+            RenderBand& band = request.bands[c];
+            band.iBand = iBands[c];
+            band.preview = m_cache.FindPreview(iBands[c]);
+            band.stats = m_cache.FindStats(iBands[c],SessionCache::SS_Full);
+            band.eSource = SessionCache::SS_Full;
+            if(!band.stats && bPreviewStats){
+                band.stats = m_cache.FindStats(iBands[c],SessionCache::SS_Preview);
+                band.eSource = SessionCache::SS_Preview;
+            }
+            if(band.stats){
+                band.transform = m_cache.Transform(iBands[c],band.eSource,eAlg);
+            }
+            rsisa::TraceCount(band.preview? "session_preview_hit" : "session_preview_miss");
+            rsisa::TraceCount(band.stats? "session_stats_hit" : "session_stats_miss");
+        }
+
+        // 同样的波段、算法和统计方式已经输出过时直接显示
+        const SessionCache::OutputKey key = {{iBands[0], iBands[1], iBands[2]}, eAlg, bPreviewStats};
+        const SessionCache::Output* pCached = m_cache.FindOutput(key);
+        if(pCached != nullptr){
+            rsisa::TraceCount("session_output_hit");
+            ShowResult(request,*pCached);
+            return;
+        }
+
+        m_original = QImage(nBufXSize,nBufYSize,QImage::Format_RGBA8888);
+        m_original.fill(Qt::transparent);
+        m_stretched = m_original;
+        m_nRenderJob = m_nJobCount++;
+        m_renderCancelled = std::make_shared<std::atomic<bool> >(false);
+        m_jobPool.start(new RenderJob(m_nRenderJob,request,m_renderCancelled,&m_notifier));
+        pProgress->setValue(0);
+        UpdateProgressVisible();
+    });
+
+    // 切换算法时取消正在进行的刷新并按新算法刷新
+    connect(pCBox,&QComboBox::currentTextChanged,[=](){
+        pBtnUpdate->click();
+    });
+
+    // 逐条显示已完成的部分
+    connect(&m_notifier,&JobNotifier::tileReady,this,[=](int nJob, int nYOff, const QImage& original, const QImage& stretched){
+        if(nJob != m_nRenderJob){ return; }
+        DrawTile(m_original,nYOff,original);
+        if(!stretched.isNull()){
+            DrawTile(m_stretched,nYOff,stretched);
+        }
+        m_scene.SetPreview(m_original,m_stretched);
+    });
+
+    // 刷新完成：保存后台任务读取和统计的数据，显示最终结果
+    connect(&m_notifier,&JobNotifier::rendered,this,[=](int nJob, const RenderResultPtr& result){
+        if(nJob != m_nRenderJob){ return; }
+        m_nRenderJob = -1;
+        UpdateProgressVisible();
+        const RenderRequest& request = result->request;
+        for(int c=0;c<3;++c){
+            const RenderBand& band = request.bands[c];
+            if(!m_cache.FindPreview(band.iBand)){
+                m_cache.InsertPreview(band.iBand,band.preview);
+            }
+            if(!m_cache.FindStats(band.iBand,band.eSource)){
+                m_cache.InsertStats(band.iBand,band.eSource,band.stats);
+            }
+            m_cache.InsertTransform(band.iBand,band.eSource,request.eAlg,band.transform);
+        }
+        const SessionCache::OutputKey key = {{request.bands[0].iBand, request.bands[1].iBand, request.bands[2].iBand},
+                                             request.eAlg, request.bPreviewStats};
+        m_cache.InsertOutput(key,result->output);
+        m_original = QImage();
+        m_stretched = QImage();
+        ShowResult(request,result->output);
+        // 开启记录时每次刷新完成后输出累计的各阶段耗时
+        if(rsisa::IsTraceEnabled()){
+            qDebug().noquote()<<QString::fromUtf8(rsisa::TraceSummary().c_str());
+        }
+    });
+
+    // 导出按钮单击处理：分块统计和拉伸，不需要将整幅影像读入内存
+    connect(pBtnExport,&QPushButton::clicked,[=](){
+        QString filename = pLned->text();
+        if(filename.isEmpty()){
+            return;
+        }
+        QString dstname = QFileDialog::getSaveFileName(this,
+                                                       QStringLiteral("导出拉伸结果"),
+                                                       QStringLiteral("."),
+                                                       QStringLiteral("GeoTIFF (*.tif *.tiff)"));
+        if(dstname.isEmpty()){
+            return;
+        }
+        const int iBands[3] = {pSBoxR->value(), pSBoxG->value(), pSBoxB->value()};
+        m_nExportJob = m_nJobCount++;
+        m_exportCancelled = std::make_shared<std::atomic<bool> >(false);
+        m_jobPool.start(new ExportJob(m_nExportJob,filename.toUtf8(),dstname,iBands,
+                                      AlgorithmFromText(pCBox->currentText()),
+                                      NoDataFromText(pLnedNoData->text()),
+                                      m_exportCancelled,&m_notifier));
+        pProgress->setValue(0);
+        UpdateProgressVisible();
+    });
+
+    connect(&m_notifier,&JobNotifier::exported,this,[=](int nJob, const QString&){
+        if(nJob != m_nExportJob){ return; }
+        m_nExportJob = -1;
+        UpdateProgressVisible();
+    });
+
+    // 显示当前任务的进度
+    connect(&m_notifier,&JobNotifier::progress,this,[=](int nJob, const QString& stage, int nPercent){
+        if(nJob != m_nRenderJob && nJob != m_nExportJob){ return; }
+        pProgress->setFormat(stage + QStringLiteral(" %p%"));
+        pProgress->setValue(nPercent);
+    });
+
+    // 任务失败或被取消，取消时没有错误信息
+    connect(&m_notifier,&JobNotifier::failed,this,[=](int nJob, const QString& message){
+        if(nJob != m_nRenderJob && nJob != m_nExportJob){ return; }
+        if(!message.isEmpty()){
+            qDebug()<<message;
+        }
+        if(nJob == m_nRenderJob){ m_nRenderJob = -1; }
+        if(nJob == m_nExportJob){ m_nExportJob = -1; }
+        UpdateProgressVisible();
+    });
+
+    connect(pBtnCancel,&QPushButton::clicked,[=](){
+        CancelRender();
+        CancelExport();
+        UpdateProgressVisible();
+    });
+}
+
+VisualEffect::~VisualEffect()
+{
+    // 任务在工作线程中使用m_notifier，等待全部任务结束
+    CancelRender();
+    CancelExport();
+    m_jobPool.waitForDone();
+
+    // 配置项RSISA_TRACE为.json文件名时写出整个会话的记录
+    const std::string osTrace = rsisa::TraceOutputFile();
+    if(!osTrace.empty()){
+        rsisa::WriteTraceJson(osTrace.c_str());
+    }
+}
+
+void VisualEffect::CancelRender()
+{
+    if(m_renderCancelled){
+        *m_renderCancelled = true;
+    }
+    m_nRenderJob = -1;
+}
+
+void VisualEffect::CancelExport()
+{
+    if(m_exportCancelled){
+        *m_exportCancelled = true;
+    }
+    m_nExportJob = -1;
+}
+
+void VisualEffect::ShowResult(const RenderRequest& request, const SessionCache::Output& output)
+{
+    // 预览图先显示，放大后可见的瓦片用同样的拉伸变换按需渲染
+    m_scene.SetPreview(output.original,output.stretched);
+    const int iBands[3] = {request.bands[0].iBand, request.bands[1].iBand, request.bands[2].iBand};
+    const SessionCache::TransformPtr transforms[3] = {request.bands[0].transform,
+                                                      request.bands[1].transform,
+                                                      request.bands[2].transform};
+    if(!transforms[0] || !transforms[1] || !transforms[2]){
+        return;
+    }
+    m_scene.SetSource(std::make_shared<TileSource>(m_scene.NewSourceId(),request.filename,m_nXSize,m_nYSize,
+                                                   iBands,request.dfNoData,transforms));
+}
@@ -1,15 +1,44 @@
-#ifndef VISUALEFFECT_HPP
-#define VISUALEFFECT_HPP
-
-#include <QWidget>
-
-class VisualEffect : public QWidget
-{
-    Q_OBJECT
-
-public:
-    VisualEffect(QWidget *parent = 0);
-    ~VisualEffect();
-};
-
-#endif // VISUALEFFECT_HPP
+﻿#ifndef VISUALEFFECT_HPP
+#define VISUALEFFECT_HPP
+
+#include <QImage>
+#include <QThreadPool>
+#include <QWidget>
+
+#include "renderjob.hpp"
+#include "sessioncache.hpp"
+#include "tileview.hpp"
+
+class VisualEffect : public QWidget
+{
+    Q_OBJECT
+
+public:
+    VisualEffect(QWidget *parent = 0);
+    ~VisualEffect();
+
+private:
+    // 取消正在进行的刷新任务，之后收到的该任务的信号都被忽略
+    void CancelRender();
+    void CancelExport();
+    // 显示刷新结果，并按结果的拉伸变换渲染放大后的瓦片
+    void ShowResult(const RenderRequest& request, const SessionCache::Output& output);
+
+    int m_nBands;           // 当前影像的波段数和大小，没有打开影像时为0
+    int m_nXSize;
+    int m_nYSize;
+    SessionCache m_cache;   // 当前影像的预览数据、统计信息、拉伸变换和输出图像缓存
+
+    JobNotifier m_notifier; // 后台任务的信号
+    QThreadPool m_jobPool;  // 执行刷新和导出任务
+    int m_nJobCount;        // 已开始的任务个数，用于生成任务编号
+    int m_nRenderJob;       // 当前刷新任务的编号，没有时为-1
+    int m_nExportJob;       // 当前导出任务的编号，没有时为-1
+    CancelFlag m_renderCancelled;
+    CancelFlag m_exportCancelled;
+    QImage m_original;      // 刷新中逐条显示的原图和拉伸结果
+    QImage m_stretched;
+    TileScene m_scene;      // 原图和处理图共用的视口和瓦片缓存
+};
+
+#endif // VISUALEFFECT_HPP
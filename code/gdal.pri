@@ -0,0 +1,17 @@
+# GDAL 头文件和库
+# 各子项目 include 此文件
+
+unix:!macx {
+    INCLUDEPATH += $$PWD/VisualEffect/3rd/gdal/include
+    LIBS += -L$$PWD/VisualEffect -lgdal_i
+}
+else:win32-g++ {
+    INCLUDEPATH += C:/msys64/mingw64/inlude
+    LIBS += -L/mingw64/lib/ -lgdal
+    # 拷贝所需动态库
+    # ldd VisualEffect.exe |grep /mingw64/bin/|awk '{print $3}'|xargs -I{} cp {} ./
+}
+else:win32:!win32-g++ {
+    INCLUDEPATH += $$PWD/VisualEffect/3rd/gdal/include
+    LIBS += -L$$PWD/../ -lgdal_i
+}
@@ -1,4 +1,11 @@
-TEMPLATE = subdirs
-
-SUBDIRS += \
-    VisualEffect
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    StretchEngine \
+    StretchBatch \
+    StretchBench \
+    VisualEffect
+
+StretchBatch.depends = StretchEngine
+StretchBench.depends = StretchEngine
+VisualEffect.depends = StretchEngine